@@ -0,0 +1,402 @@
+// Database operations benchmark.
+//
+// Generates a synthetic database and times installing its packages into
+// an empty database, relinking it serially and on multiple threads, the
+// integrity check, filtered queries, storing and loading it with and
+// without compression and deleting packages. Every operation is repeated
+// and the best and mean times are reported, with -J as a JSON object
+// which can be kept to compare revisions.
+//
+// The packages are generated from a seed, so a given set of options always
+// produces the same database: package N's objects need libraries of
+// packages before it with the same ELF class, a few needed libraries
+// exist nowhere, some objects carry an rpath and every package ships a
+// file list and depends on the packages it links to.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <elf.h>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+#include "../main.h"
+
+#ifdef PKGDEPDB_ENABLE_THREADS
+#  include <thread>
+#endif
+
+#include "../elf.h"
+#include "../package.h"
+#include "../db.h"
+#include "../filter.h"
+#include "../writer.h"
+#include "../stats.h"
+#include "../thread.h"
+
+using namespace pkgdepdb;
+
+struct Options {
+  unsigned long packages   = 2000;
+  unsigned long objects    = 4;    // per package
+  unsigned long needed     = 6;    // per object
+  unsigned long files      = 20;   // per package, besides the objects
+  unsigned long abi32      = 10;   // percentage of 32 bit packages
+  unsigned long rpath      = 20;   // percentage of objects with an rpath
+  unsigned long missing    = 2;    // percentage of needed names not found
+  unsigned long rounds     = 3;
+  unsigned long jobs       = 0;
+  unsigned long seed       = 1;
+  bool          json       = false;
+  const char   *dir        = nullptr;
+};
+
+static string package_name(unsigned long i) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "pkg%05lu", i);
+  return buf;
+}
+
+static string library_name(unsigned long pkg, unsigned long obj) {
+  char buf[48];
+  snprintf(buf, sizeof(buf), "libp%05lu_%lu.so.1", pkg, obj);
+  return buf;
+}
+
+static PackageList generate(const Options &opts) {
+  std::mt19937 rng(opts.seed);
+  auto percent = [&rng](unsigned long p) { return rng() % 100 < p; };
+
+  PackageList packages;
+  vec<unsigned long> by_class[2];
+  for (unsigned long i = 0; i != opts.packages; ++i) {
+    bool is32 = percent(opts.abi32);
+    auto &earlier = by_class[is32];
+
+    Package *pkg = new Package;
+    pkg->name_        = package_name(i);
+    pkg->version_     = "1.0-1";
+    pkg->description_ = "synthetic package " + pkg->name_;
+    if (i % 10 == 0)
+      pkg->groups_.insert(i % 20 ? "base" : "devel");
+    if (i % 7 == 0)
+      pkg->provides_.emplace_back(pkg->name_ + "-compat", "=1.0");
+
+    const char *libdir = is32 ? "/usr/lib32" : "/usr/lib";
+    StringSet depends;
+    for (unsigned long o = 0; o != opts.objects; ++o) {
+      Elf *obj = new Elf;
+      obj->dirname_  = libdir;
+      obj->basename_ = library_name(i, o);
+      obj->ei_class_ = is32 ? ELFCLASS32 : ELFCLASS64;
+      obj->ei_data_  = ELFDATA2LSB;
+      obj->ei_osabi_ = ELFOSABI_NONE;
+      if (percent(opts.rpath)) {
+        obj->rpath_set_ = true;
+        obj->rpath_     = "/opt/" + pkg->name_ + "/lib";
+      }
+      for (unsigned long n = 0; n != opts.needed; ++n) {
+        if (earlier.empty() || percent(opts.missing)) {
+          obj->needed_.emplace_back("libmissing" +
+                                    std::to_string(rng() % 64) + ".so");
+          continue;
+        }
+        unsigned long dep = earlier[rng() % earlier.size()];
+        obj->needed_.emplace_back(library_name(dep, rng() % opts.objects));
+        depends.insert(package_name(dep));
+      }
+      pkg->objects_.emplace_back(obj);
+      pkg->filelist_.emplace_back(string(libdir+1) + "/" + obj->basename_);
+    }
+    for (auto &dep : depends)
+      pkg->depends_.emplace_back(dep, "");
+    for (unsigned long f = 0; f != opts.files; ++f) {
+      pkg->filelist_.emplace_back("usr/share/" + pkg->name_ + "/file" +
+                                  std::to_string(f));
+    }
+    if (opts.objects)
+      earlier.push_back(i);
+    packages.push_back(pkg);
+  }
+  return packages;
+}
+
+static uniq<DB> create_db(const Config &config) {
+  uniq<DB> db(new DB(config));
+  db->name_ = "bench";
+  db->LD_Append("/usr/lib");
+  db->LD_Append("/usr/lib32");
+  return db;
+}
+
+// Queries print to stdout, which is pointed at /dev/null while they run.
+class Silence {
+ public:
+  Silence() {
+    fflush(stdout);
+    saved_ = dup(1);
+    int null = open("/dev/null", O_WRONLY);
+    if (null != -1) {
+      dup2(null, 1);
+      close(null);
+    }
+  }
+  ~Silence() {
+    fflush(stdout);
+    if (saved_ != -1) {
+      dup2(saved_, 1);
+      close(saved_);
+    }
+  }
+ private:
+  int saved_;
+};
+
+struct Result {
+  string        name_;
+  unsigned long items_;
+  double        best_;
+  double        mean_;
+};
+
+using clock_type = std::chrono::steady_clock;
+
+// Runs setup() untimed and run() timed for each round.
+template<typename Setup, typename Run>
+static Result measure(const Options &opts, const char *name,
+                      unsigned long items, Setup setup, Run run)
+{
+  Result result { name, items, 0, 0 };
+  for (unsigned long r = 0; r != opts.rounds; ++r) {
+    setup();
+    auto start = clock_type::now();
+    run();
+    std::chrono::duration<double> took = clock_type::now() - start;
+    if (!r || took.count() < result.best_)
+      result.best_ = took.count();
+    result.mean_ += took.count();
+  }
+  result.mean_ /= double(opts.rounds);
+  return result;
+}
+
+static void print_results(const Options &opts, unsigned long objects,
+                          const vec<Result> &results)
+{
+  if (opts.json) {
+    printf("{ \"options\": { \"packages\": %lu, \"objects\": %lu,"
+           " \"needed\": %lu, \"files\": %lu, \"abi32\": %lu,"
+           " \"rpath\": %lu, \"missing\": %lu, \"jobs\": %lu,"
+           " \"rounds\": %lu, \"seed\": %lu },\n  \"results\": {",
+           opts.packages, objects, opts.needed, opts.files, opts.abi32,
+           opts.rpath, opts.missing, opts.jobs, opts.rounds, opts.seed);
+    const char *sep = "\n";
+    for (auto &r : results) {
+      printf("%s    \"%s\": { \"items\": %lu, \"best\": %.9f,"
+             " \"mean\": %.9f }", sep, r.name_.c_str(), r.items_,
+             r.best_, r.mean_);
+      sep = ",\n";
+    }
+    printf("\n  }\n}\n");
+    return;
+  }
+
+  printf("%lu packages, %lu objects, %lu needed each, %lu%% 32 bit,"
+         " %lu%% rpath, %lu rounds\n", opts.packages, objects, opts.needed,
+         opts.abi32, opts.rpath, opts.rounds);
+  for (auto &r : results) {
+    printf("  %-20s %8lu items %12.6f s best %12.6f s mean %10.3f us/item\n",
+           r.name_.c_str(), r.items_, r.best_, r.mean_,
+           r.items_ ? r.best_ * 1e6 / double(r.items_) : 0.0);
+  }
+}
+
+static void usage [[noreturn]] (const char *arg0, int exitstatus) {
+  fprintf(exitstatus ? stderr : stdout,
+    "usage: %s [options]\n"
+    "options:\n"
+    "  -p N    number of packages (%lu)\n"
+    "  -o N    objects per package (%lu)\n"
+    "  -n N    needed libraries per object (%lu)\n"
+    "  -f N    files per package besides the objects (%lu)\n"
+    "  -a PCT  percentage of 32 bit packages (%lu)\n"
+    "  -R PCT  percentage of objects with an rpath (%lu)\n"
+    "  -m PCT  percentage of needed libraries which do not exist (%lu)\n"
+    "  -r N    rounds per operation (%lu)\n"
+    "  -j N    threads for the threaded relink (number of cpus, at least 2)\n"
+    "  -s N    random seed (%lu)\n"
+    "  -d DIR  where to write the database files (TMPDIR or /tmp)\n"
+    "  -J      print the results as JSON\n",
+    arg0, Options().packages, Options().objects, Options().needed,
+    Options().files, Options().abi32, Options().rpath, Options().missing,
+    Options().rounds, Options().seed);
+  exit(exitstatus);
+}
+
+int main(int argc, char **argv) {
+  Options opts;
+  int c;
+  while ((c = getopt(argc, argv, "hp:o:n:f:a:R:m:r:j:s:d:J")) != -1) {
+    unsigned long *value = nullptr;
+    switch (c) {
+      case 'h': usage(argv[0], 0);
+      case 'p': value = &opts.packages; break;
+      case 'o': value = &opts.objects;  break;
+      case 'n': value = &opts.needed;   break;
+      case 'f': value = &opts.files;    break;
+      case 'a': value = &opts.abi32;    break;
+      case 'R': value = &opts.rpath;    break;
+      case 'm': value = &opts.missing;  break;
+      case 'r': value = &opts.rounds;   break;
+      case 'j': value = &opts.jobs;     break;
+      case 's': value = &opts.seed;     break;
+      case 'd': opts.dir = optarg; break;
+      case 'J': opts.json = true;  break;
+      default: usage(argv[0], 1);
+    }
+    if (value)
+      *value = strtoul(optarg, nullptr, 0);
+  }
+  if (optind != argc || !opts.rounds || !opts.packages)
+    usage(argv[0], 1);
+
+  if (!opts.dir)
+    opts.dir = getenv("TMPDIR");
+  string tmpl = string(opts.dir ? opts.dir : "/tmp") + "/pkgdepdb-bench.XXXXXX";
+  if (!mkdtemp(&tmpl[0])) {
+    fprintf(stderr, "failed to create a directory from %s: %s\n",
+            tmpl.c_str(), strerror(errno));
+    return 1;
+  }
+  const string dbfile   = tmpl + "/bench.db";
+  const string gzdbfile = tmpl + "/bench.db.gz";
+
+  Config config;
+  config.quiet_     = true;
+  config.log_level_ = LogLevel::Warn;
+
+  unsigned long objects = opts.packages * opts.objects;
+  vec<Result> results;
+  uniq<DB> db;
+  PackageList packages;
+
+  results.push_back(measure(opts, "install", opts.packages,
+    [&]() {
+      db = create_db(config);
+      packages = generate(opts);
+    },
+    [&]() {
+      for (auto &pkg : packages)
+        db->InstallPackage(move(pkg));
+    }));
+
+  config.max_jobs_ = 1;
+  results.push_back(measure(opts, "relink", objects,
+    []() {}, [&]() { db->RelinkAll(); }));
+
+#ifdef PKGDEPDB_ENABLE_THREADS
+  // on a single cpu this measures the overhead of the threaded path
+  if (!opts.jobs)
+    opts.jobs = std::max(thread::ncpus, 2u);
+  unsigned int ncpus = thread::ncpus;
+  thread::ncpus    = opts.jobs;
+  config.max_jobs_ = opts.jobs;
+  results.push_back(measure(opts, "relink threaded", objects,
+    []() {}, [&]() { db->RelinkAll(); }));
+  thread::ncpus    = ncpus;
+#endif
+  config.max_jobs_ = 0;
+
+  FilterList    no_filters;
+  ObjFilterList no_obj_filters;
+  results.push_back(measure(opts, "integrity", opts.packages,
+    [&]() { db->integrity_cache_.clear(); },
+    [&]() {
+      Silence silence;
+      db->CheckIntegrity(no_filters, no_obj_filters, true);
+    }));
+  results.push_back(measure(opts, "integrity cached", opts.packages,
+    []() {},
+    [&]() {
+      Silence silence;
+      db->CheckIntegrity(no_filters, no_obj_filters, true);
+    }));
+
+  FilterList pkg_filters;
+  pkg_filters.emplace_back(filter::PackageFilter::name(
+    filter::Match::CreateGlob("pkg0*"), false));
+  ObjFilterList obj_filters;
+  obj_filters.emplace_back(filter::ObjectFilter::depends(
+    filter::Match::CreateGlob("libp0*"), false));
+  StrFilterList str_filters;
+  str_filters.emplace_back(filter::StringFilter::filter(
+    filter::Match::CreateGlob("*/file1*"), false));
+
+  results.push_back(measure(opts, "show packages", opts.packages,
+    []() {},
+    [&]() {
+      Silence silence;
+      db->ShowPackages(false, false, pkg_filters, no_obj_filters);
+    }));
+  results.push_back(measure(opts, "show objects", objects,
+    []() {},
+    [&]() {
+      Silence silence;
+      db->ShowObjects(no_filters, obj_filters);
+    }));
+  results.push_back(measure(opts, "show missing", objects,
+    []() {}, [&]() { Silence silence; db->ShowMissing(); }));
+  results.push_back(measure(opts, "show filelist", opts.packages,
+    []() {},
+    [&]() {
+      Silence silence;
+      db->ShowFilelist(pkg_filters, str_filters);
+    }));
+
+  bool ok = true;
+  auto store = [&](const string &file) {
+    return [&db, &ok, &file]() { ok = db->Store(file) && ok; };
+  };
+  auto load = [&](const string &file) {
+    return [&db, &ok, &file]() { ok = db->Load(file) && ok; };
+  };
+  auto fresh = [&]() { db = create_db(config); };
+
+  results.push_back(measure(opts, "store", opts.packages,
+    []() {}, store(dbfile)));
+  results.push_back(measure(opts, "store gz", opts.packages,
+    []() {}, store(gzdbfile)));
+  results.push_back(measure(opts, "load", opts.packages,
+    fresh, load(dbfile)));
+  results.push_back(measure(opts, "load gz", opts.packages,
+    fresh, load(gzdbfile)));
+
+  // every tenth package, one at a time
+  StringList names;
+  for (unsigned long i = 0; i < opts.packages; i += 10)
+    names.emplace_back(package_name(i));
+  results.push_back(measure(opts, "delete", names.size(),
+    [&]() { fresh(); load(dbfile)(); },
+    [&]() {
+      for (auto &name : names)
+        db->DeletePackage(name);
+    }));
+
+  db.reset();
+  unlink(dbfile.c_str());
+  unlink(gzdbfile.c_str());
+  rmdir(tmpl.c_str());
+
+  if (!ok) {
+    fprintf(stderr, "failed to store or load the database\n");
+    return 1;
+  }
+  print_results(opts, objects, results);
+  return 0;
+}
@@ -0,0 +1,405 @@
+// ELF parser microbenchmark.
+//
+// Generates a corpus of ELF images in memory and times Elf::Open on them,
+// reporting objects and bytes per second for each of the four parsers
+// (32/64 bit, little/big endian) and for the malformed images.
+// The images carry varying numbers of sections, DT_NEEDED entries,
+// rpaths, runpaths and interpreters, with padding standing in for their
+// code. The malformed ones are truncated, lack DT_STRSZ or a dynamic
+// section, have an invalid version, dynamic entry size or string offset.
+// The objects parsed from well-formed images are checked against what was
+// generated before anything is timed.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <elf.h>
+
+#include <chrono>
+#include <random>
+
+#include "../main.h"
+#include "../endian.h"
+#include "../elf.h"
+
+using namespace pkgdepdb;
+
+struct Options {
+  unsigned long images    = 2000;
+  unsigned long rounds    = 20;
+  unsigned long malformed = 5;    // percentage of malformed images
+  unsigned long seed      = 1;
+  bool          json      = false;
+};
+
+enum Defect {
+  None,
+  Truncated,    // cut off in the middle of the section headers
+  BadVersion,
+  BadEntsize,
+  NoStrsz,
+  BadString,    // a DT_NEEDED entry points past the string table
+  NotDynamic,   // no dynamic section, not an error
+  DefectCount
+};
+
+// What to put into an image.
+struct Shape {
+  unsigned char ei_class;
+  unsigned char ei_data;
+  unsigned char ei_osabi;
+  size_t        sections;  // including the null, .dynstr and .dynamic
+  size_t        padding;
+  StringList    needed;
+  bool          rpath_set;
+  string        rpath;
+  bool          runpath_set;
+  string        runpath;
+  bool          interp_set;
+  string        interp;
+  Defect        defect;
+};
+
+struct Image {
+  Shape         shape_;
+  // 8 byte aligned as the parser reads the headers in place
+  vec<uint64_t> words_;
+  size_t        size_;
+
+  const char* data() const {
+    return reinterpret_cast<const char*>(words_.data());
+  }
+};
+
+template<bool BE, typename T, typename V>
+static inline void set(T &field, V value) {
+  field = Eswap<BE>(T(value));
+}
+
+static inline size_t align8(size_t off) {
+  return (off + 7) & ~size_t(7);
+}
+
+template<bool BE,
+         typename HDR, typename SecHDR, typename ProgHDR, typename Dyn>
+static void build(Image &image) {
+  const Shape &shape = image.shape_;
+  const size_t vaddr = 0x400000;
+
+  // the dynamic string table
+  string strtab(1, '\0');
+  auto add_string = [&strtab](const string &str) {
+    size_t off = strtab.length();
+    strtab.append(str);
+    strtab.push_back('\0');
+    return off;
+  };
+  vec<tuple<int64_t, size_t>> dynamic;
+  for (auto &name : shape.needed)
+    dynamic.emplace_back(DT_NEEDED, add_string(name));
+  if (shape.rpath_set)
+    dynamic.emplace_back(DT_RPATH, add_string(shape.rpath));
+  if (shape.runpath_set)
+    dynamic.emplace_back(DT_RUNPATH, add_string(shape.runpath));
+
+  size_t phnum       = shape.interp_set ? 3 : 2;
+  size_t phoff       = align8(sizeof(HDR));
+  size_t interp_off  = phoff + phnum * sizeof(ProgHDR);
+  size_t strtab_off  = align8(interp_off + shape.interp.length() + 1);
+  size_t dyn_off     = align8(strtab_off + strtab.length());
+  size_t dyncount    = dynamic.size() + 3; // STRTAB, STRSZ, NULL
+  size_t text_off    = align8(dyn_off + dyncount * sizeof(Dyn));
+  size_t shoff       = align8(text_off + shape.padding);
+  size_t size        = shoff + shape.sections * sizeof(SecHDR);
+
+  image.words_.assign(size / 8 + 1, 0);
+  image.size_ = size;
+  char *data = reinterpret_cast<char*>(image.words_.data());
+
+  HDR *hdr = reinterpret_cast<HDR*>(data);
+  memcpy(hdr->e_ident, ELFMAG, SELFMAG);
+  hdr->e_ident[EI_CLASS]   = shape.ei_class;
+  hdr->e_ident[EI_DATA]    = shape.ei_data;
+  hdr->e_ident[EI_VERSION] = shape.defect == BadVersion ? 0 : EV_CURRENT;
+  hdr->e_ident[EI_OSABI]   = shape.ei_osabi;
+  set<BE>(hdr->e_type,      ET_DYN);
+  set<BE>(hdr->e_machine,   EM_NONE);
+  set<BE>(hdr->e_version,   EV_CURRENT);
+  set<BE>(hdr->e_phoff,     phoff);
+  set<BE>(hdr->e_shoff,     shoff);
+  set<BE>(hdr->e_ehsize,    sizeof(HDR));
+  set<BE>(hdr->e_phentsize, sizeof(ProgHDR));
+  set<BE>(hdr->e_phnum,     phnum);
+  set<BE>(hdr->e_shentsize, sizeof(SecHDR));
+  set<BE>(hdr->e_shnum,     shape.sections);
+
+  ProgHDR *ph = reinterpret_cast<ProgHDR*>(data + phoff);
+  set<BE>(ph[0].p_type,   PT_LOAD);
+  set<BE>(ph[0].p_vaddr,  vaddr);
+  set<BE>(ph[0].p_filesz, size);
+  set<BE>(ph[0].p_memsz,  size);
+  set<BE>(ph[1].p_type,   PT_DYNAMIC);
+  set<BE>(ph[1].p_offset, dyn_off);
+  set<BE>(ph[1].p_vaddr,  vaddr + dyn_off);
+  set<BE>(ph[1].p_filesz, dyncount * sizeof(Dyn));
+  if (shape.interp_set) {
+    set<BE>(ph[2].p_type,   PT_INTERP);
+    set<BE>(ph[2].p_offset, interp_off);
+    set<BE>(ph[2].p_filesz, shape.interp.length() + 1);
+    memcpy(data + interp_off, shape.interp.c_str(),
+           shape.interp.length() + 1);
+  }
+
+  memcpy(data + strtab_off, strtab.data(), strtab.length());
+
+  Dyn *dyn = reinterpret_cast<Dyn*>(data + dyn_off);
+  for (auto &entry : dynamic) {
+    set<BE>(dyn->d_tag,      std::get<0>(entry));
+    set<BE>(dyn->d_un.d_val, std::get<1>(entry));
+    ++dyn;
+  }
+  if (shape.defect == BadString) {
+    Dyn *first = reinterpret_cast<Dyn*>(data + dyn_off);
+    set<BE>(first->d_un.d_val, strtab.length() + 16);
+  }
+  set<BE>(dyn->d_tag,      DT_STRTAB);
+  set<BE>(dyn->d_un.d_ptr, vaddr + strtab_off);
+  ++dyn;
+  set<BE>(dyn->d_tag,      shape.defect == NoStrsz ? DT_DEBUG : DT_STRSZ);
+  set<BE>(dyn->d_un.d_val, strtab.length());
+  ++dyn;
+  set<BE>(dyn->d_tag,      DT_NULL);
+
+  // padding sections first, so finding the dynamic ones scans them all
+  SecHDR *sec = reinterpret_cast<SecHDR*>(data + shoff);
+  size_t dynstr_index = shape.sections - 2;
+  for (size_t i = 1; i != dynstr_index; ++i) {
+    set<BE>(sec[i].sh_type,   SHT_PROGBITS);
+    set<BE>(sec[i].sh_offset, text_off);
+    set<BE>(sec[i].sh_size,   shape.padding);
+  }
+  SecHDR &dynstr = sec[dynstr_index];
+  set<BE>(dynstr.sh_type,   SHT_STRTAB);
+  set<BE>(dynstr.sh_addr,   vaddr + strtab_off);
+  set<BE>(dynstr.sh_offset, strtab_off);
+  set<BE>(dynstr.sh_size,   strtab.length());
+  SecHDR &dynsec = sec[dynstr_index + 1];
+  set<BE>(dynsec.sh_type,
+          shape.defect == NotDynamic ? SHT_PROGBITS : SHT_DYNAMIC);
+  set<BE>(dynsec.sh_addr,    vaddr + dyn_off);
+  set<BE>(dynsec.sh_offset,  dyn_off);
+  set<BE>(dynsec.sh_size,    dyncount * sizeof(Dyn));
+  set<BE>(dynsec.sh_entsize, shape.defect == BadEntsize ? 0 : sizeof(Dyn));
+  set<BE>(dynsec.sh_link,    dynstr_index);
+
+  if (shape.defect == Truncated)
+    image.size_ = shoff + shape.sections / 2 * sizeof(SecHDR);
+}
+
+static Image generate(std::mt19937 &rng, unsigned long index,
+                      const Options &opts)
+{
+  auto percent = [&rng](unsigned long p) { return rng() % 100 < p; };
+
+  Image image;
+  Shape &shape = image.shape_;
+  shape.ei_class  = (index & 1) ? ELFCLASS64  : ELFCLASS32;
+  shape.ei_data   = (index & 2) ? ELFDATA2MSB : ELFDATA2LSB;
+  shape.ei_osabi  = percent(50) ? ELFOSABI_LINUX : ELFOSABI_NONE;
+  shape.sections  = 3 + rng() % 40;
+  shape.padding   = 256 + rng() % 16384;
+  size_t needed   = rng() % 16;
+  for (size_t i = 0; i != needed; ++i)
+    shape.needed.emplace_back("lib" + std::to_string(rng() % 500) + ".so." +
+                              std::to_string(rng() % 4));
+  shape.rpath_set   = percent(30);
+  if (shape.rpath_set)
+    shape.rpath = "/opt/bench" + std::to_string(index) + "/lib";
+  shape.runpath_set = percent(20);
+  if (shape.runpath_set)
+    shape.runpath = "$ORIGIN/../lib:/usr/lib/bench";
+  shape.interp_set  = percent(40);
+  if (shape.interp_set) {
+    shape.interp = shape.ei_class == ELFCLASS64 ? "/lib64/ld-linux-x86-64.so.2"
+                                                : "/lib/ld-linux.so.2";
+  }
+  shape.defect = None;
+  if (percent(opts.malformed)) {
+    shape.defect = Defect(1 + rng() % (DefectCount - 1));
+    if (shape.defect == BadString && shape.needed.empty())
+      shape.needed.emplace_back("libc.so.6");
+  }
+
+  bool be = shape.ei_data == ELFDATA2MSB;
+  if (shape.ei_class == ELFCLASS32) {
+    if (be)
+      build<true,  Elf32_Ehdr, Elf32_Shdr, Elf32_Phdr, Elf32_Dyn>(image);
+    else
+      build<false, Elf32_Ehdr, Elf32_Shdr, Elf32_Phdr, Elf32_Dyn>(image);
+  } else {
+    if (be)
+      build<true,  Elf64_Ehdr, Elf64_Shdr, Elf64_Phdr, Elf64_Dyn>(image);
+    else
+      build<false, Elf64_Ehdr, Elf64_Shdr, Elf64_Phdr, Elf64_Dyn>(image);
+  }
+  return image;
+}
+
+// make sure the parser sees what was generated before timing it
+static bool verify(const Image &image, const Config &config) {
+  const Shape &shape = image.shape_;
+  bool err;
+  uniq<Elf> obj(Elf::Open(image.data(), image.size_, &err, "verify",
+                          config));
+  if (shape.defect != None)
+    return !obj && err == (shape.defect != NotDynamic);
+  return obj && !err &&
+         obj->ei_class_        == shape.ei_class    &&
+         obj->ei_data_         == shape.ei_data     &&
+         obj->ei_osabi_        == shape.ei_osabi    &&
+         obj->needed_          == shape.needed      &&
+         obj->rpath_set_       == shape.rpath_set   &&
+         obj->rpath_           == shape.rpath       &&
+         obj->runpath_set_     == shape.runpath_set &&
+         obj->runpath_         == shape.runpath     &&
+         obj->interpreter_set_ == shape.interp_set  &&
+         obj->interpreter_     == shape.interp;
+}
+
+struct Result {
+  const char   *name_;
+  unsigned long images_;
+  size_t        bytes_;
+  double        seconds_;   // per round
+};
+
+using clock_type = std::chrono::steady_clock;
+
+static Result measure(const char *name, const vec<const Image*> &images,
+                      const Options &opts, const Config &config)
+{
+  Result result { name, (unsigned long)images.size(), 0, 0 };
+  for (auto image : images)
+    result.bytes_ += image->size_;
+  if (images.empty())
+    return result;
+
+  auto start = clock_type::now();
+  for (unsigned long r = 0; r != opts.rounds; ++r) {
+    for (auto image : images) {
+      bool err;
+      delete Elf::Open(image->data(), image->size_, &err, name, config);
+    }
+  }
+  std::chrono::duration<double> took = clock_type::now() - start;
+  result.seconds_ = took.count() / double(opts.rounds);
+  return result;
+}
+
+static void print_results(const Options &opts, const vec<Result> &results) {
+  auto per_sec = [](double count, double seconds) {
+    return seconds > 0 ? count / seconds : 0.0;
+  };
+
+  if (opts.json) {
+    printf("{ \"options\": { \"images\": %lu, \"rounds\": %lu,"
+           " \"malformed\": %lu, \"seed\": %lu },\n  \"results\": {",
+           opts.images, opts.rounds, opts.malformed, opts.seed);
+    const char *sep = "\n";
+    for (auto &r : results) {
+      printf("%s    \"%s\": { \"images\": %lu, \"bytes\": %lu,"
+             " \"seconds\": %.9f, \"objects_per_sec\": %.1f,"
+             " \"bytes_per_sec\": %.1f }", sep, r.name_, r.images_,
+             (unsigned long)r.bytes_, r.seconds_,
+             per_sec(r.images_, r.seconds_), per_sec(r.bytes_, r.seconds_));
+      sep = ",\n";
+    }
+    printf("\n  }\n}\n");
+    return;
+  }
+
+  printf("%lu images, %lu rounds\n", opts.images, opts.rounds);
+  printf("  %-10s %7s %11s %11s %12s %10s\n",
+         "", "images", "bytes", "ns/object", "objects/s", "MB/s");
+  for (auto &r : results) {
+    printf("  %-10s %7lu %11lu %11.1f %12.0f %10.1f\n", r.name_, r.images_,
+           (unsigned long)r.bytes_,
+           r.images_ ? r.seconds_ * 1e9 / double(r.images_) : 0.0,
+           per_sec(r.images_, r.seconds_),
+           per_sec(r.bytes_, r.seconds_) / 1e6);
+  }
+}
+
+static void usage [[noreturn]] (const char *arg0, int exitstatus) {
+  fprintf(exitstatus ? stderr : stdout,
+    "usage: %s [options]\n"
+    "options:\n"
+    "  -n N    number of images (%lu)\n"
+    "  -r N    rounds (%lu)\n"
+    "  -m PCT  percentage of malformed images (%lu)\n"
+    "  -s N    random seed (%lu)\n"
+    "  -J      print the results as JSON\n",
+    arg0, Options().images, Options().rounds, Options().malformed,
+    Options().seed);
+  exit(exitstatus);
+}
+
+int main(int argc, char **argv) {
+  Options opts;
+  int c;
+  while ((c = getopt(argc, argv, "hn:r:m:s:J")) != -1) {
+    unsigned long *value = nullptr;
+    switch (c) {
+      case 'h': usage(argv[0], 0);
+      case 'n': value = &opts.images;    break;
+      case 'r': value = &opts.rounds;    break;
+      case 'm': value = &opts.malformed; break;
+      case 's': value = &opts.seed;      break;
+      case 'J': opts.json = true; break;
+      default: usage(argv[0], 1);
+    }
+    if (value)
+      *value = strtoul(optarg, nullptr, 0);
+  }
+  if (optind != argc || !opts.rounds || !opts.images)
+    usage(argv[0], 1);
+
+  Config config;
+  // the malformed images are expected to fail
+  config.log_level_ = LogLevel::Error + 1;
+
+  std::mt19937 rng(opts.seed);
+  vec<Image> corpus;
+  corpus.reserve(opts.images);
+  for (unsigned long i = 0; i != opts.images; ++i) {
+    corpus.emplace_back(generate(rng, i, opts));
+    if (!verify(corpus.back(), config)) {
+      fprintf(stderr, "image %lu was not parsed as generated\n", i);
+      return 1;
+    }
+  }
+
+  // by parser, the malformed images separately
+  vec<const Image*> parsers[4], malformed, all;
+  for (auto &image : corpus) {
+    const Shape &shape = image.shape_;
+    all.push_back(&image);
+    if (shape.defect != None)
+      malformed.push_back(&image);
+    else
+      parsers[(shape.ei_class == ELFCLASS64) * 2 +
+              (shape.ei_data  == ELFDATA2MSB)].push_back(&image);
+  }
+
+  vec<Result> results;
+  results.push_back(measure("32 LE", parsers[0], opts, config));
+  results.push_back(measure("32 BE", parsers[1], opts, config));
+  results.push_back(measure("64 LE", parsers[2], opts, config));
+  results.push_back(measure("64 BE", parsers[3], opts, config));
+  results.push_back(measure("malformed", malformed, opts, config));
+  results.push_back(measure("all", all, opts, config));
+  print_results(opts, results);
+  return 0;
+}
@@ -0,0 +1,146 @@
+// Pattern matching microbenchmark.
+//
+// Matches a set of patterns against every line of a file list, the way the
+// file: and libpath: filters do, and reports the time spent per path.
+// Patterns use the filter syntax: =text, :glob, /regex/ or /regex/i, a
+// pattern without one of these prefixes is a glob.
+// A realistic corpus can be created with
+//   pkgdepdb -d <db> --ls -q > files.txt
+// or simply
+//   find /usr > files.txt
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <chrono>
+
+#include "../main.h"
+#include "../elf.h"
+#include "../package.h"
+#include "../db.h"
+#include "../filter.h"
+
+using namespace pkgdepdb;
+
+static const char *default_patterns[] = {
+  "=usr/lib/libc.so.6",
+  ":*",
+  ":*.so",
+  ":usr/lib/*",
+  ":*.so.[0-9]*",
+  ":usr/share/*/doc/*",
+  ":*/include/*/*.h",
+  ":*[Pp]ython*/site-packages/*.py",
+  ":*l*i*b*x*",
+#ifdef PKGDEPDB_ENABLE_REGEX
+  "/\\.so(\\.[0-9]+)*$/",
+  "/^usr/lib/.*\\.a$/",
+  "/site-packages/.*\\.pyc$/",
+  "/xorg/i",
+  "/(bin|sbin)//",
+#endif
+  nullptr
+};
+
+static rptr<filter::Match> create(const string &pattern) {
+  if (pattern.empty())
+    return filter::Match::CreateGlob(string());
+  switch (pattern[0]) {
+    case '=': return filter::Match::CreateExact(pattern.substr(1));
+    case ':': return filter::Match::CreateGlob(pattern.substr(1));
+#ifdef PKGDEPDB_ENABLE_REGEX
+    case '/': {
+      bool icase = pattern.length() > 2 &&
+                   pattern.compare(pattern.length()-2, 2, "/i") == 0;
+      size_t end = pattern.length() - (icase ? 2 : 1);
+      if (end < 1 || pattern[end] != '/')
+        return nullptr;
+      return filter::Match::CreateRegex(pattern.substr(1, end-1), icase);
+    }
+#endif
+    default:  return filter::Match::CreateGlob(string(pattern));
+  }
+}
+
+static void usage(const char *arg0, int exitstatus) {
+  fprintf(exitstatus ? stderr : stdout,
+          "usage: %s [-r rounds] <filelist|-> [patterns...]\n", arg0);
+  exit(exitstatus);
+}
+
+static bool read_corpus(FILE *in, StringList &out) {
+  char *line = nullptr;
+  size_t size = 0;
+  ssize_t len;
+  while ( (len = ::getline(&line, &size, in)) != -1) {
+    if (len && line[len-1] == '\n')
+      --len;
+    if (len)
+      out.emplace_back(line, size_t(len));
+  }
+  free(line);
+  return !ferror(in);
+}
+
+int main(int argc, char **argv) {
+  unsigned long rounds = 10;
+  int arg = 1;
+  if (arg < argc && !strcmp(argv[arg], "-h"))
+    usage(argv[0], 0);
+  if (arg+1 < argc && !strcmp(argv[arg], "-r")) {
+    rounds = strtoul(argv[arg+1], nullptr, 0);
+    arg += 2;
+  }
+  if (arg >= argc || !rounds)
+    usage(argv[0], 1);
+
+  StringList corpus;
+  const char *listfile = argv[arg++];
+  FILE *in = strcmp(listfile, "-") ? fopen(listfile, "r") : stdin;
+  if (!in) {
+    fprintf(stderr, "failed to open %s: %s\n", listfile, strerror(errno));
+    return 1;
+  }
+  bool ok = read_corpus(in, corpus);
+  if (in != stdin)
+    fclose(in);
+  if (!ok || corpus.empty()) {
+    fprintf(stderr, "no paths read from %s\n", listfile);
+    return 1;
+  }
+
+  StringList patterns;
+  for (; arg < argc; ++arg)
+    patterns.emplace_back(argv[arg]);
+  if (patterns.empty()) {
+    for (const char **p = default_patterns; *p; ++p)
+      patterns.emplace_back(*p);
+  }
+
+  printf("%lu paths, %lu rounds\n",
+         (unsigned long)corpus.size(), rounds);
+  using clock = std::chrono::steady_clock;
+  double total = 0;
+  for (auto &pattern : patterns) {
+    auto match = create(pattern);
+    if (!match) {
+      fprintf(stderr, "invalid pattern: %s\n", pattern.c_str());
+      return 1;
+    }
+    size_t hits = 0;
+    auto start = clock::now();
+    for (unsigned long r = 0; r != rounds; ++r) {
+      for (auto &path : corpus)
+        hits += (*match)(path);
+    }
+    std::chrono::duration<double, std::nano> took = clock::now() - start;
+    double per_path = took.count() / double(rounds * corpus.size());
+    total += per_path;
+    printf("  %-32s %8lu matches %10.1f ns/path\n", pattern.c_str(),
+           (unsigned long)(hits / rounds), per_path);
+  }
+  printf("  %-32s %8s         %10.1f ns/path\n", "total", "", total);
+  return 0;
+}
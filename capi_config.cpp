@@ -118,6 +118,16 @@ void pkgdepdb_cfg_set_log_level(pkgdepdb_cfg *cfg_, unsigned int v) {
   cfg->log_level_ = v;
 }
 
+pkgdepdb_bool pkgdepdb_cfg_stats(pkgdepdb_cfg *cfg_) {
+  auto cfg = reinterpret_cast<Config*>(cfg_);
+  return cfg->stats_;
+}
+
+void pkgdepdb_cfg_set_stats(pkgdepdb_cfg *cfg_, pkgdepdb_bool v) {
+  auto cfg = reinterpret_cast<Config*>(cfg_);
+  cfg->stats_ = !!v;
+}
+
 unsigned int pkgdepdb_cfg_json(pkgdepdb_cfg *cfg_) {
   auto cfg = reinterpret_cast<Config*>(cfg_);
   return cfg->json_;
@@ -2,6 +2,7 @@
 #include "elf.h"
 #include "package.h"
 #include "db.h"
+#include "stats.h"
 
 #include "pkgdepdb.h"
 
@@ -9,6 +10,20 @@
 
 using namespace pkgdepdb;
 
+// call fn for each entry of lst in the range which would be deleted by
+// pkgdepdb_strlist_del_r(lst, index, count)
+template<class STRLIST, class FN>
+static void strlist_foreach_r(const STRLIST& lst, size_t index, size_t count,
+                              FN fn)
+{
+  if (index >= lst.size())
+    return;
+  auto i = lst.begin();
+  for (size_t n = index; n--; ) ++i;
+  for (; count-- && i != lst.end(); ++i)
+    fn(*i);
+}
+
 extern "C" {
 
 pkgdepdb_db *pkgdepdb_db_new(pkgdepdb_cfg *cfg_) {
@@ -21,6 +36,11 @@ void pkgdepdb_db_delete(pkgdepdb_db *db_) {
   delete db;
 }
 
+pkgdepdb_db *pkgdepdb_db_snapshot(pkgdepdb_db *db_) {
+  auto db = reinterpret_cast<DB*>(db_);
+  return reinterpret_cast<pkgdepdb_db*>(db->Snapshot());
+}
+
 pkgdepdb_bool pkgdepdb_db_load(pkgdepdb_db *db_, const char *filename) {
   auto db = reinterpret_cast<DB*>(db_);
   return db->Load(filename);
@@ -36,6 +56,40 @@ unsigned int pkgdepdb_db_loaded_version(pkgdepdb_db *db_) {
   return db->loaded_version_;
 }
 
+void pkgdepdb_db_stats(pkgdepdb_db *db_, pkgdepdb_stats *out) {
+  auto db = reinterpret_cast<DB*>(db_);
+  stats::Values values;
+  stats::Get(db->config_, values);
+  for (size_t i = 0; i != stats::PhaseCount; ++i) {
+    out->phase_ns[i]    = values.phase_ns_[i];
+    out->phase_calls[i] = values.phase_calls_[i];
+  }
+  out->objects_linked = values.counters_[stats::ObjectsLinked];
+  out->lookups        = values.counters_[stats::Lookups];
+  out->cache_hits     = values.counters_[stats::CacheHits];
+  out->candidates     = values.counters_[stats::Candidates];
+  out->elf_finds      = values.counters_[stats::ElfFinds];
+  out->bytes_read     = values.counters_[stats::BytesRead];
+  out->bytes_written  = values.counters_[stats::BytesWritten];
+  out->peak_rss       = values.peak_rss_;
+}
+
+void pkgdepdb_db_stats_reset(pkgdepdb_db *db_) {
+  auto db = reinterpret_cast<DB*>(db_);
+  stats::Reset(db->config_);
+}
+
+void pkgdepdb_db_memory(pkgdepdb_db *db_, pkgdepdb_memory *out) {
+  auto db = reinterpret_cast<const DB*>(db_);
+  MemoryReport report;
+  db->Memory(report);
+  for (size_t i = 0; i != MemoryReport::CategoryCount; ++i) {
+    out->bytes[i]       = report.bytes_[i];
+    out->allocations[i] = report.allocations_[i];
+  }
+  out->peak_rss = stats::PeakRSS();
+}
+
 pkgdepdb_bool pkgdepdb_db_strict_linking(pkgdepdb_db *db_) {
   auto db = reinterpret_cast<DB*>(db_);
   return db->strict_linking_;
@@ -43,7 +97,7 @@ pkgdepdb_bool pkgdepdb_db_strict_linking(pkgdepdb_db *db_) {
 
 void pkgdepdb_db_set_strict_linking(pkgdepdb_db *db_, pkgdepdb_bool v) {
   auto db = reinterpret_cast<DB*>(db_);
-  db->strict_linking_ = v;
+  db->SetStrictLinking(v);
 }
 
 const char* pkgdepdb_db_name(pkgdepdb_db *db_) {
@@ -90,13 +144,7 @@ size_t pkgdepdb_db_library_path_insert_r(pkgdepdb_db *db_, size_t index,
     fixpath(s);
     pv.insert(s);
   }
-  db->library_path_.insert(db->library_path_.begin() + index,
-                           pv.begin(), pv.end());
-  /* STL SUCKS
-                           std::make_move_iterator(pv.begin()),
-                           std::make_move_iterator(pv.end()));
-   */
-  return pv.size();
+  return db->LD_Insert(pv, index);
 }
 
 pkgdepdb_bool pkgdepdb_db_library_path_contains(pkgdepdb_db *db_,
@@ -108,7 +156,11 @@ pkgdepdb_bool pkgdepdb_db_library_path_contains(pkgdepdb_db *db_,
 
 pkgdepdb_bool pkgdepdb_db_library_path_del_s(pkgdepdb_db *db_, const char *path) {
   auto db = reinterpret_cast<DB*>(db_);
-  return pkgdepdb_strlist_del_s_one(db->library_path_, path) == 1;
+  auto &lst = db->library_path_;
+  auto old = std::find(lst.begin(), lst.end(), path);
+  if (old == lst.end())
+    return 0;
+  return db->LD_Delete(size_t(old - lst.begin()));
 }
 
 pkgdepdb_bool pkgdepdb_db_library_path_del_i(pkgdepdb_db *db_, size_t index) {
@@ -120,14 +172,14 @@ size_t pkgdepdb_db_library_path_del_r(pkgdepdb_db *db_, size_t index,
                                       size_t count)
 {
   auto db = reinterpret_cast<DB*>(db_);
-  return pkgdepdb_strlist_del_r(db->library_path_, index, count);
+  return db->LD_Delete(index, count);
 }
 
 pkgdepdb_bool pkgdepdb_db_library_path_set_i(pkgdepdb_db *db_, size_t index,
                                              const char *v)
 {
   auto db = reinterpret_cast<DB*>(db_);
-  return pkgdepdb_strlist_set_i(db->library_path_, index, v);
+  return db->LD_Set(index, v ? v : "");
 }
 
 size_t pkgdepdb_db_package_count(pkgdepdb_db *db_) {
@@ -167,7 +219,7 @@ pkgdepdb_bool pkgdepdb_db_package_delete_p(pkgdepdb_db *db_,
 {
   auto db = reinterpret_cast<DB*>(db_);
   auto pkg = reinterpret_cast<Package*>(pkg_);
-  auto pkgiter = std::find(db->packages_.begin(), db->packages_.end(), pkg);
+  auto pkgiter = db->FindPkg_i(pkg);
   return db->DeletePackage(pkgiter) ? 1 : 0;
 }
 
@@ -176,7 +228,7 @@ pkgdepdb_bool pkgdepdb_db_package_remove_p(pkgdepdb_db *db_,
 {
   auto db = reinterpret_cast<DB*>(db_);
   auto pkg = reinterpret_cast<Package*>(pkg_);
-  auto pkgiter = std::find(db->packages_.begin(), db->packages_.end(), pkg);
+  auto pkgiter = db->FindPkg_i(pkg);
   return db->DeletePackage(pkgiter, false) ? 1 : 0;
 }
 
@@ -200,14 +252,49 @@ pkgdepdb_bool pkgdepdb_db_package_delete_s(pkgdepdb_db *db_, const char *name)
   return db->DeletePackage(name) ? 1 : 0;
 }
 
+size_t pkgdepdb_db_package_delete_s_r(pkgdepdb_db *db_, size_t count,
+                                      const char **names)
+{
+  auto db = reinterpret_cast<DB*>(db_);
+  StringList list;
+  list.reserve(count);
+  for (size_t i = 0; i != count; ++i)
+    list.emplace_back(names[i]);
+  return db->DeletePackages(list);
+}
+
+size_t pkgdepdb_db_package_owners(pkgdepdb_db *db_, const char *path,
+                                  pkgdepdb_pkg **out, size_t count)
+{
+  auto db = reinterpret_cast<DB*>(db_);
+  auto owners = db->FindOwners(path);
+  for (size_t i = 0; i != owners.size() && i != count; ++i)
+    out[i] = reinterpret_cast<pkgdepdb_pkg*>(const_cast<Package*>(
+               owners[i]));
+  return owners.size();
+}
+
 pkgdepdb_bool pkgdepdb_db_package_is_broken(pkgdepdb_db *db_,
                                             pkgdepdb_pkg *pkg_)
 {
   auto db = reinterpret_cast<DB*>(db_);
   auto pkg = reinterpret_cast<Package*>(pkg_);
+  db->RelinkDirty();
   return db->IsBroken(pkg) ? 1 : 0;
 }
 
+size_t pkgdepdb_db_package_broken(pkgdepdb_db *db_, pkgdepdb_pkg **out,
+                                  size_t count)
+{
+  auto db = reinterpret_cast<DB*>(db_);
+  db->RelinkDirty();
+  auto broken = db->BrokenPackages();
+  for (size_t i = 0; i != broken.size() && i != count; ++i)
+    out[i] = reinterpret_cast<pkgdepdb_pkg*>(const_cast<Package*>(
+               broken[i]));
+  return broken.size();
+}
+
 size_t pkgdepdb_db_object_count(pkgdepdb_db *db_) {
   auto db = reinterpret_cast<DB*>(db_);
   return db->objects_.size();
@@ -283,6 +370,8 @@ size_t pkgdepdb_db_ignored_files_del_r(pkgdepdb_db *db_, size_t index,
                                        size_t count)
 {
   auto db = reinterpret_cast<DB*>(db_);
+  strlist_foreach_r(db->ignore_file_rules_, index, count,
+                    [db](const string &f) { db->MarkDirty_File(f); });
   return pkgdepdb_strlist_del_r(db->ignore_file_rules_, index, count);
 }
 
@@ -388,14 +477,75 @@ size_t pkgdepdb_db_assume_found_del_r(pkgdepdb_db *db_, size_t index,
                                       size_t count)
 {
   auto db = reinterpret_cast<DB*>(db_);
+  strlist_foreach_r(db->assume_found_rules_, index, count,
+                    [db](const string &l) { db->MarkDirty_Needed(l); });
   return pkgdepdb_strlist_del_r(db->assume_found_rules_, index, count);
 }
 
+size_t pkgdepdb_db_package_library_path_count(pkgdepdb_db *db_,
+                                              const char *pkg)
+{
+  auto db = reinterpret_cast<DB*>(db_);
+  auto iter = db->package_library_path_.find(pkg);
+  if (iter == db->package_library_path_.end())
+    return 0;
+  return iter->second.size();
+}
+
+size_t pkgdepdb_db_package_library_path_get(pkgdepdb_db *db_,
+                                            const char *pkg,
+                                            const char **out,
+                                            size_t off, size_t count)
+{
+  auto db = reinterpret_cast<DB*>(db_);
+  auto iter = db->package_library_path_.find(pkg);
+  if (iter == db->package_library_path_.end())
+    return 0;
+  return pkgdepdb_strlist_get(iter->second, out, off, count);
+}
+
+pkgdepdb_bool pkgdepdb_db_package_library_path_insert(pkgdepdb_db *db_,
+                                                      const char *pkg,
+                                                      size_t index,
+                                                      const char *path)
+{
+  auto db = reinterpret_cast<DB*>(db_);
+  return db->PKG_LD_Insert(pkg, path, index) ? 1 : 0;
+}
+
+pkgdepdb_bool pkgdepdb_db_package_library_path_del_s(pkgdepdb_db *db_,
+                                                     const char *pkg,
+                                                     const char *path)
+{
+  auto db = reinterpret_cast<DB*>(db_);
+  return db->PKG_LD_Delete(pkg, string(path)) ? 1 : 0;
+}
+
+pkgdepdb_bool pkgdepdb_db_package_library_path_del_i(pkgdepdb_db *db_,
+                                                     const char *pkg,
+                                                     size_t index)
+{
+  auto db = reinterpret_cast<DB*>(db_);
+  return db->PKG_LD_Delete(pkg, index) ? 1 : 0;
+}
+
+pkgdepdb_bool pkgdepdb_db_package_library_path_clear(pkgdepdb_db *db_,
+                                                     const char *pkg)
+{
+  auto db = reinterpret_cast<DB*>(db_);
+  return db->PKG_LD_Clear(pkg) ? 1 : 0;
+}
+
 void pkgdepdb_db_relink_all(pkgdepdb_db *db_) {
   auto db = reinterpret_cast<DB*>(db_);
   return db->RelinkAll();
 }
 
+pkgdepdb_bool pkgdepdb_db_relink_dirty(pkgdepdb_db *db_) {
+  auto db = reinterpret_cast<DB*>(db_);
+  return db->RelinkDirty() ? 1 : 0;
+}
+
 void pkgdepdb_db_fix_paths(pkgdepdb_db *db_) {
   auto db = reinterpret_cast<DB*>(db_);
   return db->FixPaths();
@@ -415,6 +565,7 @@ pkgdepdb_bool pkgdepdb_db_object_is_broken(pkgdepdb_db *db_, pkgdepdb_elf elf_)
 {
   auto db = reinterpret_cast<DB*>(db_);
   auto elf = *reinterpret_cast<rptr<Elf>*>(elf_);
+  db->RelinkDirty();
   return db->IsBroken(elf) ? 1 : 0;
 }
 
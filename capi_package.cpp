@@ -51,7 +51,10 @@ const char* pkgdepdb_pkg_description(pkgdepdb_pkg *pkg_) {
 
 void pkgdepdb_pkg_set_name(pkgdepdb_pkg *pkg_, const char *v) {
   auto pkg = reinterpret_cast<Package*>(pkg_);
-  pkg->name_ = v ? v : "";
+  string name(v ? v : "");
+  if (!pkg->name_.empty() && pkg->name_ != name)
+    ++Package::renames_;
+  pkg->name_ = move(name);
 }
 
 void pkgdepdb_pkg_set_version(pkgdepdb_pkg *pkg_, const char *v) {
@@ -9,6 +9,7 @@
 #include <sstream>
 
 #include "main.h"
+#include "stats.h"
 
 #ifdef PKGDEPDB_ENABLE_THREADS
 unsigned int pkgdepdb_enable_threads = 1;
@@ -31,6 +32,7 @@ unsigned int pkgdepdb_enable_regex = 0;
 namespace pkgdepdb {
 
 Config::Config()
+: stats_totals_(new stats::Totals)
 {
 }
 
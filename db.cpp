@@ -3,6 +3,8 @@
 #include <utility>
 
 #include <stdlib.h>
+#include <stdarg.h>
+#include <stdio.h>
 #include <limits.h>
 
 #include "main.h"
@@ -22,6 +24,9 @@
 #include "package.h"
 #include "db.h"
 #include "filter.h"
+#include "writer.h"
+#include "stats.h"
+#include "thread.h"
 
 namespace pkgdepdb {
 
@@ -40,35 +45,174 @@ DB::DB(const Config& optconfig)
 }
 
 DB::~DB() {
+  if (base_) {
+    for (auto &pkg : own_packages_)
+      delete pkg;
+    return;
+  }
   for (auto &pkg : packages_)
     delete pkg;
 }
 
-template<typename T>
-static void stdreplace(T &what, const T &with) {
-  what.~T();
-  new (&what) T(with);
+DB::DB(const DB *base)
+: loaded_version_      (base->loaded_version_),
+  strict_linking_      (base->strict_linking_),
+  name_                (base->name_),
+  library_path_        (base->library_path_),
+  packages_            (base->packages_),
+  objects_             (base->objects_),
+  ignore_file_rules_   (base->ignore_file_rules_),
+  package_library_path_(base->package_library_path_),
+  base_packages_       (base->base_packages_),
+  assume_found_rules_  (base->assume_found_rules_),
+  integrity_cache_     (base->integrity_cache_),
+  config_              (base->config_),
+  contains_package_depends_(base->contains_package_depends_),
+  contains_make_depends_   (base->contains_make_depends_),
+  contains_check_depends_  (base->contains_check_depends_),
+  contains_groups_         (base->contains_groups_),
+  contains_filelists_      (base->contains_filelists_),
+  contains_pkgbase_        (base->contains_pkgbase_),
+  dirty_objects_       (base->dirty_objects_),
+  package_index_       (base->package_index_),
+  package_gaps_        (base->package_gaps_),
+  package_renames_     (base->package_renames_),
+  base_                (base)
+{}
+
+DB* DB::Snapshot() const {
+  return new DB(this);
 }
 
-DB::DB(bool wiped, const DB &copy)
-: name_                (copy.name_),
-  library_path_        (copy.library_path_),
-  ignore_file_rules_   (copy.ignore_file_rules_),
-  package_library_path_(copy.package_library_path_),
-  base_packages_       (copy.base_packages_),
-  config_              (copy.config_)
-{
-  loaded_version_ = copy.loaded_version_;
-  strict_linking_ = copy.strict_linking_;
-  if (!wiped) {
-    stdreplace(packages_, copy.packages_);
-    stdreplace(objects_,  copy.objects_);
+Package* DB::Own(Package* &slot) {
+  if (!base_ || own_packages_.count(slot))
+    return slot;
+  // the copy still shares the objects
+  Package *copy = new Package(*slot);
+  own_packages_.insert(copy);
+  slot = copy;
+  file_index_.Reset();
+  reverse_index_.Reset();
+  return copy;
+}
+
+Elf* DB::Own(rptr<Elf> &slot) {
+  if (!base_ || own_objects_.count(slot))
+    return slot;
+  Elf     *obj   = slot;
+  Package *owner = nullptr;
+  if (obj->owner_) {
+    auto pos = FindPkg_i(obj->owner_->name_);
+    if (pos != packages_.end())
+      owner = Own(packages_[size_t(pos - packages_.begin())]);
+  }
+  Elf *copy = Copy(obj, owner);
+  if (owner)
+    std::replace(owner->objects_.begin(), owner->objects_.end(), obj, copy);
+  slot = copy;
+  return copy;
+}
+
+// Links to the original object stay valid, as the copy stands for it (see
+// Elf::Origin) wherever objects are identified.
+Elf* DB::Copy(const Elf *obj, Package *owner) {
+  Elf *copy = new Elf(*obj);
+  copy->origin_ = obj->Origin();
+  copy->owner_  = owner;
+  own_objects_.insert(copy);
+  if (dirty_objects_.erase(const_cast<Elf*>(obj)))
+    dirty_objects_.insert(copy);
+  link_cache_.Forget(obj->basename_);
+  reverse_index_.Reset();
+  return copy;
+}
+
+// for operations touching everything
+void DB::OwnAll() {
+  if (!base_)
+    return;
+  std::unordered_map<const Elf*, Elf*> copies;
+  for (auto &slot : packages_) {
+    Package *pkg = Own(slot);
+    for (auto &obj : pkg->objects_) {
+      if (own_objects_.count(obj))
+        continue;
+      Elf *copy = Copy(obj, pkg);
+      copies[obj] = copy;
+      obj = copy;
+    }
+  }
+  for (auto &obj : objects_) {
+    auto copy = copies.find(obj);
+    if (copy != copies.end())
+      obj = copy->second;
+    else
+      Own(obj);
   }
 }
 
+bool DB::Detachable(const Package *pkg) const {
+  if (!base_)
+    return true;
+  if (!own_packages_.count(pkg))
+    return false;
+  for (auto &obj : pkg->objects_) {
+    if (obj->origin_ || !own_objects_.count(obj))
+      return false;
+  }
+  return true;
+}
+
+void DB::IndexPackages() {
+  package_index_.clear();
+  package_index_.reserve(packages_.size());
+  for (size_t i = 0; i != packages_.size(); ++i)
+    package_index_[packages_[i]->name_] = i;
+  package_gaps_.clear();
+  package_renames_ = Package::renames_;
+}
+
+// Removals leave the index alone and only record the gaps they left, so
+// the position of a package in packages_ is its indexed position minus
+// the gaps before it.
+size_t DB::PackagePos(size_t indexed) const {
+  auto gaps = std::lower_bound(package_gaps_.begin(), package_gaps_.end(),
+                               indexed);
+  return indexed - size_t(gaps - package_gaps_.begin());
+}
+
+size_t DB::IndexedPos(size_t pos) const {
+  for (auto gap : package_gaps_) {
+    if (gap > pos)
+      break;
+    ++pos;
+  }
+  return pos;
+}
+
 PackageList::const_iterator DB::FindPkg_i(const string& name) const {
+  if (package_renames_ == Package::renames_) {
+    auto idx = package_index_.find(name);
+    if (idx == package_index_.end())
+      return packages_.end();
+    size_t pos = PackagePos(idx->second);
+    if (pos < packages_.size() && packages_[pos] &&
+        packages_[pos]->name_ == name)
+    {
+      return packages_.begin() + pos;
+    }
+  }
+  // a package was renamed after being installed, the index is rebuilt by
+  // the next change to the package list
   return std::find_if(packages_.begin(), packages_.end(),
-    [&name](const Package *pkg) { return pkg->name_ == name; });
+    [&name](const Package *pkg) { return pkg && pkg->name_ == name; });
+}
+
+PackageList::const_iterator DB::FindPkg_i(const Package *pkg) const {
+  auto iter = FindPkg_i(pkg->name_);
+  if (iter != packages_.end() && *iter == pkg)
+    return iter;
+  return std::find(packages_.begin(), packages_.end(), pkg);
 }
 
 Package* DB::FindPkg(const string& name) const {
@@ -76,11 +220,176 @@ Package* DB::FindPkg(const string& name) const {
   return (pkg != packages_.end()) ? *pkg : nullptr;
 }
 
+void FileIndex::Find(const PackageList                    &packages,
+                     const string                         &path,
+                     const function<void(const Package*)> &fn) const
+{
+  std::hash<string> hasher;
+  {
+#ifdef PKGDEPDB_ENABLE_THREADS
+    std::lock_guard<std::mutex> lock(mutex_);
+#endif
+    if (!built_ && !used_) {
+      used_ = true;
+      for (auto &pkg : packages) {
+        for (auto &file : pkg->filelist_) {
+          if (file == path)
+            fn(pkg);
+        }
+      }
+      return;
+    }
+    if (!built_)
+      Build_i(packages);
+  }
+  // the entries only change through Reset() which must not run
+  // concurrently with queries
+  size_t hash = hasher(path);
+  auto at = std::lower_bound(entries_.begin(), entries_.end(), hash,
+    [](const Entry &e, size_t h) { return e.hash_ < h; });
+  for (; at != entries_.end() && at->hash_ == hash; ++at) {
+    const StringList &files = at->pkg_->filelist_;
+    if (at->index_ < files.size() && files[at->index_] == path)
+      fn(at->pkg_);
+  }
+}
+
+void FileIndex::Build(const PackageList& packages) const {
+#ifdef PKGDEPDB_ENABLE_THREADS
+  std::lock_guard<std::mutex> lock(mutex_);
+#endif
+  if (!built_)
+    Build_i(packages);
+}
+
+void FileIndex::Build_i(const PackageList& packages) const {
+  std::hash<string> hasher;
+  entries_.clear();
+  for (auto &pkg : packages) {
+    for (size_t i = 0; i != pkg->filelist_.size(); ++i)
+      entries_.push_back({hasher(pkg->filelist_[i]), pkg, i});
+  }
+  // keep the owners of a file in package order
+  std::stable_sort(entries_.begin(), entries_.end(),
+    [](const Entry &a, const Entry &b) { return a.hash_ < b.hash_; });
+  built_ = true;
+}
+
+void FileIndex::Reset() {
+#ifdef PKGDEPDB_ENABLE_THREADS
+  std::lock_guard<std::mutex> lock(mutex_);
+#endif
+  entries_.clear();
+  entries_.shrink_to_fit();
+  built_ = false;
+  used_  = false;
+}
+
+void ReverseIndex::Build(const PackageList& packages,
+                         const ObjectList&  objects) const
+{
+#ifdef PKGDEPDB_ENABLE_THREADS
+  std::lock_guard<std::mutex> lock(mutex_);
+#endif
+  if (built_)
+    return;
+  for (auto &obj : objects) {
+    named_[obj->basename_].push_back(obj);
+    for (auto &lib : obj->req_found_)
+      users_[lib->Origin()].push_back(obj);
+    for (auto &name : obj->req_missing_)
+      missing_[name].push_back(obj);
+  }
+  for (auto &pkg : packages) {
+    providers_[pkg->name_].push_back(pkg);
+    for (auto &prov : pkg->provides_)
+      providers_[std::get<0>(prov)].push_back(pkg);
+    for (auto &dep : pkg->depends_)
+      dependers_[std::get<0>(dep)].push_back(pkg);
+  }
+  built_ = true;
+}
+
+void ReverseIndex::Reset() {
+#ifdef PKGDEPDB_ENABLE_THREADS
+  std::lock_guard<std::mutex> lock(mutex_);
+#endif
+  if (!built_)
+    return;
+  users_.clear();
+  missing_.clear();
+  dependers_.clear();
+  providers_.clear();
+  named_.clear();
+  built_ = false;
+}
+
+template<typename Map>
+static const typename Map::mapped_type& index_get(
+  const Map &map, const typename Map::key_type &key)
+{
+  static const typename Map::mapped_type none;
+  auto it = map.find(key);
+  return it == map.end() ? none : it->second;
+}
+
+const vec<const Elf*>& ReverseIndex::Users(const Elf *obj) const {
+  return index_get(users_, obj->Origin());
+}
+
+const vec<const Elf*>& ReverseIndex::Missing(const string& name) const {
+  return index_get(missing_, name);
+}
+
+const vec<const Package*>& ReverseIndex::Dependers(const string& name) const {
+  return index_get(dependers_, name);
+}
+
+const vec<const Package*>& ReverseIndex::Providers(const string& name) const {
+  return index_get(providers_, name);
+}
+
+const vec<Elf*>& ReverseIndex::Named(const string& basename) const {
+  return index_get(named_, basename);
+}
+
+vec<const Package*> DB::FindOwners(const string& path) const {
+  vec<const Package*> owners;
+  // file lists don't start with a slash
+  size_t start = path.find_first_not_of('/');
+  if (start == string::npos)
+    return owners;
+  file_index_.Find(packages_, start ? path.substr(start) : path,
+    [&owners](const Package *pkg) { owners.push_back(pkg); });
+  return owners;
+}
+
+bool DB::Owns(const Package *pkg, const string& path) const {
+  bool found = false;
+  file_index_.Find(packages_, path,
+    [pkg,&found](const Package *owner) { found = found || owner == pkg; });
+  return found;
+}
+
 bool DB::WipePackages() {
   if (Empty())
     return false;
+  // what remains is no longer shared
+  if (base_) {
+    for (auto &pkg : own_packages_)
+      delete pkg;
+    own_packages_.clear();
+    own_objects_.clear();
+    base_ = nullptr;
+  }
   objects_.clear();
   packages_.clear();
+  IndexPackages();
+  integrity_cache_.clear();
+  dirty_objects_.clear();
+  link_cache_.Clear();
+  file_index_.Reset();
+  reverse_index_.Reset();
   contains_package_depends_ = false;
   contains_make_depends_    = false;
   contains_check_depends_   = false;
@@ -94,11 +403,12 @@ bool DB::WipeFilelists() {
   bool hadfiles = contains_filelists_;
   for (auto &pkg : packages_) {
     if (!pkg->filelist_.empty()) {
-      pkg->filelist_.clear();
+      Own(pkg)->filelist_.clear();
       hadfiles = true;
     }
   }
   contains_filelists_ = false;
+  file_index_.Reset();
   return hadfiles;
 }
 
@@ -124,45 +434,155 @@ bool DB::DeletePackage(PackageList::const_iterator pkgiter, bool destroy) {
   if (pkgiter == packages_.end())
     return true;
 
+  Package *old = *pkgiter;
+  if (!destroy && !Detachable(old)) {
+    config_.Log(Error, "%s: package is shared with the snapshot's base\n",
+                old->name_.c_str());
+    return false;
+  }
+  if (package_renames_ != Package::renames_)
+    IndexPackages();
+  TakePackage(pkgiter);
+  CompactPackages();
+  UnlinkPackages({old}, destroy);
+  return true;
+}
+
+size_t DB::DeletePackages(const StringList& names, bool destroy) {
+  if (package_renames_ != Package::renames_)
+    IndexPackages();
+  PackageList removed;
+  for (auto &name : names) {
+    auto pkgiter = FindPkg_i(name);
+    if (pkgiter == packages_.end())
+      continue;
+    if (!destroy && !Detachable(*pkgiter)) {
+      config_.Log(Error, "%s: package is shared with the snapshot's base\n",
+                  name.c_str());
+      continue;
+    }
+    removed.push_back(*pkgiter);
+    TakePackage(pkgiter);
+  }
+  if (!removed.empty()) {
+    CompactPackages();
+    UnlinkPackages(removed, destroy);
+  }
+  return removed.size();
+}
+
+// Leaves a gap in packages_ so the positions of the other packages stay
+// valid until CompactPackages() closes all gaps of a removal at once.
+void DB::TakePackage(PackageList::const_iterator pkgiter) {
   const Package *old = *pkgiter;
-  packages_.erase(packages_.begin() + (pkgiter - packages_.begin()));
+  package_index_.erase(old->name_);
+  if (!old->filelist_.empty())
+    file_index_.Reset();
+  packages_[size_t(pkgiter - packages_.begin())] = nullptr;
+}
 
-  for (auto &elfsp : old->objects_) {
-    Elf *elf = elfsp.get();
-    // remove the object from the list
-    objects_.erase(std::remove(objects_.begin(), objects_.end(), elf),
-                   objects_.end());
+void DB::CompactPackages() {
+  vec<size_t> gaps;
+  auto first = std::find(packages_.begin(), packages_.end(), nullptr);
+  for (auto iter = first; iter != packages_.end(); ++iter) {
+    if (!*iter)
+      gaps.push_back(IndexedPos(size_t(iter - packages_.begin())));
   }
+  packages_.erase(std::remove(first, packages_.end(), nullptr),
+                  packages_.end());
 
-  for (auto &seeker : objects_) {
+  // the packages after a gap keep their indexed positions, unless there
+  // are enough gaps for lookups to be better off with a fresh index
+  if (package_gaps_.size() + gaps.size() > packages_.size()/16 + 64) {
+    IndexPackages();
+    return;
+  }
+  size_t mid = package_gaps_.size();
+  package_gaps_.insert(package_gaps_.end(), gaps.begin(), gaps.end());
+  std::inplace_merge(package_gaps_.begin(), package_gaps_.begin() + mid,
+                     package_gaps_.end());
+}
+
+// Drops the objects of packages which have already been taken out of
+// packages_ and repairs the links of every object which used one of them.
+void DB::UnlinkPackages(const PackageList& removed, bool destroy) {
+  reverse_index_.Reset();
+  std::set<const Elf*> gone;
+  for (auto &old : removed) {
     for (auto &elfsp : old->objects_) {
       Elf *elf = elfsp.get();
-      // for each object which depends on this object,
-      // search for a replacing object
-      auto ref = std::find(seeker->req_found_.begin(),
-                           seeker->req_found_.end(),
-                           elf);
-      if (ref == seeker->req_found_.end())
-        continue;
-      seeker->req_found_.erase(ref);
+      gone.insert(elf->Origin());
+      dirty_objects_.erase(elf);
+      link_cache_.Forget(elf->basename_);
+    }
+  }
 
-      const StringList *libpaths = GetObjectLibPath(seeker);
-      if (Elf *other = FindFor (seeker, elf->basename_, libpaths))
-        seeker->req_found_.insert(other);
+  // remove the objects from the list
+  objects_.erase(
+    std::remove_if(objects_.begin(), objects_.end(),
+      [&gone](rptr<Elf> &obj) {
+        return gone.find(obj->Origin()) != gone.end();
+      }),
+    objects_.end());
+
+  for (auto &slot : objects_) {
+    // for each object which depended on a removed object,
+    // search for a replacing object
+    StringSet lost;
+    for (auto &ref : slot->req_found_) {
+      if (gone.find(ref->Origin()) != gone.end())
+        lost.insert(ref->basename_);
+    }
+    if (lost.empty())
+      continue;
+
+    Elf *seeker = Own(slot);
+    for (auto ref = seeker->req_found_.begin();
+         ref != seeker->req_found_.end(); )
+    {
+      if (gone.find((*ref)->Origin()) == gone.end())
+        ++ref;
       else
-        seeker->req_missing_.insert(elf->basename_);
+        ref = seeker->req_found_.erase(ref);
     }
+
+    const StringList *libpaths = GetObjectLibPath(seeker);
+    bool was_broken = IsBroken(seeker);
+    for (auto &name : lost) {
+      if (Elf *other = FindFor (seeker, name, libpaths))
+        seeker->req_found_.insert(other);
+      else if (assume_found_rules_.find(name) == assume_found_rules_.end())
+        seeker->req_missing_.insert(name);
+    }
+    UpdateBroken(seeker, was_broken);
   }
 
-  if (destroy)
-    delete old;
+  // a snapshot only frees what it created or copied itself
+  for (auto &old : removed) {
+    if (base_) {
+      for (auto &elf : old->objects_)
+        own_objects_.erase(elf);
+      if (!own_packages_.erase(old))
+        continue;
+    }
+    if (destroy)
+      delete old;
+  }
 
+  // drop objects nothing else refers to, which a snapshot cannot tell as
+  // its base holds references as well
+  if (base_)
+    return;
   objects_.erase(
     std::remove_if(objects_.begin(), objects_.end(),
-      [](rptr<Elf> &obj) { return 1 == obj->refcount_; }),
+      [this](rptr<Elf> &obj) {
+        if (1 != obj->refcount_)
+          return false;
+        dirty_objects_.erase(obj);
+        link_cache_.Forget(obj->basename_);
+        return true;
+      }),
     objects_.end());
-
-  return true;
 }
 
 static bool pathlist_contains(const string& list, const string& path) {
@@ -182,6 +602,7 @@ static bool pathlist_contains(const string& list, const string& path) {
 bool DB::ElfFinds(const Elf *elf, const string& path,
                   const StringList *extrapaths) const
 {
+  stats::Count(config_, stats::ElfFinds);
   // DT_RPATH first
   if (elf->rpath_set_ && pathlist_contains(elf->rpath_, path))
     return true;
@@ -217,10 +638,30 @@ bool DB::ElfFinds(const Elf *elf, const string& path,
 }
 
 bool DB::InstallPackage(Package* &&pkg) {
-  if (!DeletePackage(pkg->name_))
-    return false;
+  stats::Timer timer(config_, stats::Install);
+  if (package_renames_ != Package::renames_)
+    IndexPackages();
+
+  // an upgrade takes the place of the old package
+  auto oldpkg = FindPkg_i(pkg->name_);
+  if (oldpkg != packages_.end()) {
+    Package *old = *oldpkg;
+    if (!old->filelist_.empty())
+      file_index_.Reset();
+    packages_[size_t(oldpkg - packages_.begin())] = pkg;
+    UnlinkPackages({old}, true);
+  } else {
+    package_index_[pkg->name_] = packages_.size() + package_gaps_.size();
+    packages_.push_back(pkg);
+  }
 
-  packages_.push_back(pkg);
+  reverse_index_.Reset();
+  if (base_) {
+    own_packages_.insert(pkg);
+    own_objects_.insert(pkg->objects_.begin(), pkg->objects_.end());
+  }
+  if (!pkg->filelist_.empty())
+    file_index_.Reset();
   if (!pkg->depends_.empty()    ||
       !pkg->optdepends_.empty() ||
       !pkg->replaces_.empty()   ||
@@ -242,34 +683,137 @@ bool DB::InstallPackage(Package* &&pkg) {
 
   const StringList *libpaths = GetPackageLibPath(pkg);
 
-  for (auto &obj : pkg->objects_)
+  for (auto &obj : pkg->objects_) {
+    obj->owner_ = pkg;
     objects_.push_back(obj);
+    link_cache_.Forget(obj->basename_);
+  }
   // loop anew since we need to also be able to found our own packages
   for (auto &obj : pkg->objects_)
     LinkObject_do(obj, pkg);
 
   // check for packages which are looking for any of our packages
   for (auto &seeker : objects_) {
+    if (!IsBroken(seeker))
+      continue;
     for (auto &obj : pkg->objects_) {
       if (!seeker->CanUse(*obj, strict_linking_) ||
           !ElfFinds(seeker, obj->dirname_, libpaths))
       {
         continue;
       }
+      if (seeker->req_missing_.find(obj->basename_) ==
+          seeker->req_missing_.end())
+      {
+        continue;
+      }
+
+      Elf *mine = Own(seeker);
+      mine->req_missing_.erase(obj->basename_);
+      mine->req_found_.insert(obj);
+    }
+    UpdateBroken(seeker, true);
+  }
+  return true;
+}
 
-      if (0 != seeker->req_missing_.erase(obj->basename_))
-        seeker->req_found_.insert(obj);
+uint32_t LinkCache::Context(const Elf *obj, const StringList *extrapath) {
+  string key;
+  key.push_back(char(obj->ei_class_));
+  key.push_back(char(obj->ei_data_));
+  key.push_back(char(obj->ei_osabi_));
+  if (obj->rpath_set_)
+    key.append(obj->rpath_);
+  key.push_back('\0');
+  if (obj->runpath_set_)
+    key.append(obj->runpath_);
+  key.push_back('\0');
+  key.push_back(char(obj->rpath_set_ | (obj->runpath_set_ << 1)));
+  if (extrapath) {
+    for (auto &dir : *extrapath) {
+      key.push_back('\0');
+      key.append(dir);
     }
   }
+
+#ifdef PKGDEPDB_ENABLE_THREADS
+  std::lock_guard<std::mutex> lock(contexts_mutex_);
+#endif
+  return contexts_.emplace(move(key), uint32_t(contexts_.size()))
+           .first->second;
+}
+
+LinkCache::Shard& LinkCache::ShardFor(const string& name) const {
+  return shards_[std::hash<string>()(name) % kShards];
+}
+
+bool LinkCache::Find(uint32_t ctx, const string& name, Elf **found) const {
+  Shard &shard = ShardFor(name);
+#ifdef PKGDEPDB_ENABLE_THREADS
+  std::lock_guard<std::mutex> lock(shard.mutex_);
+#endif
+  auto byname = shard.names_.find(name);
+  if (byname == shard.names_.end())
+    return false;
+  auto byctx = byname->second.find(ctx);
+  if (byctx == byname->second.end())
+    return false;
+  *found = byctx->second;
   return true;
 }
 
+void LinkCache::Insert(uint32_t ctx, const string& name, Elf *found) {
+  Shard &shard = ShardFor(name);
+#ifdef PKGDEPDB_ENABLE_THREADS
+  std::lock_guard<std::mutex> lock(shard.mutex_);
+#endif
+  shard.names_[name][ctx] = found;
+}
+
+void LinkCache::Forget(const string& name) {
+  Shard &shard = ShardFor(name);
+#ifdef PKGDEPDB_ENABLE_THREADS
+  std::lock_guard<std::mutex> lock(shard.mutex_);
+#endif
+  shard.names_.erase(name);
+}
+
+void LinkCache::Clear() {
+  for (auto &shard : shards_) {
+#ifdef PKGDEPDB_ENABLE_THREADS
+    std::lock_guard<std::mutex> lock(shard.mutex_);
+#endif
+    shard.names_.clear();
+  }
+#ifdef PKGDEPDB_ENABLE_THREADS
+  std::lock_guard<std::mutex> lock(contexts_mutex_);
+#endif
+  contexts_.clear();
+}
+
 Elf* DB::FindFor(const Elf *obj, const string& needed,
                  const StringList *extrapath) const
+{
+  return FindIn(objects_, obj, needed, extrapath);
+}
+
+Elf* DB::FindFor(const Elf *obj, const string& needed,
+                 const StringList *extrapath,
+                 const vec<Elf*> &candidates) const
+{
+  return FindIn(candidates, obj, needed, extrapath);
+}
+
+template<typename List>
+Elf* DB::FindIn(const List &candidates, const Elf *obj, const string& needed,
+                const StringList *extrapath) const
 {
   config_.Log(Debug, "dependency of %s/%s   :  %s\n",
               obj->dirname_.c_str(), obj->basename_.c_str(), needed.c_str());
-  for (auto &lib : objects_) {
+  uint64_t compared = 0;
+  Elf     *found    = nullptr;
+  for (Elf *lib : candidates) {
+    ++compared;
     if (!obj->CanUse(*lib, strict_linking_)) {
       config_.Log(Debug, "  skipping %s/%s (objclass)\n",
                   lib->dirname_.c_str(), lib->basename_.c_str());
@@ -286,19 +830,47 @@ Elf* DB::FindFor(const Elf *obj, const string& needed,
       continue;
     }
     // same class, same name, and visible...
-    return lib;
+    found = lib;
+    break;
   }
-  return 0;
+  stats::Count(config_, stats::Candidates, compared);
+  return found;
 }
 
-void DB::LinkObject_do(Elf *obj, const Package *owner) {
+void DB::LinkObject_do(Elf *obj, const Package *owner,
+                       const vec<Elf*> *candidates)
+{
+  bool was_broken = IsBroken(obj);
+  reverse_index_.Reset();
   obj->req_found_.clear();
   obj->req_missing_.clear();
-  LinkObject(obj, owner, obj->req_found_, obj->req_missing_);
+  LinkObject(obj, owner, obj->req_found_, obj->req_missing_, candidates);
+  UpdateBroken(obj, was_broken);
+}
+
+void DB::UpdateBroken(const Elf *obj, bool was_broken) {
+  bool broken = IsBroken(obj);
+  if (broken == was_broken || !obj->owner_)
+    return;
+  if (broken)
+    ++obj->owner_->broken_objects_;
+  else
+    --obj->owner_->broken_objects_;
+}
+
+void DB::CountBroken() {
+  for (auto &pkg : packages_) {
+    pkg->broken_objects_ = 0;
+    for (auto &obj : pkg->objects_) {
+      if (IsBroken(obj))
+        ++pkg->broken_objects_;
+    }
+  }
 }
 
 void DB::LinkObject(Elf *obj, const Package *owner,
-                    ObjectSet &req_found, StringSet &req_missing) const
+                    ObjectSet &req_found, StringSet &req_missing,
+                    const vec<Elf*> *candidates) const
 {
   if (ignore_file_rules_.size()) {
     string full = obj->dirname_ + "/" + obj->basename_;
@@ -307,9 +879,19 @@ void DB::LinkObject(Elf *obj, const Package *owner,
   }
 
   const StringList *libpaths = GetPackageLibPath(owner);
+  uint32_t          ctx      = link_cache_.Context(obj, libpaths);
 
+  stats::Count(config_, stats::ObjectsLinked);
+  stats::Count(config_, stats::Lookups, obj->needed_.size());
   for (auto &needed : obj->needed_) {
-    Elf *found = FindFor (obj, needed, libpaths);
+    Elf *found;
+    if (!link_cache_.Find(ctx, needed, &found)) {
+      found = candidates ? FindFor(obj, needed, libpaths, *candidates)
+                         : FindFor(obj, needed, libpaths);
+      link_cache_.Insert(ctx, needed, found);
+    }
+    else
+      stats::Count(config_, stats::CacheHits);
     if (found)
       req_found.insert(found);
     else if (assume_found_rules_.find(needed) == assume_found_rules_.end())
@@ -318,126 +900,32 @@ void DB::LinkObject(Elf *obj, const Package *owner,
 }
 
 #ifdef PKGDEPDB_ENABLE_THREADS
-namespace thread {
-
-  static unsigned int ncpus_init() {
-    long v = sysconf(_SC_NPROCESSORS_CONF);
-    return (v <= 0 ? 1 : (unsigned int)v);
-  }
-
-  static unsigned int ncpus = ncpus_init();
 
-  using status_printer_func_t =
-    void (unsigned long at, unsigned long count, unsigned long threads);
-
-  template<typename PerThread>
-  using worker_func_t =
-    void(std::atomic_ulong*, size_t from, size_t to, PerThread&);
-
-  template<typename PerThread>
-  using merger_func_t = void(vec<PerThread>&&);
-
-  template<typename PerThread>
-  void work(unsigned long                      Count,
-            function<status_printer_func_t>    StatusPrinter,
-            function<worker_func_t<PerThread>> Worker,
-            function<merger_func_t<PerThread>> Merger,
-            const Config&                      Config)
-  {
-    unsigned long threadcount = thread::ncpus;
-    if (Config.max_jobs_ >= 1 && Config.max_jobs_ < threadcount)
-      threadcount = Config.max_jobs_;
-
-    unsigned long  obj_per_thread = Count / threadcount;
-    if (!Config.quiet_)
-      StatusPrinter(0, Count, threadcount);
-
-    if (threadcount == 1) {
-      for (unsigned long i = 0; i != Count; ++i) {
-        PerThread Data;
-        Worker(nullptr, i, i+1, Data);
-        if (!Config.quiet_)
-          StatusPrinter(i, Count, 1);
-      }
-      return;
-    }
-
-    // data created by threads, to be merged in the merger
-    vec<PerThread> Data;
-    Data.resize(threadcount);
-
-    std::atomic_ulong         counter(0);
-    vec<std::thread*> threads;
-
-    unsigned long i;
-    for (i = 0; i != threadcount-1; ++i) {
-      threads.emplace_back(
-        new std::thread(Worker,
-                        &counter,
-                        i*obj_per_thread,
-                        i*obj_per_thread + obj_per_thread,
-                        std::ref(Data[i])));
-    }
-    threads.emplace_back(
-      new std::thread(Worker,
-                      &counter,
-                      i*obj_per_thread, Count,
-                      std::ref(Data[i])));
-    if (!Config.quiet_) {
-      unsigned long c = 0;
-      while (c != Count) {
-        c = counter.load();
-        StatusPrinter(c, Count, threadcount);
-        usleep(100000);
-      }
-    }
-
-    for (i = 0; i != threadcount; ++i) {
-      threads[i]->join();
-      delete threads[i];
-    }
-    Merger(move(Data));
-    if (!Config.quiet_)
-      StatusPrinter(Count, Count, threadcount);
-  }
-
-} // namespace thread
-
-void DB::RelinkAll_Threaded() {
-  //using FoundMap   = std::map<Elf*, ObjectSet>;
-  //using MissingMap = std::map<Elf*, StringSet>;
-  //using Tuple      = std::tuple<FoundMap, MissingMap>;
-  auto worker = [this](std::atomic_ulong *count, size_t from, size_t to, int&)
-  {
-    //FoundMap   *f = &std::get<0>(tup);
-    //MissingMap *m = &std::get<1>(tup);
+void DB::RelinkAll_Threaded(const vec<LinkJob> &jobs) {
+  auto worker = [this,&jobs]
+  (std::atomic_ulong *count, size_t from, size_t to, int&) {
+    stats::Span    span(config_, "relink");
+    const Package *last = nullptr;
     for (size_t i = from; i != to; ++i) {
-      const Package *pkg = this->packages_[i];
-
-      for (auto &obj : pkg->objects_) {
-        this->LinkObject_do(obj, pkg);
-        //ObjectSet req_found;
-        //StringSet req_missing;
-        //this->LinkObject(obj, pkg, req_found, req_missing);
-        //(*f)[obj] = move(req_found);
-        //(*m)[obj] = move(req_missing);
+      // a package's objects may be spread over threads, its broken
+      // counter is recounted once all of them are linked
+      auto &job = jobs[i];
+      if (std::get<1>(job) != last) {
+        last = std::get<1>(job);
+        span.Start(last->name_);
       }
-
+      Elf *obj = std::get<0>(job);
+      obj->req_found_.clear();
+      obj->req_missing_.clear();
+      this->LinkObject(obj, std::get<1>(job), obj->req_found_,
+                       obj->req_missing_, std::get<2>(job));
       if (count && !config_.quiet_)
         (*count)++;
     }
   };
-  auto merger = [this](vec<int> &&) {
-    //for (auto &t : tup) {
-    //  FoundMap   &found = std::get<0>(t);
-    //  MissingMap &missing = std::get<1>(t);
-    //  for (auto &f : found)
-    //    f.first->req_found = move(f.second);
-    //  for (auto &m : missing)
-    //    m.first->req_missing = move(m.second);
-    //}
+  auto merger = [](vec<int> &&) {
   };
-  double fac = 100.0 / double(packages_.size());
+  double fac = 100.0 / double(jobs.size());
   unsigned int pc = 1000;
   auto status = [fac, &pc](unsigned long at, unsigned long cnt,
                            unsigned long threadcount)
@@ -446,66 +934,205 @@ void DB::RelinkAll_Threaded() {
     if (newpc == pc)
       return;
     pc = newpc;
-    printf("\rrelinking: %3u%% (%lu / %lu packages) [%lu]",
+    printf("\rrelinking: %3u%% (%lu / %lu objects) [%lu]",
            pc, at, cnt, threadcount);
     fflush(stdout);
     if (at == cnt)
       printf("\n");
   };
-  thread::work<int>(packages_.size(), status, worker, merger, config_);
+  thread::work<int>(jobs.size(), status, worker, merger, config_);
+  CountBroken();
 }
 #endif
 
 void DB::RelinkAll() {
+  stats::Timer timer(config_, stats::Relink);
+  OwnAll();
+  dirty_objects_.clear();
+  reverse_index_.Reset();
+  // a full relink must not depend on lookups made under older rules
+  link_cache_.Clear();
   if (!packages_.size())
     return;
 
+  // Objects can only ever link against objects of the same class and
+  // data encoding, and with strict linking also the same OS ABI (see
+  // Elf::CanUse), so every object only searches its own bucket. The jobs
+  // are grouped by bucket so threads mostly share the same candidates.
+  auto bucket_of = [this](const Elf *obj) -> uint32_t {
+    return uint32_t(obj->ei_class_)
+         | uint32_t(obj->ei_data_) << 8
+         | (strict_linking_ ? uint32_t(obj->ei_osabi_) << 16 : 0);
+  };
+  std::map<uint32_t, vec<Elf*>>       buckets;
+  std::map<uint32_t, vec<LinkJob>>    bucket_jobs;
+  for (Elf *obj : objects_)
+    buckets[bucket_of(obj)].push_back(obj);
+  for (auto &pkg : packages_) {
+    for (auto &obj : pkg->objects_) {
+      auto key = bucket_of(obj);
+      bucket_jobs[key].emplace_back(obj, pkg, &buckets[key]);
+    }
+  }
+  vec<LinkJob> jobs;
+  for (auto &b : bucket_jobs)
+    jobs.insert(jobs.end(), b.second.begin(), b.second.end());
+  if (!jobs.size())
+    return;
+
 #ifdef PKGDEPDB_ENABLE_THREADS
   if (config_.max_jobs_ != 1   &&
       thread::ncpus     >  1   &&
       packages_.size()  >  100 &&
       objects_.size()   >= 300)
   {
-    return RelinkAll_Threaded();
+    return RelinkAll_Threaded(jobs);
   }
 #endif
 
-  unsigned long pkgcount = packages_.size();
-  double        fac   = 100.0 / double(pkgcount);
+  unsigned long objcount = jobs.size();
+  double        fac   = 100.0 / double(objcount);
   unsigned long count = 0;
   unsigned int  pc    = 0;
   if (!config_.quiet_) {
-    printf("relinking: 0%% (0 / %lu packages)", pkgcount);
+    printf("relinking: 0%% (0 / %lu objects)", objcount);
     fflush(stdout);
   }
-  for (auto &pkg : packages_) {
-    for (auto &obj : pkg->objects_) {
-      LinkObject_do(obj, pkg);
+  stats::Span    span(config_, "relink");
+  const Package *last = nullptr;
+  for (auto &job : jobs) {
+    if (std::get<1>(job) != last) {
+      last = std::get<1>(job);
+      span.Start(last->name_);
     }
+    LinkObject_do(std::get<0>(job), std::get<1>(job), std::get<2>(job));
     if (!config_.quiet_) {
       ++count;
       auto newpc = (unsigned int)(fac * double(count));
       if (newpc != pc) {
         pc = newpc;
-        printf("\rrelinking: %3u%% (%lu / %lu packages)",
-               pc, count, pkgcount);
+        printf("\rrelinking: %3u%% (%lu / %lu objects)",
+               pc, count, objcount);
         fflush(stdout);
       }
     }
   }
   if (!config_.quiet_) {
-    printf("\rrelinking: 100%% (%lu / %lu packages)\n",
-           count, pkgcount);
+    printf("\rrelinking: 100%% (%lu / %lu objects)\n",
+           count, objcount);
   }
 }
 
 void DB::FixPaths() {
+  OwnAll();
   for (auto &obj : objects_) {
     fixpathlist(obj->rpath_);
     fixpathlist(obj->runpath_);
   }
 }
 
+bool DB::RelinkDirty() {
+  if (dirty_objects_.empty())
+    return false;
+  config_.Log(Message, "relinking %lu objects\n",
+              (unsigned long)dirty_objects_.size());
+  if (base_) {
+    // the objects have to be copied where they are listed
+    for (auto &slot : objects_) {
+      if (dirty_objects_.find(slot) == dirty_objects_.end())
+        continue;
+      Elf *obj = Own(slot);
+      LinkObject_do(obj, obj->owner_);
+    }
+  } else {
+    for (Elf *obj : dirty_objects_)
+      LinkObject_do(obj, obj->owner_);
+  }
+  dirty_objects_.clear();
+  return true;
+}
+
+// Adding or removing a directory can change the result of every lookup
+// for a library living in there.
+void DB::MarkDirty_Path(const string& dir) {
+  std::set<strref> names;
+  for (auto &obj : objects_) {
+    if (obj->dirname_ == dir)
+      names.insert(obj->basename_);
+  }
+  if (names.empty())
+    return;
+  for (auto &obj : objects_) {
+    for (auto &need : obj->needed_) {
+      if (names.find(need) != names.end()) {
+        dirty_objects_.insert(obj);
+        break;
+      }
+    }
+  }
+}
+
+void DB::MarkDirty_Needed(const string& lib) {
+  for (auto &obj : objects_) {
+    if (std::find(obj->needed_.begin(), obj->needed_.end(), lib)
+        != obj->needed_.end())
+    {
+      dirty_objects_.insert(obj);
+    }
+  }
+}
+
+void DB::MarkDirty_File(const string& path) {
+  size_t slash = path.find_last_of('/');
+  if (slash == string::npos)
+    return;
+  for (auto &obj : objects_) {
+    if (path.compare(slash+1, string::npos, obj->basename_) == 0 &&
+        path.compare(0, slash, obj->dirname_) == 0)
+    {
+      dirty_objects_.insert(obj);
+    }
+  }
+}
+
+void DB::MarkDirty_Package(const string& name) {
+  if (const Package *pkg = FindPkg(name)) {
+    for (auto &obj : pkg->objects_)
+      dirty_objects_.insert(obj);
+  }
+}
+
+// Strict linking only changes whether objects with an OSABI of NONE may
+// link to objects of a different OSABI and vice versa.
+void DB::MarkDirty_Strict() {
+  std::set<strref> names;
+  for (auto &obj : objects_) {
+    if (!obj->ei_osabi_)
+      names.insert(obj->basename_);
+  }
+  for (auto &obj : objects_) {
+    if (!obj->ei_osabi_) {
+      dirty_objects_.insert(obj);
+      continue;
+    }
+    for (auto &need : obj->needed_) {
+      if (names.find(need) != names.end()) {
+        dirty_objects_.insert(obj);
+        break;
+      }
+    }
+  }
+}
+
+bool DB::SetStrictLinking(bool strict) {
+  if (strict_linking_ == strict)
+    return false;
+  strict_linking_ = strict;
+  link_cache_.Clear();
+  MarkDirty_Strict();
+  return true;
+}
+
 bool DB::Empty() const {
   return packages_.size() == 0 &&
          objects_.size()  == 0;
@@ -513,7 +1140,10 @@ bool DB::Empty() const {
 
 bool DB::LD_Clear() {
   if (library_path_.size()) {
+    for (auto &dir : library_path_)
+      MarkDirty_Path(dir);
     library_path_.clear();
+    link_cache_.Clear();
     return true;
   }
   return false;
@@ -536,7 +1166,9 @@ bool DB::LD_Prepend(const string& dir) {
 bool DB::LD_Delete(size_t i) {
   if (!library_path_.size() || i >= library_path_.size())
     return false;
+  MarkDirty_Path(library_path_[i]);
   library_path_.erase(library_path_.begin() + i);
+  link_cache_.Clear();
   return true;
 }
 
@@ -551,6 +1183,8 @@ bool DB::LD_Delete(const string& dir_) {
   auto old = std::find(library_path_.begin(), library_path_.end(), dir);
   if (old != library_path_.end()) {
     library_path_.erase(old);
+    link_cache_.Clear();
+    MarkDirty_Path(dir);
     return true;
   }
   return false;
@@ -565,6 +1199,8 @@ bool DB::LD_Insert(const string& dir_, size_t i) {
   auto old = std::find(library_path_.begin(), library_path_.end(), dir);
   if (old == library_path_.end()) {
     library_path_.insert(library_path_.begin() + i, dir);
+    link_cache_.Clear();
+    MarkDirty_Path(dir);
     return true;
   }
   size_t oldidx = old - library_path_.begin();
@@ -578,6 +1214,43 @@ bool DB::LD_Insert(const string& dir_, size_t i) {
   return true;
 }
 
+// Inserts the directories as they are, without looking for ones already
+// in the path.
+size_t DB::LD_Insert(const StringSet& dirs, size_t i) {
+  if (i > library_path_.size())
+    i = library_path_.size();
+  library_path_.insert(library_path_.begin() + i, dirs.begin(), dirs.end());
+  for (auto &dir : dirs)
+    MarkDirty_Path(dir);
+  if (!dirs.empty())
+    link_cache_.Clear();
+  return dirs.size();
+}
+
+size_t DB::LD_Delete(size_t i, size_t count) {
+  if (i >= library_path_.size())
+    return 0;
+  if (count > library_path_.size() - i)
+    count = library_path_.size() - i;
+  auto from = library_path_.begin() + i;
+  for (auto dir = from; dir != from + count; ++dir)
+    MarkDirty_Path(*dir);
+  library_path_.erase(from, from + count);
+  if (count)
+    link_cache_.Clear();
+  return count;
+}
+
+bool DB::LD_Set(size_t i, const string& dir) {
+  if (i >= library_path_.size())
+    return false;
+  MarkDirty_Path(library_path_[i]);
+  library_path_[i] = dir;
+  MarkDirty_Path(dir);
+  link_cache_.Clear();
+  return true;
+}
+
 bool DB::PKG_LD_Insert(const string& package,
                        const string& directory,
                        size_t        i)
@@ -592,6 +1265,7 @@ bool DB::PKG_LD_Insert(const string& package,
   auto old = std::find(path.begin(), path.end(), dir);
   if (old == path.end()) {
     path.insert(path.begin() + i, dir);
+    MarkDirty_Package(package);
     return true;
   }
   size_t oldidx = old - path.begin();
@@ -616,6 +1290,7 @@ bool DB::PKG_LD_Delete(const string& package, const string& directory) {
     path.erase(old);
     if (!path.size())
       package_library_path_.erase(iter);
+    MarkDirty_Package(package);
     return true;
   }
   return false;
@@ -632,6 +1307,7 @@ bool DB::PKG_LD_Delete(const string& package, size_t i) {
   path.erase(path.begin()+i);
   if (!path.size())
     package_library_path_.erase(iter);
+  MarkDirty_Package(package);
   return true;
 }
 
@@ -641,15 +1317,24 @@ bool DB::PKG_LD_Clear(const string& package) {
     return false;
 
   package_library_path_.erase(iter);
+  MarkDirty_Package(package);
   return true;
 }
 
 bool DB::IgnoreFile_Add(const string& filename) {
-  return std::get<1>(ignore_file_rules_.insert(fixcpath(filename)));
+  string path(fixcpath(filename));
+  if (!std::get<1>(ignore_file_rules_.insert(path)))
+    return false;
+  MarkDirty_File(path);
+  return true;
 }
 
 bool DB::IgnoreFile_Delete(const string& filename) {
-  return (ignore_file_rules_.erase(fixcpath(filename)) > 0);
+  string path(fixcpath(filename));
+  if (!ignore_file_rules_.erase(path))
+    return false;
+  MarkDirty_File(path);
+  return true;
 }
 
 bool DB::IgnoreFile_Delete(size_t id) {
@@ -660,16 +1345,23 @@ bool DB::IgnoreFile_Delete(size_t id) {
     ++iter;
     --id;
   }
+  MarkDirty_File(*iter);
   ignore_file_rules_.erase(iter);
   return true;
 }
 
 bool DB::AssumeFound_Add(const string& name) {
-  return std::get<1>(assume_found_rules_.insert(name));
+  if (!std::get<1>(assume_found_rules_.insert(name)))
+    return false;
+  MarkDirty_Needed(name);
+  return true;
 }
 
 bool DB::AssumeFound_Delete(const string& name) {
-  return (assume_found_rules_.erase(name) > 0);
+  if (!assume_found_rules_.erase(name))
+    return false;
+  MarkDirty_Needed(name);
+  return true;
 }
 
 bool DB::AssumeFound_Delete(size_t id) {
@@ -680,6 +1372,7 @@ bool DB::AssumeFound_Delete(size_t id) {
     ++iter;
     --id;
   }
+  MarkDirty_Needed(*iter);
   assume_found_rules_.erase(iter);
   return true;
 }
@@ -760,65 +1453,84 @@ bool DB::IsEmpty(const Package *pkg, const ObjFilterList &filters) const {
 }
 
 bool DB::IsBroken(const Package *pkg) const {
-  for (auto &obj : pkg->objects_) {
-    if (IsBroken(obj))
-      return true;
+  return pkg->broken_objects_ != 0;
+}
+
+vec<const Package*> DB::BrokenPackages() const {
+  vec<const Package*> broken;
+  for (auto &pkg : packages_) {
+    if (IsBroken(pkg))
+      broken.push_back(pkg);
   }
-  return false;
+  return broken;
 }
 
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wformat-nonliteral"
-static void ShowDependList(const char *fmt, const DependList& lst) {
+static void ShowDependList(Writer &out, const char *what,
+                           const DependList& lst)
+{
   for (const auto &dep : lst)
-    printf(fmt, std::get<0>(dep).c_str(), std::get<1>(dep).c_str());
+    out.Put(what).Put(std::get<0>(dep)).Put(std::get<1>(dep)).Put('\n');
+}
+
+static void ShowObjName(Writer &out, const char *prefix, const Elf *obj,
+                        const char *sep)
+{
+  out.Put(prefix).Put(obj->dirname_).Put(sep).Put(obj->basename_).Put('\n');
 }
-#pragma clang diagnostic pop
 
 void DB::ShowPackages(bool                 filter_broken,
                       bool                 filter_notempty,
                       const FilterList    &pkg_filters,
                       const ObjFilterList &obj_filters)
 {
+  RelinkDirty();
   if (config_.json_ & JSONBits::Query)
     return ShowPackages_json(filter_broken, filter_notempty,
                              pkg_filters, obj_filters);
 
-  if (!config_.quiet_)
-    printf("Packages:%s\n", (filter_broken ? " (filter: 'broken')" : ""));
-  for (auto &pkg : packages_) {
-    if (!util::all(pkg_filters, *this, *pkg))
-      continue;
-    if (filter_broken && !IsBroken(pkg))
-      continue;
-    if (filter_notempty && IsEmpty(pkg, obj_filters))
-      continue;
-    if (config_.quiet_)
-      printf("%s\n", pkg->name_.c_str());
-    else
-      printf("  -> %s - %s\n", pkg->name_.c_str(), pkg->version_.c_str());
-    if (config_.verbosity_ >= 1) {
+  Writer out(stdout);
+  if (!config_.quiet_) {
+    out.Put("Packages:");
+    if (filter_broken)
+      out.Put(" (filter: 'broken')");
+    out.Put('\n');
+  }
+  auto format = [&](Writer &out, size_t from, size_t to, bool) {
+    for (size_t i = from; i != to; ++i) {
+      const Package *pkg = packages_[i];
+      if (!util::all(pkg_filters, *this, *pkg))
+        continue;
+      if (filter_broken && !IsBroken(pkg))
+        continue;
+      if (filter_notempty && IsEmpty(pkg, obj_filters))
+        continue;
+      if (config_.quiet_)
+        out.Put(pkg->name_).Put('\n');
+      else
+        out.Put("  -> ").Put(pkg->name_).Put(" - ").Put(pkg->version_)
+           .Put('\n');
+      if (config_.verbosity_ < 1)
+        continue;
       if (!pkg->pkgbase_.empty())
-        printf("    package base: %s\n", pkg->pkgbase_.c_str());
+        out.Put("    package base: ").Put(pkg->pkgbase_).Put('\n');
       for (auto &grp : pkg->groups_)
-        printf("    is in group: %s\n", grp.c_str());
-      ShowDependList("    depends on: %s%s\n",              pkg->depends_);
-      ShowDependList("    depends optionally on: %s%s\n",   pkg->optdepends_);
-      ShowDependList("    depends at buildtime on: %s%s\n", pkg->makedepends_);
-      ShowDependList("    check depends on: %s%s\n",        pkg->checkdepends_);
-      ShowDependList("    provides: %s%s\n",                pkg->provides_);
-      ShowDependList("    replaces: %s%s\n",                pkg->replaces_);
-      ShowDependList("    conflicts with: %s%s\n",          pkg->conflicts_);
+        out.Put("    is in group: ").Put(grp).Put('\n');
+      ShowDependList(out, "    depends on: ",              pkg->depends_);
+      ShowDependList(out, "    depends optionally on: ",   pkg->optdepends_);
+      ShowDependList(out, "    depends at buildtime on: ", pkg->makedepends_);
+      ShowDependList(out, "    check depends on: ",        pkg->checkdepends_);
+      ShowDependList(out, "    provides: ",                pkg->provides_);
+      ShowDependList(out, "    replaces: ",                pkg->replaces_);
+      ShowDependList(out, "    conflicts with: ",          pkg->conflicts_);
       if (filter_broken) {
         for (auto &obj : pkg->objects_) {
           if (!util::all(obj_filters, *this, *obj))
             continue;
           if (IsBroken(obj)) {
-            printf("    broken: %s / %s\n",
-                   obj->dirname_.c_str(), obj->basename_.c_str());
+            ShowObjName(out, "    broken: ", obj, " / ");
             if (config_.verbosity_ >= 2) {
               for (auto &missing : obj->req_missing_)
-                printf("      misses: %s\n", missing.c_str());
+                out.Put("      misses: ").Put(missing).Put('\n');
             }
           }
         }
@@ -827,99 +1539,108 @@ void DB::ShowPackages(bool                 filter_broken,
         for (auto &obj : pkg->objects_) {
           if (!util::all(obj_filters, *this, *obj))
             continue;
-          printf("    contains %s / %s\n",
-                 obj->dirname_.c_str(), obj->basename_.c_str());
+          ShowObjName(out, "    contains ", obj, " / ");
         }
       }
     }
-  }
+  };
+  thread::ordered_output(out, packages_.size(), 0, format, config_);
 }
 
 void DB::ShowObjects(const FilterList    &pkg_filters,
                      const ObjFilterList &obj_filters)
 {
+  RelinkDirty();
   if (config_.json_ & JSONBits::Query)
     return ShowObjects_json(pkg_filters, obj_filters);
 
+  Writer out(stdout);
   if (!objects_.size()) {
     if (!config_.quiet_)
-      printf("Objects: none\n");
+      out.Put("Objects: none\n");
     return;
   }
   if (!config_.quiet_)
-    printf("Objects:\n");
-  for (auto &obj : objects_) {
-    if (!util::all(obj_filters, *this, *obj))
-      continue;
-    if (pkg_filters.size() &&
-        (!obj->owner_ || !util::all(pkg_filters, *this, *obj->owner_)))
-      continue;
-    if (config_.quiet_)
-      printf("%s/%s\n", obj->dirname_.c_str(), obj->basename_.c_str());
-    else
-      printf("  -> %s / %s\n", obj->dirname_.c_str(), obj->basename_.c_str());
-    if (config_.verbosity_ < 1)
-      continue;
-    printf("     class: %u (%s)\n"
-           "     data:  %u (%s)\n"
-           "     osabi: %u (%s)\n",
-           (unsigned)obj->ei_class_, obj->classString(),
-           (unsigned)obj->ei_data_,  obj->dataString(),
-           (unsigned)obj->ei_osabi_, obj->osabiString());
-    if (obj->rpath_set_)
-      printf("     rpath: %s\n", obj->rpath_.c_str());
-    if (obj->runpath_set_)
-      printf("     runpath: %s\n", obj->runpath_.c_str());
-    if (obj->interpreter_.length())
-      printf("     interpreter: %s\n", obj->interpreter_.c_str());
-    if (config_.verbosity_ < 2)
-      continue;
-    printf("     finds:\n"); {
-      for (auto &found : obj->req_found_)
-        printf("       -> %s / %s\n",
-               found->dirname_.c_str(), found->basename_.c_str());
-    }
-    printf("     misses:\n"); {
-      for (auto &miss : obj->req_missing_)
-        printf("       -> %s\n", miss.c_str());
+    out.Put("Objects:\n");
+  auto format = [&](Writer &out, size_t from, size_t to, bool) {
+    for (size_t i = from; i != to; ++i) {
+      const Elf *obj = objects_[i];
+      if (!util::all(obj_filters, *this, *obj))
+        continue;
+      if (pkg_filters.size() &&
+          (!obj->owner_ || !util::all(pkg_filters, *this, *obj->owner_)))
+        continue;
+      if (config_.quiet_)
+        ShowObjName(out, "", obj, "/");
+      else
+        ShowObjName(out, "  -> ", obj, " / ");
+      if (config_.verbosity_ < 1)
+        continue;
+      out.Put("     class: ").Unsigned(obj->ei_class_)
+         .Put(" (").Put(obj->classString()).Put(")\n")
+         .Put("     data:  ").Unsigned(obj->ei_data_)
+         .Put(" (").Put(obj->dataString()).Put(")\n")
+         .Put("     osabi: ").Unsigned(obj->ei_osabi_)
+         .Put(" (").Put(obj->osabiString()).Put(")\n");
+      if (obj->rpath_set_)
+        out.Put("     rpath: ").Put(obj->rpath_).Put('\n');
+      if (obj->runpath_set_)
+        out.Put("     runpath: ").Put(obj->runpath_).Put('\n');
+      if (obj->interpreter_.length())
+        out.Put("     interpreter: ").Put(obj->interpreter_).Put('\n');
+      if (config_.verbosity_ < 2)
+        continue;
+      out.Put("     finds:\n"); {
+        for (auto &found : obj->req_found_)
+          ShowObjName(out, "       -> ", found, " / ");
+      }
+      out.Put("     misses:\n"); {
+        for (auto &miss : obj->req_missing_)
+          out.Put("       -> ").Put(miss).Put('\n');
+      }
     }
-  }
+  };
+  thread::ordered_output(out, objects_.size(), 0, format, config_);
 }
 
 void DB::ShowMissing() {
+  RelinkDirty();
   if (config_.json_ & JSONBits::Query)
     return ShowMissing_json();
 
+  Writer out(stdout);
   if (!config_.quiet_)
-    printf("Missing:\n");
+    out.Put("Missing:\n");
   for (Elf *obj : objects_) {
     if (obj->req_missing_.empty())
       continue;
     if (config_.quiet_)
-      printf("%s/%s\n", obj->dirname_.c_str(), obj->basename_.c_str());
+      ShowObjName(out, "", obj, "/");
     else
-      printf("  -> %s / %s\n", obj->dirname_.c_str(), obj->basename_.c_str());
+      ShowObjName(out, "  -> ", obj, " / ");
     for (auto &s : obj->req_missing_) {
-      printf("    misses: %s\n", s.c_str());
+      out.Put("    misses: ").Put(s).Put('\n');
     }
   }
 }
 
 void DB::ShowFound() {
+  RelinkDirty();
   if (config_.json_ & JSONBits::Query)
     return ShowFound_json();
 
+  Writer out(stdout);
   if (!config_.quiet_)
-    printf("Found:\n");
+    out.Put("Found:\n");
   for (Elf *obj : objects_) {
     if (obj->req_found_.empty())
       continue;
     if (config_.quiet_)
-      printf("%s/%s\n", obj->dirname_.c_str(), obj->basename_.c_str());
+      ShowObjName(out, "", obj, "/");
     else
-      printf("  -> %s / %s\n", obj->dirname_.c_str(), obj->basename_.c_str());
+      ShowObjName(out, "  -> ", obj, " / ");
     for (auto &s : obj->req_found_)
-      printf("    finds: %s\n", s->basename_.c_str());
+      out.Put("    finds: ").Put(s->basename_).Put('\n');
   }
 }
 
@@ -929,17 +1650,381 @@ void DB::ShowFilelist(const FilterList    &pkg_filters,
   if (config_.json_ & JSONBits::Query)
     return ShowFilelist_json(pkg_filters, str_filters);
 
-  for (auto &pkg : packages_) {
-    if (!util::all(pkg_filters, *this, *pkg))
+  Writer out(stdout);
+  auto format = [&](Writer &out, size_t from, size_t to, bool) {
+    for (size_t i = from; i != to; ++i) {
+      const Package *pkg = packages_[i];
+      if (!util::all(pkg_filters, *this, *pkg))
+        continue;
+      for (auto &file : pkg->filelist_) {
+        if (!util::all(str_filters, file))
+          continue;
+        if (!config_.quiet_)
+          out.Put(pkg->name_).Put(' ');
+        out.Put(file).Put('\n');
+      }
+    }
+  };
+  thread::ordered_output(out, packages_.size(), 0, format, config_);
+}
+
+void DB::ShowOwners(const StringList &paths,
+                    const FilterList &pkg_filters)
+{
+  if (config_.json_ & JSONBits::Query)
+    return ShowOwners_json(paths, pkg_filters);
+
+  Writer out(stdout);
+  for (auto &path : paths) {
+    bool owned = false;
+    for (auto &pkg : FindOwners(path)) {
+      if (!util::all(pkg_filters, *this, *pkg))
+        continue;
+      owned = true;
+      if (config_.quiet_)
+        out.Put(pkg->name_).Put('\n');
+      else
+        out.Put(pkg->name_).Put(' ').Put(path).Put('\n');
+    }
+    if (!owned)
+      config_.Log(Warn, "%s: not owned by any package\n", path.c_str());
+  }
+}
+
+void DB::Impact(const vec<const Package*> &packages,
+                const vec<const Elf*>     &objects,
+                ImpactResult              &result) const
+{
+  reverse_index_.Build(packages_, objects_);
+
+  std::set<const Package*> removed(packages.begin(), packages.end());
+  // objects are identified by their origin, see Elf::Origin
+  std::set<const Elf*> gone;
+  for (auto &obj : objects)
+    gone.insert(obj->Origin());
+  for (auto &pkg : packages) {
+    for (auto &obj : pkg->objects_)
+      gone.insert(obj->Origin());
+  }
+
+  // the remaining objects using a removed one
+  std::set<const Elf*> seekers;
+  for (auto &obj : gone) {
+    for (auto &user : reverse_index_.Users(obj)) {
+      if (gone.find(user->Origin()) == gone.end())
+        seekers.insert(user);
+    }
+  }
+
+  // look for replacements like UnlinkPackages() would
+  for (auto &seeker : seekers) {
+    const StringList *libpaths = GetObjectLibPath(seeker);
+    StringList missing;
+    for (auto &lib : seeker->req_found_) {
+      if (gone.find(lib->Origin()) == gone.end())
+        continue;
+      vec<Elf*> candidates;
+      for (auto &other : reverse_index_.Named(lib->basename_)) {
+        if (gone.find(other->Origin()) == gone.end())
+          candidates.push_back(other);
+      }
+      if (FindFor(seeker, lib->basename_, libpaths, candidates))
+        continue;
+      if (assume_found_rules_.find(lib->basename_) ==
+          assume_found_rules_.end())
+      {
+        missing.push_back(lib->basename_);
+      }
+    }
+    if (!missing.empty())
+      result.objects_.emplace_back(seeker, move(missing));
+  }
+  std::sort(result.objects_.begin(), result.objects_.end(),
+    [](const tuple<const Elf*, StringList> &a,
+       const tuple<const Elf*, StringList> &b)
+    {
+      const Elf *x = std::get<0>(a), *y = std::get<0>(b);
+      const string &xo = x->owner_ ? x->owner_->name_ : x->dirname_;
+      const string &yo = y->owner_ ? y->owner_->name_ : y->dirname_;
+      return std::tie(xo, x->dirname_, x->basename_) <
+             std::tie(yo, y->dirname_, y->basename_);
+    });
+
+  // the names the removed packages satisfy and nothing else does
+  std::map<string, const Package*> lost;
+  for (auto &pkg : packages) {
+    lost.emplace(pkg->name_, pkg);
+    for (auto &prov : pkg->provides_)
+      lost.emplace(std::get<0>(prov), pkg);
+  }
+  std::map<string, StringList> depends;
+  for (auto &name : lost) {
+    bool provided = false;
+    for (auto &other : reverse_index_.Providers(name.first))
+      provided = provided || removed.find(other) == removed.end();
+    if (provided)
       continue;
-    for (auto &file : pkg->filelist_) {
-      if (!util::all(str_filters, file))
+    for (auto &pkg : reverse_index_.Dependers(name.first)) {
+      if (removed.find(pkg) == removed.end())
+        depends[pkg->name_].push_back(name.first);
+    }
+  }
+  for (auto &dep : depends)
+    result.depends_.emplace_back(FindPkg(dep.first), move(dep.second));
+}
+
+void DB::ShowImpact(const StringList &names) {
+  RelinkDirty();
+
+  vec<const Package*> packages;
+  vec<const Elf*>     objects;
+  for (auto &name : names) {
+    size_t slash = name.find_last_of('/');
+    if (slash == string::npos) {
+      if (const Package *pkg = FindPkg(name))
+        packages.push_back(pkg);
+      else
+        config_.Log(Warn, "%s: no such package\n", name.c_str());
+      continue;
+    }
+    reverse_index_.Build(packages_, objects_);
+    string dir(name, 0, slash);
+    if (dir.empty() || dir[0] != '/')
+      dir.insert(0, 1, '/');
+    bool found = false;
+    for (auto &obj : reverse_index_.Named(name.substr(slash+1))) {
+      if (obj->dirname_ == dir) {
+        objects.push_back(obj);
+        found = true;
+      }
+    }
+    if (!found)
+      config_.Log(Warn, "%s: no such object\n", name.c_str());
+  }
+
+  ImpactResult result;
+  Impact(packages, objects, result);
+  if (config_.json_ & JSONBits::Query)
+    return ShowImpact_json(result);
+
+  Writer out(stdout);
+  out.Put("Broken objects:\n");
+  for (auto &entry : result.objects_) {
+    const Elf *obj = std::get<0>(entry);
+    if (config_.quiet_)
+      ShowObjName(out, "", obj, "/");
+    else
+      ShowObjName(out, "  -> ", obj, " / ");
+    for (auto &lib : std::get<1>(entry))
+      out.Put("    misses: ").Put(lib).Put('\n');
+  }
+  out.Put("Broken packages:\n");
+  const Package *last = nullptr;
+  for (auto &entry : result.objects_) {
+    const Package *owner = std::get<0>(entry)->owner_;
+    if (!owner || owner == last)
+      continue;
+    last = owner;
+    out.Put("  ").Put(owner->name_).Put('\n');
+  }
+  out.Put("Unsatisfied dependencies:\n");
+  for (auto &entry : result.depends_) {
+    out.Put("  ").Put(std::get<0>(entry)->name_).Put('\n');
+    for (auto &dep : std::get<1>(entry))
+      out.Put("    misses: ").Put(dep).Put('\n');
+  }
+}
+
+void DB::Preview(const vec<const Package*> &packages,
+                 PreviewResult             &result) const
+{
+  reverse_index_.Build(packages_, objects_);
+
+  // installing a package of the same name twice keeps the last one
+  vec<const Package*> install;
+  for (auto pkg = packages.rbegin(); pkg != packages.rend(); ++pkg) {
+    bool later = false;
+    for (auto &other : install)
+      later = later || other->name_ == (*pkg)->name_;
+    if (!later)
+      install.insert(install.begin(), *pkg);
+  }
+
+  // the replaced objects by origin, see Elf::Origin
+  std::set<const Elf*> gone;
+  std::map<const Package*, const Package*> old_of;
+  std::unordered_map<string, vec<tuple<const Elf*, const Package*>>> added;
+  for (auto &pkg : install) {
+    if (const Package *old = FindPkg(pkg->name_)) {
+      result.replaced_.emplace_back(pkg, old);
+      old_of[pkg] = old;
+      for (auto &obj : old->objects_)
+        gone.insert(obj->Origin());
+    }
+    for (auto &obj : pkg->objects_)
+      added[obj->basename_].emplace_back(obj, pkg);
+  }
+
+  // whether obj would find a library among the new objects, or among the
+  // remaining ones when it lost one
+  auto finds_added = [&](const Elf *obj, const string &name,
+                         const StringList *libpaths) -> bool
+  {
+    auto fnd = added.find(name);
+    if (fnd == added.end())
+      return false;
+    for (auto &other : fnd->second) {
+      const Elf *lib = std::get<0>(other);
+      if (obj->CanUse(*lib, strict_linking_) &&
+          ElfFinds(obj, lib->dirname_, libpaths))
+      {
+        return true;
+      }
+    }
+    return false;
+  };
+  auto finds = [&](const Elf *obj, const string &name,
+                   const StringList *libpaths) -> bool
+  {
+    for (auto &lib : reverse_index_.Named(name)) {
+      if (gone.find(lib->Origin()) == gone.end() &&
+          obj->CanUse(*lib, strict_linking_) &&
+          ElfFinds(obj, lib->dirname_, libpaths))
+      {
+        return true;
+      }
+    }
+    return finds_added(obj, name, libpaths);
+  };
+
+  // the remaining objects which lose a library or may find a missing one
+  std::set<const Elf*> seekers;
+  for (auto &obj : gone) {
+    for (auto &user : reverse_index_.Users(obj)) {
+      if (gone.find(user->Origin()) == gone.end())
+        seekers.insert(user);
+    }
+  }
+  for (auto &name : added) {
+    for (auto &seeker : reverse_index_.Missing(name.first)) {
+      if (gone.find(seeker->Origin()) == gone.end())
+        seekers.insert(seeker);
+    }
+  }
+
+  for (auto &seeker : seekers) {
+    const StringList *libpaths = GetObjectLibPath(seeker);
+    StringList missing;
+    for (auto &name : seeker->req_missing_) {
+      if (!finds_added(seeker, name, libpaths))
+        missing.push_back(name);
+    }
+    bool lost = false;
+    for (auto &lib : seeker->req_found_) {
+      if (gone.find(lib->Origin()) == gone.end())
         continue;
-      if (!config_.quiet_)
-        printf("%s ", pkg->name_.c_str());
-      printf("%s\n", file.c_str());
+      if (finds(seeker, lib->basename_, libpaths))
+        continue;
+      if (assume_found_rules_.find(lib->basename_) ==
+          assume_found_rules_.end())
+      {
+        missing.push_back(lib->basename_);
+        lost = true;
+      }
+    }
+    if (lost && !IsBroken(seeker)) {
+      std::sort(missing.begin(), missing.end());
+      missing.erase(std::unique(missing.begin(), missing.end()),
+                    missing.end());
+      result.broken_.emplace_back(seeker->owner_, seeker, move(missing));
+    }
+    else if (missing.empty() && IsBroken(seeker))
+      result.fixed_.emplace_back(seeker->owner_, seeker);
+  }
+
+  // the new objects compared to the ones they replace
+  for (auto &pkg : install) {
+    auto old = old_of.find(pkg);
+    const StringList *libpaths = GetPackageLibPath(pkg);
+    for (auto &obj : pkg->objects_) {
+      StringList missing;
+      string full = obj->dirname_ + "/" + obj->basename_;
+      if (ignore_file_rules_.find(full) == ignore_file_rules_.end()) {
+        for (auto &name : obj->needed_) {
+          if (!finds(obj, name, libpaths) &&
+              assume_found_rules_.find(name) == assume_found_rules_.end())
+          {
+            missing.push_back(name);
+          }
+        }
+      }
+      const Elf *before = old == old_of.end() ? nullptr :
+        old->second->Find(obj->dirname_, obj->basename_);
+      bool was_broken = before && IsBroken(before);
+      if (!missing.empty() && !was_broken) {
+        std::sort(missing.begin(), missing.end());
+        missing.erase(std::unique(missing.begin(), missing.end()),
+                      missing.end());
+        result.broken_.emplace_back(pkg, obj, move(missing));
+      }
+      else if (missing.empty() && was_broken)
+        result.fixed_.emplace_back(pkg, obj);
     }
   }
+
+  auto by_name = [](const Package *pkg, const Elf *obj) {
+    return std::tie(pkg ? pkg->name_ : obj->dirname_,
+                    obj->dirname_, obj->basename_);
+  };
+  std::sort(result.broken_.begin(), result.broken_.end(),
+    [&by_name](const tuple<const Package*, const Elf*, StringList> &a,
+               const tuple<const Package*, const Elf*, StringList> &b)
+    {
+      return by_name(std::get<0>(a), std::get<1>(a)) <
+             by_name(std::get<0>(b), std::get<1>(b));
+    });
+  std::sort(result.fixed_.begin(), result.fixed_.end(),
+    [&by_name](const tuple<const Package*, const Elf*> &a,
+               const tuple<const Package*, const Elf*> &b)
+    {
+      return by_name(std::get<0>(a), std::get<1>(a)) <
+             by_name(std::get<0>(b), std::get<1>(b));
+    });
+}
+
+void DB::ShowPreview(const vec<const Package*> &packages) {
+  RelinkDirty();
+
+  PreviewResult result;
+  Preview(packages, result);
+  if (config_.json_ & JSONBits::Query)
+    return ShowPreview_json(result);
+
+  Writer out(stdout);
+  out.Put("Replaced packages:\n");
+  for (auto &entry : result.replaced_) {
+    const Package *pkg = std::get<0>(entry), *old = std::get<1>(entry);
+    out.Put("  ").Put(pkg->name_).Put(": ").Put(old->version_)
+       .Put(" -> ").Put(pkg->version_).Put('\n');
+  }
+  out.Put("Broken objects:\n");
+  for (auto &entry : result.broken_) {
+    const Elf *obj = std::get<1>(entry);
+    if (config_.quiet_)
+      ShowObjName(out, "", obj, "/");
+    else
+      ShowObjName(out, "  -> ", obj, " / ");
+    for (auto &lib : std::get<2>(entry))
+      out.Put("    misses: ").Put(lib).Put('\n');
+  }
+  out.Put("Fixed objects:\n");
+  for (auto &entry : result.fixed_) {
+    const Elf *obj = std::get<1>(entry);
+    if (config_.quiet_)
+      ShowObjName(out, "", obj, "/");
+    else
+      ShowObjName(out, "  -> ", obj, " / ");
+  }
 }
 
 void split_dependency(const string &full, string &dep, string &constraint) {
@@ -1117,14 +2202,39 @@ static const Package* find_depend(const string     &dependency,
   return nullptr;
 }
 
+using Findings = vec<tuple<uint8_t,string>>;
+
+static void add_finding(Findings *findings, uint8_t verbosity,
+                        const char *fmt, ...)
+  __attribute__((format(printf, 3, 4)));
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wformat-nonliteral"
+static void add_finding(Findings *findings, uint8_t verbosity,
+                        const char *fmt, ...)
+{
+  va_list ap;
+  va_start(ap, fmt);
+  int len = vsnprintf(nullptr, 0, fmt, ap);
+  va_end(ap);
+  if (len < 0)
+    return;
+  string msg(size_t(len)+1, 0);
+  va_start(ap, fmt);
+  vsnprintf(&msg[0], msg.length(), fmt, ap);
+  va_end(ap);
+  msg.resize(size_t(len));
+  findings->emplace_back(verbosity, move(msg));
+}
+#pragma clang diagnostic pop
+
 static void install_recursive(vec<const Package*>         &packages,
                               PkgMap                      &installmap,
                               const Package               *pkg,
                               const PkgMap                &pkgmap,
                               const PkgListMap            &providemap,
                               const PkgListMap            &replacemap,
-                              const bool                   showmsg,
-                              const bool                   quiet)
+                              Findings                    *findings)
 {
   if (installmap.find(pkg->name_) != installmap.end())
     return;
@@ -1151,14 +2261,13 @@ static void install_recursive(vec<const Package*>         &packages,
       if (!version_op(op, other->version_.c_str(), ver.c_str()))
         continue;
     }
-    if (showmsg) {
-      printf("%s%s conflicts with %s (%s-%s): { %s%s }\n",
-             (quiet ? "" : "\r"),
-             pkg->name_.c_str(),
-             conf.c_str(),
-             other->name_.c_str(),
-             other->version_.c_str(),
-             conf.c_str(), std::get<1>(full).c_str());
+    if (findings) {
+      add_finding(findings, 0, "%s conflicts with %s (%s-%s): { %s%s }\n",
+                  pkg->name_.c_str(),
+                  conf.c_str(),
+                  other->name_.c_str(),
+                  other->version_.c_str(),
+                  conf.c_str(), std::get<1>(full).c_str());
     }
   }
 #endif
@@ -1167,49 +2276,165 @@ static void install_recursive(vec<const Package*>         &packages,
     auto found = find_depend(std::get<0>(dep), std::get<1>(dep),
                              pkgmap, providemap, replacemap);
     if (!found) {
-      if (showmsg) {
-        printf("%smissing package: %s depends on %s%s\n",
-               (quiet ? "" : "\r"),
-               pkg->name_.c_str(),
-               std::get<0>(dep).c_str(), std::get<1>(dep).c_str());
+      if (findings) {
+        add_finding(findings, 0, "missing package: %s depends on %s%s\n",
+                    pkg->name_.c_str(),
+                    std::get<0>(dep).c_str(), std::get<1>(dep).c_str());
       }
       continue;
     }
     install_recursive(packages, installmap, found,
-                      pkgmap, providemap, replacemap, false, quiet);
+                      pkgmap, providemap, replacemap, nullptr);
   }
   for (auto &dep : pkg->optdepends_) {
     auto found = find_depend(std::get<0>(dep), std::get<1>(dep),
                              pkgmap, providemap, replacemap);
     if (!found) {
-      if (showmsg) {
-        printf("%smissing package: %s depends optionally on %s%s\n",
-               (quiet ? "" : "\r"),
-               pkg->name_.c_str(),
-               std::get<0>(dep).c_str(), std::get<1>(dep).c_str());
+      if (findings) {
+        add_finding(findings, 0,
+                    "missing package: %s depends optionally on %s%s\n",
+                    pkg->name_.c_str(),
+                    std::get<0>(dep).c_str(), std::get<1>(dep).c_str());
       }
       continue;
     }
     install_recursive(packages, installmap, found,
-                      pkgmap, providemap, replacemap, false, quiet);
+                      pkgmap, providemap, replacemap, nullptr);
+  }
+}
+
+// FNV-1a, used to fingerprint the data an integrity check depends on
+class Fingerprint {
+ public:
+  uint64_t value_ = 14695981039346656037ULL;
+
+  void Add(const void *data, size_t length) {
+    auto bytes = reinterpret_cast<const unsigned char*>(data);
+    for (size_t i = 0; i != length; ++i) {
+      value_ ^= bytes[i];
+      value_ *= 1099511628211ULL;
+    }
   }
+  void Add(uint64_t v) {
+    Add(&v, sizeof(v));
+  }
+  void Add(const string& str) {
+    Add(uint64_t(str.length()));
+    Add(str.c_str(), str.length());
+  }
+  void Add(const DependList& list) {
+    Add(uint64_t(list.size()));
+    for (auto &dep : list) {
+      Add(std::get<0>(dep));
+      Add(std::get<1>(dep));
+    }
+  }
+};
+
+// Everything about a package which can influence the integrity check of
+// itself or of any package pulling it in.
+static uint64_t package_digest(const Package *pkg) {
+  Fingerprint fp;
+  fp.Add(pkg->name_);
+  fp.Add(pkg->version_);
+  fp.Add(pkg->depends_);
+  fp.Add(pkg->optdepends_);
+  fp.Add(pkg->provides_);
+  fp.Add(pkg->replaces_);
+  fp.Add(pkg->conflicts_);
+  fp.Add(uint64_t(pkg->objects_.size()));
+  for (auto &obj : pkg->objects_) {
+    fp.Add(obj->dirname_);
+    fp.Add(obj->basename_);
+    fp.Add(uint64_t(obj->needed_.size()));
+    for (auto &need : obj->needed_)
+      fp.Add(need);
+  }
+  return fp.value_;
 }
 
-void DB::CheckIntegrity(const Package             *pkg,
+// The names under which a package affects the checks of other packages:
+// dependencies are resolved by name, provides and replaces, and needed
+// libraries by object basename.
+static void package_names(const Package *pkg, StringList &names) {
+  names.clear();
+  names.push_back(pkg->name_);
+  for (auto &prov : pkg->provides_)
+    names.push_back(std::get<0>(prov));
+  for (auto &repl : pkg->replaces_)
+    names.push_back(std::get<0>(repl));
+  for (auto &obj : pkg->objects_)
+    names.push_back(obj->basename_);
+  std::sort(names.begin(), names.end());
+  names.erase(std::unique(names.begin(), names.end()), names.end());
+}
+
+static bool integrity_affected(const StringList &inputs,
+                               const StringSet  &changed)
+{
+  if (changed.empty())
+    return false;
+  for (auto &name : inputs) {
+    if (changed.find(name) != changed.end())
+      return true;
+  }
+  return false;
+}
+
+bool DB::CheckIntegrity(const Package             *pkg,
                         const PkgMap              &pkgmap,
                         const PkgListMap          &providemap,
                         const PkgListMap          &replacemap,
                         const PkgMap              &basemap,
                         const ObjListMap          &objmap,
                         const vec<const Package*> &package_base,
-                        const ObjFilterList       &obj_filters) const
+                        const ObjFilterList       &obj_filters,
+                        const IntegrityState      *state,
+                        IntegrityResult           &result) const
 {
+  // An unchanged package needs no walk through its dependencies as long as
+  // nothing it depended on last time changed since.
+  if (state) {
+    auto cached = integrity_cache_.find(pkg->name_);
+    if (cached != integrity_cache_.end() &&
+        cached->second.fingerprint_ == state->base_ &&
+        !integrity_affected(cached->second.inputs_, state->changed_))
+    {
+      result.findings_ = cached->second.findings_;
+      return true;
+    }
+  }
+
   vec<const Package*> pulled(package_base);
   PkgMap              installmap(basemap);
 
+  result.findings_.clear();
   install_recursive(pulled, installmap, pkg,
-                    pkgmap, providemap, replacemap, true, config_.quiet_);
-  (void)objmap;
+                    pkgmap, providemap, replacemap, &result.findings_);
+
+  if (state) {
+    // every package walked resolved its dependencies by name, the package
+    // itself is not walked if a base package provides it
+    result.fingerprint_ = state->base_;
+    result.inputs_.clear();
+    result.inputs_.push_back(pkg->name_);
+    for (size_t i = package_base.size(); i != pulled.size(); ++i) {
+      const Package *p = pulled[i];
+      result.inputs_.push_back(p->name_);
+      for (auto &dep : p->depends_)
+        result.inputs_.push_back(std::get<0>(dep));
+      for (auto &dep : p->optdepends_)
+        result.inputs_.push_back(std::get<0>(dep));
+    }
+    for (auto &obj : pkg->objects_) {
+      for (auto &need : obj->needed_)
+        result.inputs_.push_back(need);
+    }
+    std::sort(result.inputs_.begin(), result.inputs_.end());
+    result.inputs_.erase(std::unique(result.inputs_.begin(),
+                                     result.inputs_.end()),
+                         result.inputs_.end());
+  }
 
   StringSet needed;
   for (auto &obj : pkg->objects_) {
@@ -1230,27 +2455,37 @@ void DB::CheckIntegrity(const Package             *pkg,
         }
       }
       if (!found) {
-        if (config_.verbosity_ > 0)
-          printf("%s%s: %s not pulled in for %s/%s\n",
-                 (config_.quiet_ ? "" : "\r"),
-                 pkg->name_.c_str(),
-                 need.c_str(),
-                 obj->dirname_.c_str(), obj->basename_.c_str());
+        add_finding(&result.findings_, 1, "%s: %s not pulled in for %s/%s\n",
+                    pkg->name_.c_str(),
+                    need.c_str(),
+                    obj->dirname_.c_str(), obj->basename_.c_str());
         needed.insert(need);
       }
     }
   }
   for (auto &n : needed) {
-    printf("%s%s: doesn't pull in %s\n",
-           (config_.quiet_ ? "" : "\r"),
-           pkg->name_.c_str(),
-           n.c_str());
+    add_finding(&result.findings_, 0, "%s: doesn't pull in %s\n",
+                pkg->name_.c_str(),
+                n.c_str());
+  }
+  return false;
+}
+
+static void show_findings(const IntegrityResult &result,
+                          const Config          &config)
+{
+  for (auto &f : result.findings_) {
+    if (std::get<0>(f) > config.verbosity_)
+      continue;
+    printf("%s%s", (config.quiet_ ? "" : "\r"), std::get<1>(f).c_str());
   }
 }
 
-void DB::CheckIntegrity(const FilterList    &pkg_filters,
-                        const ObjFilterList &obj_filters) const
+bool DB::CheckIntegrity(const FilterList    &pkg_filters,
+                        const ObjFilterList &obj_filters,
+                        bool                 update_cache)
 {
+  stats::Timer timer(config_, stats::Integrity);
   config_.Log(Message, "Looking for stale object files...\n");
   for (auto &o : objects_) {
     if (!o->owner_) {
@@ -1299,6 +2534,45 @@ void DB::CheckIntegrity(const FilterList    &pkg_filters,
     }
   }
 
+  // Object filters change what a check reports, so results are only
+  // cached and reused for unfiltered runs. A cached result stays valid
+  // until one of the names it depends on belongs to a package which was
+  // added, removed or changed since the last run checking all packages.
+  IntegrityState        statedata;
+  const IntegrityState *state = nullptr;
+  vec<uint64_t>         digests;
+  if (obj_filters.empty()) {
+    Fingerprint fp;
+    for (auto &p : base)
+      fp.Add(package_digest(p));
+    statedata.base_ = fp.value_;
+    digests.reserve(packages_.size());
+    StringList names;
+    for (auto &p : packages_) {
+      digests.push_back(package_digest(p));
+      auto cached = integrity_cache_.find(p->name_);
+      if (cached != integrity_cache_.end() &&
+          cached->second.digest_ == digests.back())
+      {
+        continue;
+      }
+      package_names(p, names);
+      statedata.changed_.insert(names.begin(), names.end());
+      if (cached != integrity_cache_.end())
+        statedata.changed_.insert(cached->second.names_.begin(),
+                                  cached->second.names_.end());
+    }
+    for (auto &cached : integrity_cache_) {
+      if (pkgmap.find(cached.first) == pkgmap.end())
+        statedata.changed_.insert(cached.second.names_.begin(),
+                                  cached.second.names_.end());
+    }
+    state = &statedata;
+  }
+  // per package: 0 = filtered out, 1 = cached result reused, 2 = checked
+  vec<uint8_t>         outcome(state ? packages_.size() : 0, 0);
+  vec<IntegrityResult> results(state ? packages_.size() : 0);
+
   // print some stats
   config_.Log(Message,
       "packages: %lu, provides: %lu, replacements: %lu, objects: %lu\n",
@@ -1326,6 +2600,20 @@ void DB::CheckIntegrity(const FilterList    &pkg_filters,
       printf("\n");
   };
 
+  auto check = [this,&pkgmap,&providemap,&replacemap,
+                &basemap,&objmap,&base,&obj_filters,state,&outcome,&results]
+  (size_t i) {
+    stats::Span      span(config_, "integrity", packages_[i]->name_);
+    IntegrityResult  local;
+    IntegrityResult &result = state ? results[i] : local;
+    bool cached = CheckIntegrity(packages_[i], pkgmap, providemap,
+                                 replacemap, basemap, objmap, base,
+                                 obj_filters, state, result);
+    if (state)
+      outcome[i] = cached ? 1 : 2;
+    show_findings(result, config_);
+  };
+
   config_.Log(Message, "Checking package dependencies...\n");
 #ifdef PKGDEPDB_ENABLE_THREADS
   if (config_.max_jobs_ == 1) {
@@ -1334,8 +2622,7 @@ void DB::CheckIntegrity(const FilterList    &pkg_filters,
     for (size_t i = 0; i != packages_.size(); ++i) {
       if (!util::all(pkg_filters, *this, *packages_[i]))
         continue;
-      CheckIntegrity(packages_[i], pkgmap, providemap, replacemap,
-                      basemap, objmap, base, obj_filters);
+      check(i);
       if (!config_.quiet_)
         status(i, packages_.size(), 1);
     }
@@ -1344,18 +2631,13 @@ void DB::CheckIntegrity(const FilterList    &pkg_filters,
     auto merger = [](vec<int> &&n) {
       (void)n;
     };
-    auto worker =
-      [this,&pkgmap,&providemap,&replacemap,
-       &objmap,&base,&basemap,&obj_filters,&pkg_filters]
+    auto worker = [this,&pkg_filters,&check]
     (std::atomic_ulong *count, size_t from, size_t to, int &dummy) {
       (void)dummy;
 
       for (size_t i = from; i != to; ++i) {
-        const Package *pkg = packages_[i];
-        if (util::all(pkg_filters, *this, *pkg)) {
-          CheckIntegrity(pkg, pkgmap, providemap, replacemap,
-                          basemap, objmap, base, obj_filters);
-        }
+        if (util::all(pkg_filters, *this, *packages_[i]))
+          check(i);
         if (count)
           ++*count;
       }
@@ -1364,6 +2646,48 @@ void DB::CheckIntegrity(const FilterList    &pkg_filters,
   }
 #endif
 
+  bool cache_changed = false;
+  if (state && update_cache) {
+    for (size_t i = 0; i != packages_.size(); ++i) {
+      if (outcome[i] != 2)
+        continue;
+      IntegrityResult &entry = integrity_cache_[packages_[i]->name_];
+      IntegrityResult &result = results[i];
+      if (entry.fingerprint_ == result.fingerprint_ &&
+          entry.inputs_      == result.inputs_      &&
+          entry.findings_    == result.findings_)
+      {
+        continue;
+      }
+      entry.fingerprint_ = result.fingerprint_;
+      entry.inputs_      = move(result.inputs_);
+      entry.findings_    = move(result.findings_);
+      cache_changed = true;
+    }
+    // Only a run which checked every package may move on to the current
+    // state of the packages, otherwise the changes would go unnoticed for
+    // the packages it skipped.
+    if (pkg_filters.empty()) {
+      for (auto it = integrity_cache_.begin(); it != integrity_cache_.end(); )
+      {
+        if (pkgmap.find(it->first) == pkgmap.end()) {
+          it = integrity_cache_.erase(it);
+          cache_changed = true;
+        }
+        else
+          ++it;
+      }
+      for (size_t i = 0; i != packages_.size(); ++i) {
+        IntegrityResult &entry = integrity_cache_[packages_[i]->name_];
+        if (entry.digest_ == digests[i])
+          continue;
+        entry.digest_ = digests[i];
+        package_names(packages_[i], entry.names_);
+        cache_changed = true;
+      }
+    }
+  }
+
   config_.Log(Message, "Checking for file conflicts...\n");
   std::map<strref,vec<const Package*>> file_counter;
   for (auto &pkg : packages_) {
@@ -1401,6 +2725,7 @@ void DB::CheckIntegrity(const FilterList    &pkg_filters,
       }
     }
   }
+  return cache_changed;
 }
 
 } // ::pkgdepdb
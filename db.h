@@ -3,6 +3,173 @@
 
 namespace pkgdepdb {
 
+// The outcome of checking a single package's integrity. Stored in the
+// database so that a later --integrity run only has to re-verify packages
+// which depend on something that changed since.
+struct IntegrityResult {
+  // fingerprint of the base packages the check was done with
+  uint64_t                   fingerprint_ = 0;
+  // the package's digest and the names it answered to (its own, provides,
+  // replaces and object basenames) as of the last run checking all packages
+  uint64_t                   digest_ = 0;
+  StringList                 names_;
+  // the names the outcome depends on: the pulled in packages, the
+  // dependencies looked up and the libraries the package needs
+  StringList                 inputs_;
+  // (required verbosity, message) in the order they were reported
+  vec<tuple<uint8_t,string>> findings_;
+};
+using IntegrityCache = std::map<string, IntegrityResult>;
+
+// What cached integrity results are validated against during a check.
+struct IntegrityState {
+  uint64_t  base_ = 0;
+  // names whose packages or objects changed since the last full check
+  StringSet changed_;
+};
+
+// The heap memory held by a database by category, see DB::Memory. Bytes
+// are the sizes requested from the allocator, node sizes of the standard
+// containers are estimated.
+struct MemoryReport {
+  // NOTE: Keep in sync with pkgdepdb.h's PKGDEPDB_MEMORY_CATEGORY
+  enum Category {
+    Packages,  // package records, their names and object lists
+    Depends,   // dependency, provides, conflicts and replaces lists
+    Groups,
+    Filelists,
+    Info,      // the PKGINFO entries not stored elsewhere
+    Objects,   // object records, their paths and needed lists
+    Links,     // the found libraries of objects
+    Missing,   // the missing libraries of objects
+    Rules,     // library paths and rules
+    Integrity, // the integrity check cache
+    Tables,    // the package and object lists and the package index
+    Indexes,   // link cache, file index and reverse index
+    CategoryCount
+  };
+
+  size_t bytes_      [CategoryCount] = {};
+  size_t allocations_[CategoryCount] = {};
+
+  static const char* Name(Category);
+};
+
+// Memoized library lookups. Objects sharing their ABI, rpath, runpath and
+// package library path (their link context) resolve a name to the same
+// object, so each (context, name) pair only needs to be looked up once.
+class LinkCache {
+ public:
+  uint32_t Context(const Elf*, const StringList *extrapath);
+  bool     Find   (uint32_t ctx, const string& name, Elf **found) const;
+  void     Insert (uint32_t ctx, const string& name, Elf *found);
+  // drop every result for a name, to be used when objects of that name
+  // are added or removed
+  void     Forget (const string& name);
+  void     Clear  ();
+  void     Memory (MemoryReport&) const;
+
+ private:
+  static const size_t kShards = 16;
+  struct Shard {
+    std::unordered_map<string, std::unordered_map<uint32_t, Elf*>> names_;
+#ifdef PKGDEPDB_ENABLE_THREADS
+    std::mutex mutex_;
+#endif
+  };
+
+  Shard& ShardFor(const string& name) const;
+
+  std::unordered_map<string, uint32_t> contexts_;
+#ifdef PKGDEPDB_ENABLE_THREADS
+  std::mutex                           contexts_mutex_;
+#endif
+  mutable Shard                        shards_[kShards];
+};
+
+// The packages shipping each file of the installed packages' filelists,
+// sorted by the paths' hashes so finding a file's owners is a binary
+// search. A single lookup is cheaper as a scan, so the index is only built
+// once a second lookup happens. To be reset when packages are added,
+// removed or lose their filelists.
+class FileIndex {
+ public:
+  // calls fn for each package containing path
+  void Find (const PackageList&, const string& path,
+             const function<void(const Package*)> &fn) const;
+  // build the index right away, eg. before forking off queries
+  void Build(const PackageList&) const;
+  void Reset();
+  void Memory(MemoryReport&) const;
+
+ private:
+  void Build_i(const PackageList&) const;
+
+  // The file is referenced by its position so that changes to an
+  // installed package's file list cannot leave a dangling pointer behind.
+  struct Entry {
+    size_t         hash_;
+    const Package *pkg_;
+    size_t         index_;
+  };
+  mutable vec<Entry>  entries_;
+  mutable bool        built_ = false;
+  mutable bool        used_  = false;
+#ifdef PKGDEPDB_ENABLE_THREADS
+  mutable std::mutex  mutex_;
+#endif
+};
+
+// The reverse edges of the links and package dependencies: the objects
+// linking to each object or missing a library name, the packages depending
+// on a name and the packages named or providing it, and the objects by file
+// name to look for replacements. Built on first use, to be reset when links
+// or the package list change, so with a resident database (--serve) impact
+// queries only touch the affected part of it.
+class ReverseIndex {
+ public:
+  void Build(const PackageList&, const ObjectList&) const;
+  void Reset();
+  void Memory(MemoryReport&) const;
+
+  // only valid after Build()
+  const vec<const Elf*>&     Users    (const Elf*) const;
+  const vec<const Elf*>&     Missing  (const string& name) const;
+  const vec<const Package*>& Dependers(const string& name) const;
+  const vec<const Package*>& Providers(const string& name) const;
+  const vec<Elf*>&           Named    (const string& basename) const;
+
+ private:
+  mutable std::unordered_map<const Elf*, vec<const Elf*>>  users_;
+  mutable std::unordered_map<string, vec<const Elf*>>      missing_;
+  mutable std::unordered_map<string, vec<const Package*>>  dependers_;
+  mutable std::unordered_map<string, vec<const Package*>>  providers_;
+  mutable std::unordered_map<string, vec<Elf*>>            named_;
+  mutable bool        built_ = false;
+#ifdef PKGDEPDB_ENABLE_THREADS
+  mutable std::mutex  mutex_;
+#endif
+};
+
+// What removing packages or objects would break, see DB::Impact.
+struct ImpactResult {
+  // objects left without some of their libraries, and those libraries
+  vec<tuple<const Elf*, StringList>>     objects_;
+  // packages left without some of their dependencies, and those names
+  vec<tuple<const Package*, StringList>> depends_;
+};
+
+// What installing packages would change, see DB::Preview.
+struct PreviewResult {
+  // (new, installed) packages of the same name
+  vec<tuple<const Package*, const Package*>>         replaced_;
+  // objects which would miss libraries they did not miss before, with
+  // their package and all of the libraries they would miss
+  vec<tuple<const Package*, const Elf*, StringList>> broken_;
+  // objects which would no longer miss any library
+  vec<tuple<const Package*, const Elf*>>             fixed_;
+};
+
 struct DB {
   static uint16_t CURRENT;
 
@@ -19,6 +186,7 @@ struct DB {
   std::map<string, StringList> package_library_path_;
   StringSet                    base_packages_;
   StringSet                    assume_found_rules_;
+  IntegrityCache               integrity_cache_;
 
 // non-serialized {
   const Config&                config_;
@@ -29,34 +197,79 @@ struct DB {
   bool contains_groups_;
   bool contains_filelists_;
   bool contains_pkgbase_;
+
+  // objects whose link information is outdated due to rule changes
+  std::set<Elf*>               dirty_objects_;
+  mutable LinkCache            link_cache_;
+  // package name -> position in packages_ as of the last IndexPackages(),
+  // see PackagePos()
+  std::unordered_map<string, size_t> package_index_;
+  // indexed positions removed since then, in ascending order
+  vec<size_t>                  package_gaps_;
+  // Package::renames_ when the index was built
+  unsigned long                package_renames_ = 0;
+  FileIndex                    file_index_;
+  ReverseIndex                 reverse_index_;
+
+  // the database a snapshot shares its packages and objects with, and the
+  // ones the snapshot created or copied and is free to modify
+  const DB                          *base_ = nullptr;
+  std::unordered_set<const Package*> own_packages_;
+  std::unordered_set<const Elf*>     own_objects_;
 // }
 
   DB() = delete;
   DB(const Config&);
   ~DB();
-  DB(bool wiped, const DB& copy);
 
+  // A copy of the database which shares the packages and objects with this
+  // one until it modifies them, to try out changes without copying
+  // everything. This database must outlive the snapshot and must not be
+  // modified while it exists, then multiple snapshots of it can be used in
+  // parallel. Packages and objects taken from a snapshot may be shared
+  // and must not be modified directly.
+  DB* Snapshot() const;
 
   bool InstallPackage(Package* &&pkg);
   bool DeletePackage (const string& name, bool destroy = true);
   bool DeletePackage (PackageList::const_iterator, bool destroy = true);
+  // returns the number of packages which were removed
+  size_t DeletePackages(const StringList& names, bool destroy = true);
   Elf *FindFor       (const Elf*, const string& lib,
                       const StringList *extrapath) const;
+  Elf *FindFor       (const Elf*, const string& lib,
+                      const StringList *extrapath,
+                      const vec<Elf*> &candidates) const;
   void LinkObject    (Elf*, const Package *owner,
                       ObjectSet &req_found,
-                      StringSet &req_missing) const;
-  void LinkObject_do (Elf*, const Package *owner);
+                      StringSet &req_missing,
+                      const vec<Elf*> *candidates = nullptr) const;
+  void LinkObject_do (Elf*, const Package *owner,
+                      const vec<Elf*> *candidates = nullptr);
   void RelinkAll     ();
+  bool RelinkDirty   ();
   void FixPaths      ();
   bool WipePackages  ();
   bool WipeFilelists ();
 
+  // An object to relink along with the objects of its ABI bucket.
+  using LinkJob = tuple<Elf*, const Package*, const vec<Elf*>*>;
 #ifdef PKGDEPDB_ENABLE_THREADS
-  void RelinkAll_Threaded();
+  void RelinkAll_Threaded(const vec<LinkJob>&);
 #endif
 
   Package*                    FindPkg   (const string& name) const;
   PackageList::const_iterator FindPkg_i (const string& name) const;
+  PackageList::const_iterator FindPkg_i (const Package*) const;
+  void                        IndexPackages();
+  size_t                      PackagePos(size_t indexed) const;
+  size_t                      IndexedPos(size_t pos) const;
+  // recount every package's broken objects
+  void                        CountBroken();
+  // the packages whose filelist contains path, which may be absolute
+  vec<const Package*>         FindOwners(const string& path) const;
+  bool                        Owns      (const Package*,
+                                         const string& path) const;
 
   void ShowInfo();
   void ShowInfo_json();
@@ -72,17 +285,48 @@ struct DB {
   void ShowFound_json   ();
   void ShowFilelist     (const FilterList&, const StrFilterList&);
   void ShowFilelist_json(const FilterList&, const StrFilterList&);
+  void ShowOwners       (const StringList& paths, const FilterList&);
+  void ShowOwners_json  (const StringList& paths, const FilterList&);
+
+  // without modifying the database find the objects and packages which
+  // break when the given packages and objects are removed
+  void Impact(const vec<const Package*> &packages,
+              const vec<const Elf*>     &objects,
+              ImpactResult              &result) const;
+  // names are package names or object paths
+  void ShowImpact       (const StringList& names);
+  void ShowImpact_json  (const ImpactResult&);
+
+  // without modifying the database find what installing the packages would
+  // break or fix, only looking at the objects linking to replaced objects
+  // or missing the new objects' names
+  void Preview(const vec<const Package*> &packages,
+               PreviewResult             &result) const;
+  void ShowPreview      (const vec<const Package*> &packages);
+  void ShowPreview_json (const PreviewResult&);
+
+  // Add up the memory held by the database. A snapshot includes the
+  // packages and objects it shares with its base.
+  void Memory(MemoryReport&) const;
+  void ShowMemory       ();
+  void ShowMemory_json  (const MemoryReport&);
 
-  void CheckIntegrity(const FilterList &pkg_filters,
-                      const ObjFilterList &obj_filters) const;
-  void CheckIntegrity(const Package             *pkg,
+  // Cached results are reused when possible, update_cache stores the new
+  // ones. Returns true if the stored integrity cache was updated.
+  bool CheckIntegrity(const FilterList &pkg_filters,
+                      const ObjFilterList &obj_filters,
+                      bool update_cache);
+  // returns true if the result was taken from the cache
+  bool CheckIntegrity(const Package             *pkg,
                       const PkgMap              &pkgmap,
                       const PkgListMap          &providemap,
                       const PkgListMap          &replacemap,
                       const PkgMap              &basemap,
                       const ObjListMap          &objmap,
                       const vec<const Package*> &base,
-                      const ObjFilterList       &obj_filters) const;
+                      const ObjFilterList       &obj_filters,
+                      const IntegrityState      *state,
+                      IntegrityResult           &result) const;
 
   bool Store(const string& filename);
   bool Load (const string& filename);
@@ -92,7 +336,10 @@ struct DB {
   bool LD_Prepend(const string& dir);
   bool LD_Delete (const string& dir);
   bool LD_Delete (size_t i);
+  size_t LD_Delete(size_t i, size_t count);
   bool LD_Insert (const string& dir, size_t i);
+  size_t LD_Insert(const StringSet& dirs, size_t i);
+  bool LD_Set    (size_t i, const string& dir);
   bool LD_Clear  ();
 
   bool IgnoreFile_Add   (const string& name);
@@ -112,11 +359,42 @@ struct DB {
   bool PKG_LD_Delete(const string& pkg, size_t i);
   bool PKG_LD_Clear (const string& pkg);
 
+  bool SetStrictLinking(bool strict);
+
+  // Mark the objects affected by a rule change for relinking.
+  void MarkDirty_Path   (const string& dir);
+  void MarkDirty_Needed (const string& lib);
+  void MarkDirty_File   (const string& path);
+  void MarkDirty_Package(const string& pkg);
+  void MarkDirty_Strict ();
+
   bool IsBroken(const Package *pkg) const;
   bool IsBroken(const Elf *elf) const;
+  vec<const Package*> BrokenPackages() const;
   bool IsEmpty (const Package *elf, const ObjFilterList &filters) const;
 
  private:
+  explicit DB(const DB *base);
+
+  // Snapshots copy shared packages and objects before modifying them, the
+  // slot is the entry in packages_ or objects_ to replace by the copy.
+  Package* Own   (Package* &slot);
+  Elf*     Own   (rptr<Elf> &slot);
+  Elf*     Copy  (const Elf*, Package *owner);
+  void     OwnAll();
+  // only packages a snapshot created can be taken out of it
+  bool     Detachable(const Package*) const;
+
+  void TakePackage   (PackageList::const_iterator);
+  void CompactPackages();
+  void UnlinkPackages(const PackageList& removed, bool destroy);
+  // account for a change of an object's missing libraries
+  void UpdateBroken  (const Elf*, bool was_broken);
+
+  template<typename List>
+  Elf *FindIn(const List&, const Elf*, const string& lib,
+              const StringList *extrapath) const;
+
   bool ElfFinds(const Elf*, const string& lib,
                 const StringList *extrapath) const;
 
@@ -14,11 +14,12 @@
 #include "package.h"
 #include "db.h"
 #include "db_format.h"
+#include "stats.h"
 
 namespace pkgdepdb {
 
 // version
-uint16_t DB::CURRENT = 13;
+uint16_t DB::CURRENT = 14;
 
 // magic header
 static const char
@@ -34,7 +35,8 @@ namespace DBFlags {
     BasePackages  = (1<<2),
     StrictLinking = (1<<3),
     AssumeFound   = (1<<4),
-    FileLists     = (1<<5)
+    FileLists     = (1<<5),
+    Integrity     = (1<<6)
   };
 }
 
@@ -180,6 +182,10 @@ SerialIn::SerialIn(DB *db, SerialStream *in)
 : db_(db), in_(*in), in_owning_(in), ver8_refs_(false)
 { }
 
+SerialIn::~SerialIn() {
+  stats::Count(db_->config_, stats::BytesRead, in_.TellG());
+}
+
 SerialIn* SerialIn::Open(DB *db, const string& file, bool gz) {
   SerialStream*
     in = gz ? (SerialStream*)new SerialGZ  (file, SerialStream::in)
@@ -200,6 +206,10 @@ SerialOut::SerialOut(DB *db, SerialStream *out)
 : db_(db), out_(*out), out_owning_(out)
 { }
 
+SerialOut::~SerialOut() {
+  stats::Count(db_->config_, stats::BytesWritten, out_.TellP());
+}
+
 SerialOut* SerialOut::Open(DB *db, const string& file, bool gz)
 {
   SerialStream*
@@ -218,6 +228,8 @@ SerialOut* SerialOut::Open(DB *db, const string& file, bool gz)
 }
 
 bool SerialOut::GetObjRef(const Elf *e, size_t *out) {
+  // a snapshot's links may still point to the objects it copied
+  e = e->Origin();
   auto exists = objref_.find(e);
   if (exists != objref_.end()) {
     *out = exists->second;
@@ -663,9 +675,13 @@ static bool db_store(DB *db, const string& filename) {
     hdr.flags |= DBFlags::AssumeFound;
   if (db->contains_filelists_)
     hdr.flags |= DBFlags::FileLists;
+  if (db->integrity_cache_.size())
+    hdr.flags |= DBFlags::Integrity;
 
   // Figure out which database format version this will be
-  if (db->contains_pkgbase_)
+  if (hdr.flags & DBFlags::Integrity)
+    hdr.version = 14;
+  else if (db->contains_pkgbase_)
     hdr.version = 13;
   else if (db->contains_check_depends_)
     hdr.version = 12;
@@ -692,18 +708,22 @@ static bool db_store(DB *db, const string& filename) {
   if (hdr.version < 9)
     hdr.version = 9;
 
+  stats::Span span(db->config_, "store");
+
   out.version_ = hdr.version;
   out <= hdr;
   out <= db->name_;
   if (!write_stringlist(out, db->library_path_))
     return false;
 
+  span.Start("packages");
   out <= (uint32_t)db->packages_.size();
   for (auto &pkg : db->packages_) {
     if (!write_pkg(out, pkg, hdr.version, hdr.flags))
       return false;
   }
 
+  span.Start("objects");
   uint32_t cnt_found = 0,
            cnt_missing = 0;
   {
@@ -718,6 +738,7 @@ static bool db_store(DB *db, const string& filename) {
     }
   }
 
+  span.Start("found");
   out <= cnt_found;
   for (Elf *obj : db->objects_) {
     if (obj->req_found_.empty())
@@ -727,6 +748,7 @@ static bool db_store(DB *db, const string& filename) {
     if (!write_objset(out, obj->req_found_))
       return false;
   }
+  span.Start("missing");
   out <= cnt_missing;
   for (Elf *obj : db->objects_) {
     if (obj->req_missing_.empty())
@@ -737,6 +759,7 @@ static bool db_store(DB *db, const string& filename) {
       return false;
   }
 
+  span.Start("rules");
   if (hdr.flags & DBFlags::IgnoreRules) {
     if (!write_stringset(out, db->ignore_file_rules_))
       return false;
@@ -760,6 +783,25 @@ static bool db_store(DB *db, const string& filename) {
       return false;
   }
 
+  if (hdr.flags & DBFlags::Integrity) {
+    span.Start("integrity cache");
+    out <= (uint32_t)db->integrity_cache_.size();
+    for (auto &iter : db->integrity_cache_) {
+      const IntegrityResult &result = iter.second;
+      out <= iter.first
+          <= result.fingerprint_
+          <= result.digest_;
+      if (!write_stringlist(out, result.names_) ||
+          !write_stringlist(out, result.inputs_))
+      {
+        return false;
+      }
+      out <= (uint32_t)result.findings_.size();
+      for (auto &f : result.findings_)
+        out <= std::get<0>(f) <= std::get<1>(f);
+    }
+  }
+
   return out.out_;
 }
 
@@ -807,6 +849,8 @@ static bool db_load(DB *db, const string& filename) {
     db->contains_groups_ = true;
   if (hdr.flags & DBFlags::FileLists)
     db->contains_filelists_ = true;
+  if (hdr.flags & DBFlags::StrictLinking)
+    db->strict_linking_ = true;
   if (hdr.version >= 10)
     db->contains_make_depends_ = true;
   if (hdr.version >= 12)
@@ -814,6 +858,8 @@ static bool db_load(DB *db, const string& filename) {
   if (hdr.version >= 13)
     db->contains_pkgbase_ = true;
 
+  stats::Span span(db->config_, "load");
+
   in >= db->name_;
   if (!read_stringlist(in, db->library_path_)) {
     db->config_.Log(Error, "failed reading library paths\n");
@@ -822,6 +868,7 @@ static bool db_load(DB *db, const string& filename) {
 
   uint32_t len;
 
+  span.Start("packages");
   in >= len;
   db->packages_.resize(len);
   for (uint32_t i = 0; i != len; ++i) {
@@ -830,12 +877,16 @@ static bool db_load(DB *db, const string& filename) {
       return false;
     }
   }
+  db->IndexPackages();
+  db->file_index_.Reset();
 
+  span.Start("objects");
   if (!read_objlist(in, db->objects_, db->config_)) {
     db->config_.Log(Error, "failed reading object list\n");
     return false;
   }
 
+  span.Start("found");
   in >= len;
   rptr<Elf> obj;
   for (uint32_t i = 0; i != len; ++i) {
@@ -847,6 +898,7 @@ static bool db_load(DB *db, const string& filename) {
     }
   }
 
+  span.Start("missing");
   in >= len;
   for (uint32_t i = 0; i != len; ++i) {
     if (!read_obj(in, obj, db->config_) ||
@@ -856,10 +908,12 @@ static bool db_load(DB *db, const string& filename) {
       return false;
     }
   }
+  db->CountBroken();
 
   if (hdr.version < 2)
     return true;
 
+  span.Start("rules");
   if (hdr.flags & DBFlags::IgnoreRules) {
     if (!read_stringset(in, db->ignore_file_rules_))
       return false;
@@ -884,6 +938,32 @@ static bool db_load(DB *db, const string& filename) {
       return false;
   }
 
+  if (hdr.flags & DBFlags::Integrity) {
+    span.Start("integrity cache");
+    in >= len;
+    for (uint32_t i = 0; i != len; ++i) {
+      string name;
+      in >= name;
+      IntegrityResult &result = db->integrity_cache_[name];
+      uint32_t count;
+      in >= result.fingerprint_
+         >= result.digest_;
+      if (!read_stringlist(in, result.names_) ||
+          !read_stringlist(in, result.inputs_))
+      {
+        break;
+      }
+      in >= count;
+      result.findings_.resize(count);
+      for (auto &f : result.findings_)
+        in >= std::get<0>(f) >= std::get<1>(f);
+    }
+    if (!in.in_) {
+      db->config_.Log(Error, "failed reading integrity check cache\n");
+      return false;
+    }
+  }
+
   return true;
 }
 
@@ -891,10 +971,13 @@ static bool db_load(DB *db, const string& filename) {
 // There we go:
 
 bool DB::Store(const string& filename) {
+  stats::Timer timer(config_, stats::Store);
+  RelinkDirty();
   return db_store(this, filename);
 }
 
 bool DB::Load(const string& filename) {
+  stats::Timer timer(config_, stats::Load);
   if (!Empty()) {
     config_.Log(Error, "internal usage error: DB::read on a non-empty db!\n");
     return false;
@@ -41,6 +41,7 @@ class SerialIn {
   SerialIn(DB*, SerialStream*);
 
  public:
+  ~SerialIn();
   static SerialIn* Open(DB *db, const string& file, bool gz);
 };
 
@@ -62,6 +63,7 @@ class SerialOut {
   SerialOut(DB*, SerialStream*);
 
  public:
+  ~SerialOut();
   static SerialOut* Open(DB *db, const string& file, bool gz);
 };
 
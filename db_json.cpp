@@ -1,56 +1,43 @@
+#include <algorithm>
+
 #include <stdio.h>
 
 #include "main.h"
+
+#ifdef PKGDEPDB_ENABLE_THREADS
+#  include <atomic>
+#  include <thread>
+#  include <unistd.h>
+#endif
+
 #include "elf.h"
 #include "package.h"
 #include "db.h"
 #include "filter.h"
+#include "writer.h"
+#include "stats.h"
+#include "thread.h"
 
 namespace pkgdepdb {
 
-static void json_in_quote(FILE *out, const string& str) {
-  for (size_t i = 0; i != str.length(); ++i) {
-    switch (str[i]) {
-      case '"':  fputc('\\', out); fputc('"', out); break;
-      case '\\': fputc('\\', out); fputc('\\', out); break;
-      case '\b': fputc('\\', out); fputc('b', out); break;
-      case '\f': fputc('\\', out); fputc('f', out); break;
-      case '\n': fputc('\\', out); fputc('n', out); break;
-      case '\r': fputc('\\', out); fputc('r', out); break;
-      case '\t': fputc('\\', out); fputc('t', out); break;
-      default:
-        fputc(str[i], out);
-        break;
-    }
-  }
-}
-
-static void json_quote(FILE *out, const string& str) {
-  fprintf(out, "\"");
-  json_in_quote(out, str);
-  fprintf(out, "\"");
+static void print_objname(Writer &out, const Elf *obj) {
+  out.Put('"').JSONEscape(obj->dirname_).Put('/').JSONEscape(obj->basename_)
+     .Put('"');
 }
 
-static void print_objname(const Elf *obj) {
-  putchar('"');
-  json_in_quote(stdout, obj->dirname_);
-  putchar('/');
-  json_in_quote(stdout, obj->basename_);
-  putchar('"');
-}
-
-static inline void print_depend_list(const char *what, const DependList& lst) {
+static inline void print_depend_list(Writer &out, const char *what,
+                                     const DependList& lst)
+{
   if (lst.empty())
     return;
-  printf(",\n\t\t\t\"%s\": [", what);
+  out.Put(",\n\t\t\t\"").Put(what).Put("\": [");
   const char *sep = "\n\t\t\t\t";
   for (auto &dep : lst) {
-    printf("%s", sep); sep = ",\n\t\t\t\t";
-    string full = std::get<0>(dep);
-    full.append(std::get<1>(dep));
-    json_quote(stdout, full);
+    out.Put(sep); sep = ",\n\t\t\t\t";
+    out.Put('"').JSONEscape(std::get<0>(dep)).JSONEscape(std::get<1>(dep))
+       .Put('"');
   }
-  printf("\n\t\t\t]");
+  out.Put("\n\t\t\t]");
 }
 
 void DB::ShowPackages_json(bool                filter_broken,
@@ -58,365 +45,463 @@ void DB::ShowPackages_json(bool                filter_broken,
                            const FilterList   &pkg_filters,
                            const ObjFilterList &obj_filters)
 {
-  printf("{");
+  Writer out(stdout);
+  out.Put("{");
   if (filter_broken)
-    printf("\n\t\"filters\": [ \"broken\" ],");
+    out.Put("\n\t\"filters\": [ \"broken\" ],");
   else
-    printf("\n\t\"filters\": [],");
+    out.Put("\n\t\"filters\": [],");
 
   if (packages_.empty()) {
-    printf("\n\t\"packages\": []\n}\n");
+    out.Put("\n\t\"packages\": []\n}\n");
     return;
   }
 
-  printf("\n\t\"packages\": [");
+  out.Put("\n\t\"packages\": [");
 
-  const char *mainsep = "\n\t\t";
-  for (auto &pkg : packages_) {
-    if (!util::all(pkg_filters, *this, *pkg))
-      continue;
-    if (filter_broken && !IsBroken(pkg))
-      continue;
-    if (filter_notempty && IsEmpty(pkg, obj_filters))
-      continue;
-    printf("%s{", mainsep); mainsep = ",\n\t\t";
-    printf("\n\t\t\t\"name\": ");
-    json_quote(stdout, pkg->name_);
-    printf(",\n\t\t\t\"version\": ");
-    json_quote(stdout, pkg->version_);
-    if (config_.verbosity_ >= 1) {
-      if (!pkg->pkgbase_.empty()) {
-        printf(",\n\t\t\t\"pkgbase\": ");
-        json_quote(stdout, pkg->pkgbase_);
-      }
-      if (!pkg->groups_.empty()) {
-        printf(",\n\t\t\t\"groups\": [");
-        const char *sep = "\n\t\t\t\t";
-        for (auto &grp : pkg->groups_) {
-          printf("%s", sep); sep = ",\n\t\t\t\t";
-          json_quote(stdout, grp);
-        }
-        printf("\n\t\t\t]");
-      }
-      print_depend_list("depends", pkg->depends_);
-      print_depend_list("optdepends", pkg->optdepends_);
-      print_depend_list("makedepends", pkg->makedepends_);
-      print_depend_list("checkdepends", pkg->checkdepends_);
-      print_depend_list("provides", pkg->provides_);
-      print_depend_list("replaces", pkg->replaces_);
-      print_depend_list("conflicts", pkg->conflicts_);
-      if (filter_broken) {
-        printf(",\n\t\t\t\"broken\": [");
-        const char *sep = "\n\t\t\t\t";
-        for (auto &obj : pkg->objects_) {
-          if (!util::all(obj_filters, *this, *obj))
-            continue;
-          if (!IsBroken(obj))
-            continue;
-          if (config_.verbosity_ >= 2) {
-            printf("%s{", sep); sep = ",\n\t\t\t\t";
-            printf("\n\t\t\t\t\t\"object\": ");
-            print_objname(obj);
-            auto& list = obj->req_missing_;
-            if (!list.empty()) {
-              printf(",\n\t\t\t\t\t\"misses\": [");
-              const char *missep = "\n\t\t\t\t\t\t";
-              for (auto &missing : list) {
-                printf("%s", missep);
-                missep = ",\n\t\t\t\t\t\t";
-                json_quote(stdout, missing);
-              }
-              printf("\n\t\t\t\t\t]");
-            }
-            printf("\n\t\t\t\t}");
-          } else {
-            printf("%s", sep); sep = ",\n\t\t\t\t";
-            print_objname(obj);
+  auto format = [&](Writer &out, size_t from, size_t to, bool first) {
+    const char *mainsep = first ? "\n\t\t" : ",\n\t\t";
+    for (size_t i = from; i != to; ++i) {
+      const Package *pkg = packages_[i];
+      if (!util::all(pkg_filters, *this, *pkg))
+        continue;
+      if (filter_broken && !IsBroken(pkg))
+        continue;
+      if (filter_notempty && IsEmpty(pkg, obj_filters))
+        continue;
+      out.Put(mainsep).Put('{'); mainsep = ",\n\t\t";
+      out.Put("\n\t\t\t\"name\": ").JSONQuote(pkg->name_);
+      out.Put(",\n\t\t\t\"version\": ").JSONQuote(pkg->version_);
+      if (config_.verbosity_ >= 1) {
+        if (!pkg->pkgbase_.empty())
+          out.Put(",\n\t\t\t\"pkgbase\": ").JSONQuote(pkg->pkgbase_);
+        if (!pkg->groups_.empty()) {
+          out.Put(",\n\t\t\t\"groups\": [");
+          const char *sep = "\n\t\t\t\t";
+          for (auto &grp : pkg->groups_) {
+            out.Put(sep).JSONQuote(grp); sep = ",\n\t\t\t\t";
           }
+          out.Put("\n\t\t\t]");
         }
-        printf("\n\t\t\t]");
-      }
-      else {
-        if (pkg->objects_.empty())
-          printf(",\n\t\t\t\"contains\": []");
-        else {
-          printf(",\n\t\t\t\"contains\": [");
+        print_depend_list(out, "depends", pkg->depends_);
+        print_depend_list(out, "optdepends", pkg->optdepends_);
+        print_depend_list(out, "makedepends", pkg->makedepends_);
+        print_depend_list(out, "checkdepends", pkg->checkdepends_);
+        print_depend_list(out, "provides", pkg->provides_);
+        print_depend_list(out, "replaces", pkg->replaces_);
+        print_depend_list(out, "conflicts", pkg->conflicts_);
+        if (filter_broken) {
+          out.Put(",\n\t\t\t\"broken\": [");
           const char *sep = "\n\t\t\t\t";
           for (auto &obj : pkg->objects_) {
             if (!util::all(obj_filters, *this, *obj))
               continue;
-            printf("%s", sep); sep = ",\n\t\t\t\t";
-            print_objname(obj);
+            if (!IsBroken(obj))
+              continue;
+            if (config_.verbosity_ >= 2) {
+              out.Put(sep).Put('{'); sep = ",\n\t\t\t\t";
+              out.Put("\n\t\t\t\t\t\"object\": ");
+              print_objname(out, obj);
+              auto& list = obj->req_missing_;
+              if (!list.empty()) {
+                out.Put(",\n\t\t\t\t\t\"misses\": [");
+                const char *missep = "\n\t\t\t\t\t\t";
+                for (auto &missing : list) {
+                  out.Put(missep).JSONQuote(missing);
+                  missep = ",\n\t\t\t\t\t\t";
+                }
+                out.Put("\n\t\t\t\t\t]");
+              }
+              out.Put("\n\t\t\t\t}");
+            } else {
+              out.Put(sep); sep = ",\n\t\t\t\t";
+              print_objname(out, obj);
+            }
+          }
+          out.Put("\n\t\t\t]");
+        }
+        else {
+          if (pkg->objects_.empty())
+            out.Put(",\n\t\t\t\"contains\": []");
+          else {
+            out.Put(",\n\t\t\t\"contains\": [");
+            const char *sep = "\n\t\t\t\t";
+            for (auto &obj : pkg->objects_) {
+              if (!util::all(obj_filters, *this, *obj))
+                continue;
+              out.Put(sep); sep = ",\n\t\t\t\t";
+              print_objname(out, obj);
+            }
+            out.Put("\n\t\t\t]");
           }
-          printf("\n\t\t\t]");
         }
       }
+      out.Put("\n\t\t}");
     }
-    printf("\n\t\t}");
-  }
+  };
+  thread::ordered_output(out, packages_.size(), 1, format, config_);
 
-  printf("\n\t]\n}\n");
+  out.Put("\n\t]\n}\n");
+}
+
+// a list of strings with an index comment behind each entry
+template<class STRLIST>
+static void json_indexed(Writer &out, const STRLIST &list) {
+  unsigned long id = 0;
+  for (auto &p : list) {
+    out.Put("\n\t\t").JSONQuote(p);
+    out.Put(id+1 == list.size() ? " // " : ", // ").Unsigned(id);
+    ++id;
+  }
 }
 
 void DB::ShowInfo_json() {
-  printf("{");
-  printf( "\n\t\"db_version\": %u", (unsigned)loaded_version_);
-  printf(",\n\t\"db_name\": "); json_quote(stdout, name_);
-  printf(",\n\t\"strict\": %s", (strict_linking_ ? "true" : "false"));
-  printf(",\n\t\"library_path\": [");
+  Writer out(stdout);
+  out.Put("{");
+  out.Put("\n\t\"db_version\": ").Unsigned(loaded_version_);
+  out.Put(",\n\t\"db_name\": ").JSONQuote(name_);
+  out.Put(",\n\t\"strict\": ").Put(strict_linking_ ? "true" : "false");
+  out.Put(",\n\t\"library_path\": [");
   if (library_path_.empty()) {
-    printf("]\n}\n");
+    out.Put("]\n}\n");
     return;
   }
   size_t i = 0;
   while (i != library_path_.size()) {
-    printf("\n\t\t");
-    json_quote(stdout, library_path_[i]);
+    out.Put("\n\t\t").JSONQuote(library_path_[i]);
     if (++i != library_path_.size()) {
-      printf(" // %u", (unsigned)i);
+      out.Put(" // ").Unsigned(i);
       break;
     }
-    printf(", // %u", (unsigned)(i-1));
+    out.Put(", // ").Unsigned(i-1);
   }
-  printf("\n\t]");
+  out.Put("\n\t]");
 
-  unsigned id;
   if (!ignore_file_rules_.empty()) {
-    printf(",\n\t\"ignore_files\": [");
-    id = 0;
-    for (auto &p : ignore_file_rules_) {
-      printf("\n\t\t");
-      json_quote(stdout, p);
-      if (id+1 == ignore_file_rules_.size())
-        printf(" // %u", id++);
-      else
-        printf(", // %u", id++);
-    }
-    printf("\n\t]");
+    out.Put(",\n\t\"ignore_files\": [");
+    json_indexed(out, ignore_file_rules_);
+    out.Put("\n\t]");
   }
   if (!assume_found_rules_.empty()) {
-    printf(",\n\t\"assume_found\": [");
-    id = 0;
-    for (auto &p : assume_found_rules_) {
-      printf("\n\t\t");
-      json_quote(stdout, p);
-      if (id+1 == assume_found_rules_.size())
-        printf(" // %u", id++);
-      else
-        printf(", // %u", id++);
-    }
-    printf("\n\t]");
+    out.Put(",\n\t\"assume_found\": [");
+    json_indexed(out, assume_found_rules_);
+    out.Put("\n\t]");
   }
   const char *sep;
   if (!package_library_path_.empty()) {
-    printf(",\n\t\"package_libray_paths\": {");
+    out.Put(",\n\t\"package_libray_paths\": {");
     sep = "\n\t\t";
     for (auto &iter : package_library_path_) {
-      printf("%s", sep); sep = ",\n\t\t";
-      json_quote(stdout, iter.first);
-      printf(": [");
+      out.Put(sep).JSONQuote(iter.first).Put(": ["); sep = ",\n\t\t";
       const char *psep = "\n\t\t\t";
       for (auto &path : iter.second) {
-        printf("%s", psep); psep = ",\n\t\t\t";
-        json_quote(stdout, path);
+        out.Put(psep).JSONQuote(path); psep = ",\n\t\t\t";
       }
-      printf("\n\t\t]");
+      out.Put("\n\t\t]");
     }
-    printf("\n\t}");
+    out.Put("\n\t}");
   }
   if (!base_packages_.empty()) {
-    printf(",\n\t\"base_packages\": [");
-    id = 0;
-    for (auto &p : base_packages_) {
-      printf("\n\t\t");
-      json_quote(stdout, p);
-      if (id+1 == base_packages_.size())
-        printf(" // %u", id++);
-      else
-        printf(", // %u", id++);
-    }
-    printf("\n\t]");
+    out.Put(",\n\t\"base_packages\": [");
+    json_indexed(out, base_packages_);
+    out.Put("\n\t]");
   }
 
-  printf("\n}\n");
+  out.Put("\n}\n");
 }
 
 void DB::ShowObjects_json(const FilterList    &pkg_filters,
                           const ObjFilterList &obj_filters)
 {
+  Writer out(stdout);
   if (objects_.empty()) {
-    printf("{ \"objects\": [] }\n");
+    out.Put("{ \"objects\": [] }\n");
     return;
   }
 
-  printf("{ \"objects\": [");
-  const char *mainsep = "\n\t";
-  for (auto &obj : objects_) {
-    if (!util::all(obj_filters, *this, *obj))
-      continue;
-    if (!pkg_filters.empty() &&
-        (!obj->owner_ || !util::all(pkg_filters, *this, *obj->owner_)))
-      continue;
-    printf("%s{\n\t\t\"file\":  ", mainsep); mainsep = ",\n\t";
-    print_objname(obj);
-    if (config_.verbosity_ < 1) {
-      printf("\n\t}");
-      continue;
-    }
-    do {
-      printf("\n\t\t\"class\": %u, // %s"
-             "\n\t\t\"data\":  %u, // %s"
-             "\n\t\t\"osabi\": %u, // %s",
-             (unsigned)obj->ei_class_, obj->classString(),
-             (unsigned)obj->ei_data_,  obj->dataString(),
-             (unsigned)obj->ei_osabi_, obj->osabiString());
-      if (obj->rpath_set_) {
-        printf(",\n\t\t\"rpath\": ");
-        json_quote(stdout, obj->rpath_);
-      }
-      if (obj->runpath_set_) {
-        printf(",\n\t\t\"runpath\": ");
-        json_quote(stdout, obj->runpath_);
+  out.Put("{ \"objects\": [");
+  auto format = [&](Writer &out, size_t from, size_t to, bool first) {
+    const char *mainsep = first ? "\n\t" : ",\n\t";
+    for (size_t i = from; i != to; ++i) {
+      const Elf *obj = objects_[i];
+      if (!util::all(obj_filters, *this, *obj))
+        continue;
+      if (!pkg_filters.empty() &&
+          (!obj->owner_ || !util::all(pkg_filters, *this, *obj->owner_)))
+        continue;
+      out.Put(mainsep).Put("{\n\t\t\"file\":  "); mainsep = ",\n\t";
+      print_objname(out, obj);
+      if (config_.verbosity_ < 1) {
+        out.Put("\n\t}");
+        continue;
       }
-      printf(",\n\t\t\"interpreter\": ");
-      json_quote(stdout, obj->interpreter_);
+      out.Put("\n\t\t\"class\": ").Unsigned(obj->ei_class_)
+         .Put(", // ").Put(obj->classString())
+         .Put("\n\t\t\"data\":  ").Unsigned(obj->ei_data_)
+         .Put(", // ").Put(obj->dataString())
+         .Put("\n\t\t\"osabi\": ").Unsigned(obj->ei_osabi_)
+         .Put(", // ").Put(obj->osabiString());
+      if (obj->rpath_set_)
+        out.Put(",\n\t\t\"rpath\": ").JSONQuote(obj->rpath_);
+      if (obj->runpath_set_)
+        out.Put(",\n\t\t\"runpath\": ").JSONQuote(obj->runpath_);
+      out.Put(",\n\t\t\"interpreter\": ").JSONQuote(obj->interpreter_);
       if (config_.verbosity_ < 2) {
-        printf("\n\t}");
-        break;
+        out.Put("\n\t}");
+        continue;
       }
-      printf(",\n\t\t\"finds\": ["); {
-        auto &set = obj->req_found_;
+      out.Put(",\n\t\t\"finds\": ["); {
         const char *sep = "\n\t\t\t";
-        for (auto &found : set) {
-          printf("%s", sep); sep = ",\n\t\t\t";
-          print_objname(found);
+        for (auto &found : obj->req_found_) {
+          out.Put(sep); sep = ",\n\t\t\t";
+          print_objname(out, found);
         }
       }
-      printf("\n\t\t],\n\t\t\"misses\": ["); {
-        auto &set = obj->req_missing_;
+      out.Put("\n\t\t],\n\t\t\"misses\": ["); {
         const char *sep = "\n\t\t\t";
-        for (auto &miss : set) {
-          printf("%s", sep); sep = ",\n\t\t\t";
-          json_quote(stdout, miss);
+        for (auto &miss : obj->req_missing_) {
+          out.Put(sep).JSONQuote(miss); sep = ",\n\t\t\t";
         }
       }
-
-      printf("\n\t\t]\n\t}");
-    } while(0);
-  }
-  printf("\n] }\n");
+      out.Put("\n\t\t]\n\t}");
+    }
+  };
+  thread::ordered_output(out, objects_.size(), 1, format, config_);
+  out.Put("\n] }\n");
 }
 
 void DB::ShowFound_json() {
-  printf("{ \"found_objects\": {");
+  Writer out(stdout);
+  out.Put("{ \"found_objects\": {");
   const char *mainsep = "\n\t";
   for (const Elf *obj : objects_) {
     if (obj->req_found_.empty())
       continue;
-    printf("%s", mainsep); mainsep = ",\n\t";
-    print_objname(obj);
-    printf(": [");
+    out.Put(mainsep); mainsep = ",\n\t";
+    print_objname(out, obj);
+    out.Put(": [");
 
     const char *sep = "\n\t\t";
     for (auto &s : obj->req_found_) {
-      printf("%s", sep); sep = ",\n\t\t";
-      json_quote(stdout, s->basename_);
+      out.Put(sep).JSONQuote(s->basename_); sep = ",\n\t\t";
     }
-    printf("\n\t]");
+    out.Put("\n\t]");
   }
-  printf("\n} }\n");
+  out.Put("\n} }\n");
 }
 
 void DB::ShowFilelist_json(const FilterList    &pkg_filters,
                            const StrFilterList &str_filters)
 {
-  printf("{ \"filelist\": [");
+  Writer out(stdout);
+  out.Put("{ \"filelist\": [");
+  auto format = [&](Writer &out, size_t from, size_t to, bool first) {
+    const char *mainsep = first ? "\n\t" : ",\n\t";
+    for (size_t i = from; i != to; ++i) {
+      const Package *pkg = packages_[i];
+      if (!util::all(pkg_filters, *this, *pkg))
+        continue;
+      if (!config_.quiet_) {
+        out.Put(mainsep).JSONQuote(pkg->name_).Put(": [");
+        mainsep = ",\n\t";
+      }
+
+      const char *sep = "\n\t\t";
+      for (auto &file : pkg->filelist_) {
+        if (!util::all(str_filters, file))
+          continue;
+        if (!config_.quiet_) {
+          out.Put(sep).JSONQuote(file); sep = ",\n\t\t";
+        } else {
+          out.Put(mainsep).JSONQuote(file); mainsep = ",\n\t";
+        }
+      }
+      if (!config_.quiet_)
+        out.Put("\n\t]");
+    }
+  };
+  thread::ordered_output(out, packages_.size(), 1, format, config_);
+  out.Put("\n] }\n");
+}
+
+void DB::ShowOwners_json(const StringList &paths,
+                         const FilterList &pkg_filters)
+{
+  Writer out(stdout);
+  out.Put("{ \"owners\": {");
   const char *mainsep = "\n\t";
-  for (auto &pkg : packages_) {
-    if (!util::all(pkg_filters, *this, *pkg))
+  for (auto &path : paths) {
+    out.Put(mainsep).JSONQuote(path).Put(": ["); mainsep = ",\n\t";
+    const char *sep = "";
+    for (auto &pkg : FindOwners(path)) {
+      if (!util::all(pkg_filters, *this, *pkg))
+        continue;
+      out.Put(sep).JSONQuote(pkg->name_); sep = ", ";
+    }
+    out.Put("]");
+  }
+  out.Put("\n} }\n");
+}
+
+void DB::ShowImpact_json(const ImpactResult &result) {
+  Writer out(stdout);
+  out.Put("{ \"impact\": {\n\t\"objects\": [");
+  const char *mainsep = "\n\t\t";
+  for (auto &entry : result.objects_) {
+    const Elf *obj = std::get<0>(entry);
+    out.Put(mainsep); mainsep = ",\n\t\t";
+    out.Put("{ \"object\": ");
+    print_objname(out, obj);
+    if (obj->owner_)
+      out.Put(", \"package\": ").JSONQuote(obj->owner_->name_);
+    out.Put(", \"missing\": [");
+    const char *sep = "";
+    for (auto &lib : std::get<1>(entry)) {
+      out.Put(sep).JSONQuote(lib); sep = ", ";
+    }
+    out.Put("] }");
+  }
+  out.Put("\n\t],\n\t\"packages\": [");
+  mainsep = "\n\t\t";
+  const Package *last = nullptr;
+  for (auto &entry : result.objects_) {
+    const Package *owner = std::get<0>(entry)->owner_;
+    if (!owner || owner == last)
       continue;
-    if (!config_.quiet_) {
-      printf("%s", mainsep); mainsep = ",\n\t";
-      json_quote(stdout, pkg->name_);
-      printf(": [");
+    last = owner;
+    out.Put(mainsep).JSONQuote(owner->name_); mainsep = ",\n\t\t";
+  }
+  out.Put("\n\t],\n\t\"depends\": {");
+  mainsep = "\n\t\t";
+  for (auto &entry : result.depends_) {
+    out.Put(mainsep).JSONQuote(std::get<0>(entry)->name_).Put(": [");
+    mainsep = ",\n\t\t";
+    const char *sep = "";
+    for (auto &dep : std::get<1>(entry)) {
+      out.Put(sep).JSONQuote(dep); sep = ", ";
     }
+    out.Put("]");
+  }
+  out.Put("\n\t}\n} }\n");
+}
 
-    const char *sep = "\n\t\t";
-    for (auto &file : pkg->filelist_) {
-      if (!util::all(str_filters, file))
-        continue;
-      if (!config_.quiet_) {
-        printf("%s", sep); sep = ",\n\t\t";
-        json_quote(stdout, file);
-      } else {
-        printf("%s", mainsep); mainsep = ",\n\t";
-        json_quote(stdout, file);
-      }
+void DB::ShowPreview_json(const PreviewResult &result) {
+  Writer out(stdout);
+  out.Put("{ \"preview\": {\n\t\"replaced\": [");
+  const char *mainsep = "\n\t\t";
+  for (auto &entry : result.replaced_) {
+    const Package *pkg = std::get<0>(entry), *old = std::get<1>(entry);
+    out.Put(mainsep); mainsep = ",\n\t\t";
+    out.Put("{ \"package\": ").JSONQuote(pkg->name_)
+       .Put(", \"old\": ").JSONQuote(old->version_)
+       .Put(", \"new\": ").JSONQuote(pkg->version_).Put(" }");
+  }
+  out.Put("\n\t],\n\t\"broken\": [");
+  mainsep = "\n\t\t";
+  for (auto &entry : result.broken_) {
+    const Package *pkg = std::get<0>(entry);
+    out.Put(mainsep); mainsep = ",\n\t\t";
+    out.Put("{ \"object\": ");
+    print_objname(out, std::get<1>(entry));
+    if (pkg)
+      out.Put(", \"package\": ").JSONQuote(pkg->name_);
+    out.Put(", \"missing\": [");
+    const char *sep = "";
+    for (auto &lib : std::get<2>(entry)) {
+      out.Put(sep).JSONQuote(lib); sep = ", ";
     }
-    if (!config_.quiet_)
-      printf("\n\t]");
+    out.Put("] }");
+  }
+  out.Put("\n\t],\n\t\"fixed\": [");
+  mainsep = "\n\t\t";
+  for (auto &entry : result.fixed_) {
+    const Package *pkg = std::get<0>(entry);
+    out.Put(mainsep); mainsep = ",\n\t\t";
+    out.Put("{ \"object\": ");
+    print_objname(out, std::get<1>(entry));
+    if (pkg)
+      out.Put(", \"package\": ").JSONQuote(pkg->name_);
+    out.Put(" }");
   }
-  printf("\n] }\n");
+  out.Put("\n\t]\n} }\n");
+}
+
+void DB::ShowMemory_json(const MemoryReport &report) {
+  Writer out(stdout);
+  out.Put("{ \"memory\": {");
+  const char *sep = "\n\t";
+  for (size_t i = 0; i != MemoryReport::CategoryCount; ++i) {
+    out.Put(sep); sep = ",\n\t";
+    out.Put('"').Put(MemoryReport::Name(MemoryReport::Category(i)))
+       .Put("\": { \"bytes\": ").Unsigned(report.bytes_[i])
+       .Put(", \"allocations\": ").Unsigned(report.allocations_[i])
+       .Put(" }");
+  }
+  out.Put(",\n\t\"peak_rss_kb\": ").Unsigned(stats::PeakRSS())
+     .Put("\n} }\n");
 }
 
 void DB::ShowMissing_json() {
-  printf("{ \"missing_objects\": {");
+  Writer out(stdout);
+  out.Put("{ \"missing_objects\": {");
   const char *mainsep = "\n\t";
   for (const Elf *obj : objects_) {
     if (obj->req_missing_.empty())
       continue;
-    printf("%s", mainsep); mainsep = ",\n\t";
-    print_objname(obj);
-    printf(": [");
+    out.Put(mainsep); mainsep = ",\n\t";
+    print_objname(out, obj);
+    out.Put(": [");
 
     const char *sep = "\n\t\t";
     for (auto &s : obj->req_missing_) {
-      printf("%s", sep); sep = ",\n\t\t";
-      json_quote(stdout, s);
+      out.Put(sep).JSONQuote(s); sep = ",\n\t\t";
     }
-    printf("\n\t]");
+    out.Put("\n\t]");
   }
-  printf("\n} }\n");
+  out.Put("\n} }\n");
 }
 
-static void json_obj(size_t id, FILE *out, const Elf *obj) {
-  fprintf(out, "\n\t\t{\n"
-               "\t\t\t\"id\": %lu", (unsigned long)id);
-
-  fprintf(out, ",\n\t\t\t\"dirname\": ");
-  json_quote(out, obj->dirname_);
-  fprintf(out, ",\n\t\t\t\"basename\": ");
-  json_quote(out, obj->basename_);
-  fprintf(out, ",\n\t\t\t\"ei_class\": %u", (unsigned)obj->ei_class_);
-  fprintf(out, ",\n\t\t\t\"ei_data\":  %u", (unsigned)obj->ei_data_);
-  fprintf(out, ",\n\t\t\t\"ei_osabi\": %u", (unsigned)obj->ei_osabi_);
-  if (obj->rpath_set_) {
-    fprintf(out, ",\n\t\t\t\"rpath\": ");
-    json_quote(out, obj->rpath_);
-  }
-  if (obj->runpath_set_) {
-    fprintf(out, ",\n\t\t\t\"runpath\": ");
-    json_quote(out, obj->runpath_);
-  }
-  fprintf(out, ",\n\t\t\t\"interpreter\": ");
-  json_quote(out, obj->interpreter_);
+static void json_obj(size_t id, Writer &out, const Elf *obj) {
+  out.Put("\n\t\t{\n"
+          "\t\t\t\"id\": ").Unsigned(id);
+
+  out.Put(",\n\t\t\t\"dirname\": ").JSONQuote(obj->dirname_);
+  out.Put(",\n\t\t\t\"basename\": ").JSONQuote(obj->basename_);
+  out.Put(",\n\t\t\t\"ei_class\": ").Unsigned(obj->ei_class_);
+  out.Put(",\n\t\t\t\"ei_data\":  ").Unsigned(obj->ei_data_);
+  out.Put(",\n\t\t\t\"ei_osabi\": ").Unsigned(obj->ei_osabi_);
+  if (obj->rpath_set_)
+    out.Put(",\n\t\t\t\"rpath\": ").JSONQuote(obj->rpath_);
+  if (obj->runpath_set_)
+    out.Put(",\n\t\t\t\"runpath\": ").JSONQuote(obj->runpath_);
+  out.Put(",\n\t\t\t\"interpreter\": ").JSONQuote(obj->interpreter_);
   if (!obj->needed_.empty()) {
-    fprintf(out, ",\n\t\t\t\"needed\": [");
+    out.Put(",\n\t\t\t\"needed\": [");
     bool comma = false;
     for (auto &need : obj->needed_) {
-      if (comma) fputc(',', out);
+      if (comma) out.Put(',');
       comma = true;
-      fprintf(out, "\n\t\t\t\t");
-      json_quote(out, need);
+      out.Put("\n\t\t\t\t").JSONQuote(need);
     }
-    fprintf(out, "\n\t\t\t]");
+    out.Put("\n\t\t\t]");
   }
 
-  fprintf(out, "\n\t\t}");
+  out.Put("\n\t\t}");
+}
+
+// Objects are identified by their position in the database's object list.
+// The IDs are kept aside rather than in the objects, which may be shared
+// with other databases (see DB::Snapshot).
+using ObjIds = std::unordered_map<const Elf*, size_t>;
+
+static inline size_t obj_id(const ObjIds &ids, const Elf *obj) {
+  return ids.find(obj->Origin())->second;
 }
 
 template<class OBJLIST>
-static void json_objlist(FILE *out, const OBJLIST &list) {
+static void json_objlist(Writer &out, const ObjIds &ids,
+                         const OBJLIST &list)
+{
   if (list.empty())
     return;
   // let's group them...
@@ -425,75 +510,98 @@ static void json_objlist(FILE *out, const OBJLIST &list) {
   auto iter = list.begin();
   for (; i != count; ++i, ++iter) {
     if ((i & 0xF) == 0)
-      fprintf(out, "\n\t\t\t\t");
-    fprintf(out, "%lu, ", (unsigned long)(*iter)->json_.id);
+      out.Put("\n\t\t\t\t");
+    out.Unsigned(obj_id(ids, *iter)).Put(", ");
   }
   if ((i & 0xF) == 0)
-    fprintf(out, "%s\n\t\t\t\t", (i ? "" : ","));
-  fprintf(out, "%lu", (unsigned long)(*iter)->json_.id);
+    out.Put("\n\t\t\t\t");
+  out.Unsigned(obj_id(ids, *iter));
 }
 
 template<class STRLIST>
-static void json_strlist(FILE *out, const STRLIST &list) {
+static void json_strlist(Writer &out, const STRLIST &list) {
   bool comma = false;
   for (auto &i : list) {
-    if (comma) fputc(',', out);
+    if (comma) out.Put(',');
     comma = true;
-    fprintf(out, "\n\t\t\t\t");
-    json_quote(out, i);
+    out.Put("\n\t\t\t\t").JSONQuote(i);
   }
 }
 
-static void json_pkg(FILE *out, const Package *pkg) {
-  fprintf(out, "\n\t\t{");
+static void json_pkg(Writer &out, const ObjIds &ids, const Package *pkg) {
+  out.Put("\n\t\t{");
   const char *sep = "\n";
   if (pkg->name_.size()) {
-    fprintf(out, "%s\t\t\t\"name\": ", sep);
-    json_quote(out, pkg->name_);
+    out.Put(sep).Put("\t\t\t\"name\": ").JSONQuote(pkg->name_);
     sep = ",\n";
   }
   if (pkg->version_.size()) {
-    fprintf(out, "%s\t\t\t\"version\": ", sep);
-    json_quote(out, pkg->version_);
+    out.Put(sep).Put("\t\t\t\"version\": ").JSONQuote(pkg->version_);
     sep = ",\n";
   }
   if (!pkg->objects_.empty()) {
-    fprintf(out, "%s\t\t\t\"objects\": [", sep);
-    json_objlist(out, pkg->objects_);
-    fprintf(out, "\n\t\t\t]");
+    out.Put(sep).Put("\t\t\t\"objects\": [");
+    json_objlist(out, ids, pkg->objects_);
+    out.Put("\n\t\t\t]");
     sep = ",\n";
   }
 
-  fprintf(out, "\n\t\t}");
+  out.Put("\n\t\t}");
 }
 
-#if 0
-static void json_obj_found(FILE *out, const Elf *obj, const ObjectSet &found) {
-  fprintf(out, "\n\t\t{"
-               "\n\t\t\t\"obj\": %lu"
-               "\n\t\t\t\"found\": [",
-          (unsigned long)obj->json_.id);
-  json_objlist(out, found);
-  fprintf(out, "\n\t\t\t]"
-               "\n\t\t}");
+static void json_obj_found(Writer &out, const ObjIds &ids, const Elf *obj) {
+  // the set is ordered by address, list the IDs in order instead
+  vec<const Elf*> found(obj->req_found_.begin(), obj->req_found_.end());
+  std::sort(found.begin(), found.end(),
+    [&ids](const Elf *a, const Elf *b) {
+      return obj_id(ids, a) < obj_id(ids, b);
+    });
+  out.Put("\n\t\t{"
+          "\n\t\t\t\"obj\": ").Unsigned(obj_id(ids, obj));
+  out.Put(",\n\t\t\t\"found\": [");
+  json_objlist(out, ids, found);
+  out.Put("\n\t\t\t]"
+          "\n\t\t}");
 }
 
-static void json_obj_missing(FILE *out, const Elf *obj,
-                             const StringSet &missing)
+static void json_obj_missing(Writer &out, const ObjIds &ids,
+                             const Elf *obj)
 {
-  fprintf(out, "\n\t\t{"
-               "\n\t\t\t\"obj\": %lu"
-               "\n\t\t\t\"missing\": [",
-          (unsigned long)obj->json_.id);
-  json_strlist(out, missing);
-  fprintf(out, "\n\t\t\t]"
-               "\n\t\t}");
+  out.Put("\n\t\t{"
+          "\n\t\t\t\"obj\": ").Unsigned(obj_id(ids, obj));
+  out.Put(",\n\t\t\t\"missing\": [");
+  json_strlist(out, obj->req_missing_);
+  out.Put("\n\t\t\t]"
+          "\n\t\t}");
+}
+
+// Write a section of the export with an entry for each selected item. The
+// entries are formatted on multiple threads for large databases.
+template<class LIST, class Select, class Print>
+static void json_section(Writer &out, const Config &config, const char *sep,
+                         const char *name, const LIST &list,
+                         Select select, Print print)
+{
+  out.Put(sep).Put("\t\"").Put(name).Put("\": [");
+  auto format = [&](Writer &out, size_t from, size_t to, bool first) {
+    for (size_t i = from; i != to; ++i) {
+      if (!select(list[i]))
+        continue;
+      if (!first)
+        out.Put(',');
+      first = false;
+      print(out, list[i]);
+    }
+  };
+  thread::ordered_output(out, list.size(), 1, format, config);
+  out.Put("\n\t]");
 }
-#endif
 
 bool db_store_json(DB *db, const string& filename) {
-  FILE *out = fopen(filename.c_str(), "wb");
-  if (!out) {
+  stats::Timer timer(db->config_, stats::Store);
+  db->RelinkDirty();
+  FILE *file = fopen(filename.c_str(), "wb");
+  if (!file) {
     db->config_.Log(Error,
                     "failed to open file `%s' for reading\n",
                     filename.c_str());
@@ -502,60 +610,41 @@ bool db_store_json(DB *db, const string& filename) {
 
   db->config_.Log(Message, "writing json database file\n");
 
-  guard close_out([out]() { fclose(out); });
+  guard close_file([file]() { fclose(file); });
+  Writer out(file);
 
-  // we put the objects first as they don't directly depend on anything
-  size_t id = 0;
-  fprintf(out, "{\n"
-               "\t\"objects\": [");
-  bool comma = false;
-  for (auto &obj : db->objects_) {
-    if (comma) fputc(',', out);
-    comma = true;
-    obj->json_.id = id;
-    json_obj(id, out, obj);
-    ++id;
-  }
-  fprintf(out, "\n\t],\n"
-               "\t\"packages\": [");
-
-  // packages have a list of objects
-  // above we numbered them with IDs to reuse here now
-  comma = false;
-  for (auto &pkg : db->packages_) {
-    if (comma) fputc(',', out);
-    comma = true;
-    json_pkg(out, pkg);
-  }
-
-  fprintf(out, "\n\t]");
-
-#if 0
-  if (!db->required_found.empty()) {
-    fprintf(out, ",\n\t\"found\": [");
-    comma = false;
-    for (auto &found : db->required_found) {
-      if (comma) fputc(',', out);
-      comma = true;
-      json_obj_found(out, found.first, found.second);
-    }
-    fprintf(out, "\n\t]");
-  }
+  // the IDs are assigned up front so the sections below can be written in
+  // parallel
+  ObjIds ids;
+  ids.reserve(db->objects_.size());
+  for (size_t id = 0; id != db->objects_.size(); ++id)
+    ids[db->objects_[id]->Origin()] = id;
 
+  auto all = [](const void*) { return true; };
 
-  if (!db->required_missing.empty()) {
-    fprintf(out, ",\n\t\"missing\": [");
-    comma = false;
-    for (auto &mis : db->required_missing) {
-      if (comma) fputc(',', out);
-      comma = true;
-      json_obj_missing(out, mis.first, mis.second);
-    }
-    fprintf(out, "\n\t]");
+  // we put the objects first as they don't directly depend on anything
+  out.Put("{");
+  json_section(out, db->config_, "\n", "objects", db->objects_, all,
+    [&ids](Writer &out, const Elf *obj) {
+      json_obj(obj_id(ids, obj), out, obj);
+    });
+  // packages refer to their objects by ID
+  json_section(out, db->config_, ",\n", "packages", db->packages_, all,
+    [&ids](Writer &out, const Package *pkg) { json_pkg(out, ids, pkg); });
+  json_section(out, db->config_, ",\n", "found", db->objects_,
+    [](const Elf *obj) { return !obj->req_found_.empty(); },
+    [&ids](Writer &out, const Elf *obj) { json_obj_found(out, ids, obj); });
+  json_section(out, db->config_, ",\n", "missing", db->objects_,
+    [](const Elf *obj) { return !obj->req_missing_.empty(); },
+    [&ids](Writer &out, const Elf *obj) { json_obj_missing(out, ids, obj); });
+  out.Put("\n}\n");
+
+  if (!out.Flush()) {
+    db->config_.Log(Error, "failed writing to file `%s'\n",
+                    filename.c_str());
+    return false;
   }
-#endif
-
-  fprintf(out, "\n}\n");
+  stats::Count(db->config_, stats::BytesWritten, ftell(file));
   return true;
 }
 
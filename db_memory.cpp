@@ -0,0 +1,229 @@
+#include <stdio.h>
+
+#include "main.h"
+#include "elf.h"
+#include "package.h"
+#include "db.h"
+#include "stats.h"
+
+namespace pkgdepdb {
+
+static const char *category_names[MemoryReport::CategoryCount] = {
+  "packages", "depends", "groups", "filelists", "info", "objects",
+  "links", "missing", "rules", "integrity", "tables", "indexes"
+};
+
+const char* MemoryReport::Name(Category what) {
+  return category_names[what];
+}
+
+namespace {
+
+// Adds up the heap memory reachable from a value into one category. The
+// nodes of the standard containers are estimated as their value plus the
+// links of a typical implementation: a red-black tree node has three
+// pointers and a color, a hash node a next pointer and the cached hash.
+class Accounting {
+ public:
+  Accounting(MemoryReport &report, MemoryReport::Category what)
+  : report_(report), what_(what)
+  {}
+
+  void Block(size_t bytes) {
+    if (!bytes)
+      return;
+    report_.bytes_[what_] += bytes;
+    report_.allocations_[what_]++;
+  }
+
+  // scalars, pointers and references to objects counted elsewhere
+  template<typename T>
+  void Add(const T&) {}
+
+  void Add(const string& str) {
+    // short strings live inside the object
+    const char *obj = reinterpret_cast<const char*>(&str);
+    if (str.data() >= obj && str.data() < obj + sizeof(str))
+      return;
+    Block(str.capacity() + 1);
+  }
+
+  template<typename T>
+  void Add(const vec<T>& list) {
+    Block(list.capacity() * sizeof(T));
+    for (auto &i : list)
+      Add(i);
+  }
+
+  template<typename A, typename B>
+  void Add(const std::pair<A,B>& p) {
+    Add(p.first);
+    Add(p.second);
+  }
+
+  template<typename A, typename B>
+  void Add(const tuple<A,B>& t) {
+    Add(std::get<0>(t));
+    Add(std::get<1>(t));
+  }
+
+  void Add(const IntegrityResult& result) {
+    Add(result.names_);
+    Add(result.inputs_);
+    Add(result.findings_);
+  }
+
+  template<typename K>
+  void Add(const std::set<K>& set) {
+    Tree(set, sizeof(K));
+  }
+
+  template<typename K, typename V>
+  void Add(const std::map<K,V>& map) {
+    Tree(map, sizeof(typename std::map<K,V>::value_type));
+  }
+
+  template<typename K>
+  void Add(const std::unordered_set<K>& set) {
+    Hash(set, sizeof(K));
+  }
+
+  template<typename K, typename V>
+  void Add(const std::unordered_map<K,V>& map) {
+    Hash(map, sizeof(typename std::unordered_map<K,V>::value_type));
+  }
+
+ private:
+  template<typename C>
+  void Tree(const C& container, size_t value) {
+    for (auto &i : container) {
+      Block(4 * sizeof(void*) + value);
+      Add(i);
+    }
+  }
+
+  template<typename C>
+  void Hash(const C& container, size_t value) {
+    if (container.bucket_count() > 1)
+      Block(container.bucket_count() * sizeof(void*));
+    for (auto &i : container) {
+      Block(2 * sizeof(void*) + value);
+      Add(i);
+    }
+  }
+
+  MemoryReport           &report_;
+  MemoryReport::Category  what_;
+};
+
+} // anonymous namespace
+
+void LinkCache::Memory(MemoryReport &report) const {
+  Accounting acc(report, MemoryReport::Indexes);
+  acc.Add(contexts_);
+  for (auto &shard : shards_)
+    acc.Add(shard.names_);
+}
+
+void FileIndex::Memory(MemoryReport &report) const {
+  Accounting acc(report, MemoryReport::Indexes);
+  acc.Add(entries_);
+}
+
+void ReverseIndex::Memory(MemoryReport &report) const {
+  Accounting acc(report, MemoryReport::Indexes);
+  acc.Add(users_);
+  acc.Add(missing_);
+  acc.Add(dependers_);
+  acc.Add(providers_);
+  acc.Add(named_);
+}
+
+void DB::Memory(MemoryReport &report) const {
+  Accounting packages (report, MemoryReport::Packages),
+             depends  (report, MemoryReport::Depends),
+             groups   (report, MemoryReport::Groups),
+             filelists(report, MemoryReport::Filelists),
+             info     (report, MemoryReport::Info),
+             objects  (report, MemoryReport::Objects),
+             links    (report, MemoryReport::Links),
+             missing  (report, MemoryReport::Missing),
+             rules    (report, MemoryReport::Rules),
+             integrity(report, MemoryReport::Integrity),
+             tables   (report, MemoryReport::Tables);
+
+  for (const Package *pkg : packages_) {
+    packages.Block(sizeof(Package));
+    packages.Add(pkg->name_);
+    packages.Add(pkg->version_);
+    packages.Add(pkg->description_);
+    packages.Add(pkg->pkgbase_);
+    packages.Add(pkg->objects_);
+    packages.Add(pkg->load_.symlinks);
+    depends.Add(pkg->depends_);
+    depends.Add(pkg->optdepends_);
+    depends.Add(pkg->makedepends_);
+    depends.Add(pkg->checkdepends_);
+    depends.Add(pkg->provides_);
+    depends.Add(pkg->conflicts_);
+    depends.Add(pkg->replaces_);
+    groups.Add(pkg->groups_);
+    filelists.Add(pkg->filelist_);
+    info.Add(pkg->info_);
+  }
+
+  for (const Elf *obj : objects_) {
+    objects.Block(sizeof(Elf));
+    objects.Add(obj->dirname_);
+    objects.Add(obj->basename_);
+    objects.Add(obj->rpath_);
+    objects.Add(obj->runpath_);
+    objects.Add(obj->interpreter_);
+    objects.Add(obj->needed_);
+    links.Add(obj->req_found_);
+    missing.Add(obj->req_missing_);
+  }
+
+  rules.Add(name_);
+  rules.Add(library_path_);
+  rules.Add(ignore_file_rules_);
+  rules.Add(package_library_path_);
+  rules.Add(base_packages_);
+  rules.Add(assume_found_rules_);
+
+  integrity.Add(integrity_cache_);
+
+  tables.Add(packages_);
+  tables.Add(objects_);
+  tables.Add(dirty_objects_);
+  tables.Add(package_index_);
+  tables.Add(package_gaps_);
+  tables.Add(own_packages_);
+  tables.Add(own_objects_);
+
+  link_cache_.Memory(report);
+  file_index_.Memory(report);
+  reverse_index_.Memory(report);
+}
+
+void DB::ShowMemory() {
+  MemoryReport report;
+  Memory(report);
+  if (config_.json_ & JSONBits::Query)
+    return ShowMemory_json(report);
+
+  unsigned long long bytes = 0, allocations = 0;
+  printf("category          bytes  allocations\n");
+  for (size_t i = 0; i != MemoryReport::CategoryCount; ++i) {
+    printf("%-9s %13llu %12llu\n",
+           MemoryReport::Name(MemoryReport::Category(i)),
+           (unsigned long long)report.bytes_[i],
+           (unsigned long long)report.allocations_[i]);
+    bytes       += report.bytes_[i];
+    allocations += report.allocations_[i];
+  }
+  printf("%-9s %13llu %12llu\n", "total", bytes, allocations);
+  printf("peak memory: %llu kB\n", (unsigned long long)stats::PeakRSS());
+}
+
+} // ::pkgdepdb
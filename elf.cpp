@@ -18,19 +18,21 @@ Elf::Elf()
 {}
 
 Elf::Elf(const Elf& cp)
-: dirname_    (cp.dirname_),
-  basename_   (cp.basename_),
-  ei_class_   (cp.ei_class_),
-  ei_data_    (cp.ei_data_),
-  ei_osabi_   (cp.ei_osabi_),
-  rpath_set_  (cp.rpath_set_),
-  runpath_set_(cp.runpath_set_),
-  rpath_      (cp.rpath_),
-  runpath_    (cp.runpath_),
-  needed_     (cp.needed_),
-  req_found_  (cp.req_found_),
-  req_missing_(cp.req_missing_),
-  owner_      (cp.owner_)
+: dirname_        (cp.dirname_),
+  basename_       (cp.basename_),
+  ei_class_       (cp.ei_class_),
+  ei_data_        (cp.ei_data_),
+  ei_osabi_       (cp.ei_osabi_),
+  rpath_set_      (cp.rpath_set_),
+  runpath_set_    (cp.runpath_set_),
+  interpreter_set_(cp.interpreter_set_),
+  rpath_          (cp.rpath_),
+  runpath_        (cp.runpath_),
+  interpreter_    (cp.interpreter_),
+  needed_         (cp.needed_),
+  req_found_      (cp.req_found_),
+  req_missing_    (cp.req_missing_),
+  owner_          (cp.owner_)
 {}
 
 template<bool BE,
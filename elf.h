@@ -4,7 +4,12 @@
 namespace pkgdepdb {
 
 struct Elf {
+#ifdef PKGDEPDB_ENABLE_THREADS
+  // snapshots of a database share its objects across threads
+  std::atomic<size_t> refcount_{0};
+#else
   size_t refcount_ = 0;
+#endif
 
   // path + name separated
   string dirname_;
@@ -30,12 +35,11 @@ struct Elf {
   ObjectSet req_found_;
   StringSet req_missing_;
 
-  // NOT SERIALIZED:
-  struct {
-    size_t id;
-  } json_;
-
   Package *owner_;
+
+  // NOT SERIALIZED:
+  // the object a database snapshot copied this one from, see DB::Snapshot
+  const Elf *origin_ = nullptr;
 // }
 
 
@@ -47,6 +51,8 @@ struct Elf {
   // utility functions while loading
   void SolvePaths(const string& origin);
   bool CanUse(const Elf &other, bool strict) const;
+  // copies made by snapshots stand for the object they were made from
+  const Elf* Origin() const { return origin_ ? origin_ : this; }
 
   // utility functions for printing stuff
   const char *classString() const;
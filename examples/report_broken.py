@@ -25,9 +25,8 @@ db = pypkgdepdb.DB(cfg)
 try:
     print('loading database: %s' % (cfg.database))
     db.load(cfg.database)
-    for pkg in db.packages:
-        if db.is_broken(pkg):
-            print(pkg.name)
+    for pkg in db.broken_packages():
+        print(pkg.name)
 
 except pypkgdepdb.PKGDepDBException as err:
     print('error: %s' % (str(err)))
@@ -1,10 +1,16 @@
 #include <algorithm>
+#include <bitset>
+#include <unordered_set>
+
+#include <string.h>
 
 #include "main.h"
 
 #ifdef PKGDEPDB_ENABLE_REGEX
 # include <sys/types.h>
 # include <regex.h>
+# include <strings.h>
+# include <ctype.h>
 #endif
 
 #include "elf.h"
@@ -27,25 +33,59 @@ namespace filter {
 Match::Match() {}
 Match::~Match() {}
 
+const string* Match::Text() const {
+  return nullptr;
+}
+
+string Match::Literal() const {
+  return string();
+}
+
 class ExactMatch : public Match {
  public:
   string text_;
   ExactMatch(string&&);
   bool operator()(const string&) const override;
+  unsigned int Cost() const override { return 1; }
+  string Describe() const override { return "=" + text_; }
+  const string* Text() const override { return &text_; }
+  string Literal() const override { return text_; }
 };
 
+// Globs are compiled into a sequence of single-character tokens and stars
+// which are matched iteratively by backtracking to the most recent star.
 class GlobMatch : public Match {
  public:
   string glob_;
   GlobMatch(string&&);
   bool operator()(const string&) const override;
+  unsigned int Cost() const override { return 3; }
+  string Describe() const override { return ":" + glob_; }
+  string Literal() const override;
+
+ private:
+  enum class Tok : uint8_t { Char, Any, Group, Star };
+  struct Token {
+    Tok      type_;
+    char     char_;
+    uint32_t group_;
+  };
+  vec<Token>              tokens_;
+  vec<std::bitset<256>>   groups_;
+
+  void   Compile();
+  bool   Accepts(const Token&, char c) const;
+  size_t Skip   (const Token&, const char *str, size_t s, size_t len) const;
 };
 
 ExactMatch::ExactMatch(string &&text)
 : text_(move(text)) {}
 
 GlobMatch::GlobMatch(string &&glob)
-: glob_(move(glob)) {}
+: glob_(move(glob))
+{
+  Compile();
+}
 
 rptr<Match> Match::CreateExact(string &&text) {
   return new ExactMatch(move(text));
@@ -56,6 +96,8 @@ rptr<Match> Match::CreateGlob (string &&text) {
 }
 
 #ifdef PKGDEPDB_ENABLE_REGEX
+// Before running regexec a string has to contain the literal parts every
+// match requires, which are extracted from the pattern when compiling it.
 class RegexMatch : public Match {
  public:
   string  pattern_;
@@ -65,6 +107,19 @@ class RegexMatch : public Match {
   RegexMatch(string&&, bool icase);
   ~RegexMatch();
   bool operator()(const string&) const override;
+  unsigned int Cost() const override { return 10; }
+  string Describe() const override {
+    return "/" + pattern_ + (icase_ ? "/i" : "/");
+  }
+  string Literal() const override;
+
+ private:
+  string prefix_;  // after a leading ^
+  string suffix_;  // before a trailing $
+  string literal_; // the longest other required run of characters
+
+  void ExtractLiterals();
+  bool Prefilter(const string&) const;
 };
 
 RegexMatch::RegexMatch(string &&pattern, bool icase)
@@ -86,6 +141,164 @@ RegexMatch::RegexMatch(string &&pattern, bool icase)
     return;
   }
   compiled_ = true;
+  ExtractLiterals();
+}
+
+// Collects runs of plain characters outside of groups and bracket
+// expressions. Anything unclear ends the current run, so the result may
+// miss literals but never contains an optional one.
+void RegexMatch::ExtractLiterals() {
+  const string &re = pattern_;
+  const size_t  len = re.length();
+  string run;
+  bool   run_at_start = false;
+  string best;
+
+  auto end_run = [&]() {
+    if (run_at_start)
+      prefix_ = run;
+    else if (run.length() > best.length())
+      best = run;
+    run.clear();
+    run_at_start = false;
+  };
+
+  // returns the position after the bracket expression starting at i
+  auto skip_bracket = [&re,len](size_t i) -> size_t {
+    ++i;
+    if (i < len && re[i] == '^') ++i;
+    if (i < len && re[i] == ']') ++i;
+    while (i < len && re[i] != ']') {
+      // [:class:], [.coll.] and [=equiv=]
+      if (re[i] == '[' && i+1 < len &&
+          (re[i+1] == ':' || re[i+1] == '.' || re[i+1] == '='))
+      {
+        size_t close = re.find(string(1, re[i+1]) + "]", i+2);
+        i = (close == string::npos) ? len : close+2;
+        continue;
+      }
+      ++i;
+    }
+    return i+1;
+  };
+
+  size_t i = 0;
+  if (len && re[0] == '^') {
+    run_at_start = true;
+    ++i;
+  }
+  while (i < len) {
+    char c = re[i];
+    switch (c) {
+      case '|':
+        // alternatives have no common requirement we know of
+        prefix_.clear();
+        suffix_.clear();
+        return;
+      case '(':
+      {
+        end_run();
+        int depth = 0;
+        while (i < len) {
+          if (re[i] == '[') {
+            i = skip_bracket(i);
+            continue;
+          }
+          if (re[i] == '\\')
+            ++i;
+          else if (re[i] == '(')
+            ++depth;
+          else if (re[i] == ')' && !--depth)
+            break;
+          ++i;
+        }
+        ++i;
+        break;
+      }
+      case '[':
+        end_run();
+        i = skip_bracket(i);
+        break;
+      case '*':
+      case '?':
+      case '+':
+      case '{':
+      {
+        // The previous character may repeat, so it ends the run, and it
+        // is dropped if any of the quantifiers allows zero repetitions.
+        bool optional = false;
+        while (i < len &&
+               (re[i] == '*' || re[i] == '?' || re[i] == '+' || re[i] == '{'))
+        {
+          if (re[i] == '{') {
+            optional = optional ||
+                       (i+1 < len && (re[i+1] == '0' || re[i+1] == ','));
+            while (i < len && re[i] != '}')
+              ++i;
+          }
+          else if (re[i] != '+')
+            optional = true;
+          ++i;
+        }
+        if (optional && !run.empty())
+          run.pop_back();
+        end_run();
+        break;
+      }
+      case '$':
+        if (i+1 == len && !run.empty()) {
+          if (run_at_start)
+            prefix_ = run;
+          suffix_ = run;
+          run.clear();
+          run_at_start = false;
+        }
+        end_run();
+        ++i;
+        break;
+      case '\\':
+        // only escaped punctuation is a plain character, \w, \< or
+        // back references are not
+        if (i+1 < len && ispunct((unsigned char)re[i+1]) &&
+            !strchr("<>`'", re[i+1]))
+        {
+          run.append(1, re[i+1]);
+          i += 2;
+          break;
+        }
+        end_run();
+        i += 2;
+        break;
+      case '.':
+      case '^':
+      case ')':
+        end_run();
+        ++i;
+        break;
+      default:
+        run.append(1, c);
+        ++i;
+        break;
+    }
+  }
+  end_run();
+  // a prefix or suffix check is cheaper than a search
+  if (best.length() <= prefix_.length() || best.length() <= suffix_.length())
+    best.clear();
+  literal_ = move(best);
+
+  if (icase_) {
+    // only fold plain ASCII the way regexec does
+    auto ascii = [](const string &s) {
+      for (unsigned char ch : s)
+        if (ch >= 0x80)
+          return false;
+      return true;
+    };
+    if (!ascii(prefix_))  prefix_.clear();
+    if (!ascii(suffix_))  suffix_.clear();
+    if (!ascii(literal_)) literal_.clear();
+  }
 }
 
 RegexMatch::~RegexMatch() {
@@ -107,6 +320,22 @@ PackageFilter::PackageFilter(bool negate)
 PackageFilter::~PackageFilter()
 {}
 
+int PackageFilter::Field() const {
+  return -1;
+}
+
+bool PackageFilter::Merge(PackageFilter &other) {
+  (void)other; return false;
+}
+
+unsigned int PackageFilter::Cost() const {
+  return 1;
+}
+
+string PackageFilter::Describe() const {
+  return "?";
+}
+
 ObjectFilter::ObjectFilter(bool negate)
 : negate_(negate)
 {}
@@ -114,6 +343,22 @@ ObjectFilter::ObjectFilter(bool negate)
 ObjectFilter::~ObjectFilter()
 {}
 
+int ObjectFilter::Field() const {
+  return -1;
+}
+
+bool ObjectFilter::Merge(ObjectFilter &other) {
+  (void)other; return false;
+}
+
+unsigned int ObjectFilter::Cost() const {
+  return 1;
+}
+
+string ObjectFilter::Describe() const {
+  return "?";
+}
+
 StringFilter::StringFilter(bool negate)
 : negate_(negate)
 {}
@@ -121,292 +366,776 @@ StringFilter::StringFilter(bool negate)
 StringFilter::~StringFilter()
 {}
 
-// general purpose package filter
-class PkgFilt : public PackageFilter {
- public:
-  function<bool(const DB&, const Package&)> func;
+int StringFilter::Field() const {
+  return -1;
+}
 
-  PkgFilt(bool neg, function<bool(const DB&, const Package&)> &&fn)
-  : PackageFilter(neg), func(move(fn)) {}
+bool StringFilter::Merge(StringFilter &other) {
+  (void)other; return false;
+}
 
-  PkgFilt(bool neg, function<bool(const Package&)> &&fn)
-  : PkgFilt(neg, [fn] (const DB &db, const Package &pkg) -> bool {
-    (void)db;
-    return fn(pkg);
-  }) {}
+unsigned int StringFilter::Cost() const {
+  return 1;
+}
 
-  virtual bool visible(const DB &db, const Package &pkg) const {
-    return func(db, pkg);
-  }
-};
+string StringFilter::Describe() const {
+  return "?";
+}
 
-// general purpose object filter
-class ObjFilt : public ObjectFilter {
+// Finds out which of a set of literals occur in a string with a single
+// pass over it (Aho-Corasick). Each literal is tagged with a bit, a scan
+// returns the bits of all literals found.
+class LiteralSet {
  public:
-  function<bool(const Elf&)> func;
+  bool Empty() const {
+    return literals_.empty();
+  }
 
-  ObjFilt(bool neg, function<bool(const Elf&)> &&fn)
-  : ObjectFilter(neg), func(move(fn)) {}
+  void Add(const string &literal, uint64_t bit) {
+    literals_.emplace_back(literal, bit);
+    Build();
+  }
 
-  virtual bool visible(const Elf &elf) const {
-    return func(elf);
+  uint64_t Scan(const string &text) const {
+    uint64_t found = 0;
+    uint32_t state = 0;
+    for (unsigned char c : text) {
+      state = next_[state * classes_ + class_[c]];
+      found |= out_[state];
+    }
+    return found;
   }
-};
 
-// general purpose string filter
-class StrFilt : public StringFilter {
- public:
-  function<bool(const string&)> func;
+ private:
+  vec<tuple<string,uint64_t>> literals_;
+  // characters not used by any literal share class 0
+  uint8_t                     class_[256];
+  size_t                      classes_ = 1;
+  // the automaton: next_[state * classes_ + class] and the bits of the
+  // literals ending in each state
+  vec<uint32_t>               next_;
+  vec<uint64_t>               out_;
+
+  void Build() {
+    std::fill(class_, class_+256, 0);
+    classes_ = 1;
+    for (auto &lit : literals_) {
+      for (unsigned char c : std::get<0>(lit)) {
+        if (!class_[c])
+          class_[c] = uint8_t(classes_++);
+      }
+    }
+    if (classes_ > 256) {
+      // every byte value is used, classes are the characters themselves
+      for (unsigned int c = 0; c != 256; ++c)
+        class_[c] = uint8_t(c);
+      classes_ = 256;
+    }
 
-  StrFilt(bool neg, function<bool(const string&)> &&fn)
-  : StringFilter(neg), func(move(fn)) {}
+    // build the trie, 0 means there's no edge yet
+    next_.assign(classes_, 0);
+    out_.assign(1, 0);
+    for (auto &lit : literals_) {
+      uint32_t state = 0;
+      for (unsigned char c : std::get<0>(lit)) {
+        uint32_t &edge = next_[state * classes_ + class_[c]];
+        if (!edge) {
+          edge = uint32_t(out_.size());
+          next_.resize(next_.size() + classes_, 0);
+          out_.push_back(0);
+        }
+        // next_ may have been reallocated
+        state = next_[state * classes_ + class_[c]];
+      }
+      out_[state] |= std::get<1>(lit);
+    }
 
-  virtual bool visible(const string &str) const {
-    return func(str);
+    // breadth first: fill in the missing edges through the fail links
+    vec<uint32_t> fail(out_.size(), 0);
+    vec<uint32_t> queue;
+    for (size_t c = 0; c != classes_; ++c) {
+      if (next_[c])
+        queue.push_back(next_[c]);
+    }
+    for (size_t at = 0; at != queue.size(); ++at) {
+      uint32_t state = queue[at];
+      out_[state] |= out_[fail[state]];
+      for (size_t c = 0; c != classes_; ++c) {
+        uint32_t &edge = next_[state * classes_ + c];
+        uint32_t  alt  = next_[fail[state] * classes_ + c];
+        if (edge) {
+          fail[edge] = alt;
+          queue.push_back(edge);
+        }
+        else
+          edge = alt;
+      }
+    }
   }
 };
 
-// Utility functions:
+// The matchers of all filters on one field. A matcher is satisfied if any
+// of the field's values matches it, a negated one if none does. The group
+// accepts an entry if all its matchers are satisfied.
+// Exact matchers are looked up in hash tables, the other patterns are only
+// tried on values containing their literal, so testing a value does not
+// get slower with every added filter.
+class MatcherGroup {
+ public:
+  // evaluation state is kept in a bitmask: positive matchers and
+  // patterns are limited
+  static const size_t kMax = 64;
+
+  struct Pattern {
+    rptr<Match> matcher_;
+    bool        negate_;
+    uint64_t    bit_; // 0 if negated
+  };
 
-static bool match_glob(const string &glob, size_t g,
-                       const string &str,  size_t s)
-// tail recursive
-{
-  size_t from, to;
-  bool neg = false;
-
-  auto parse_group = [&]() -> bool {
-    from = ++g;
-    neg = (g < glob.length() && glob[g] == '^');
-    if (neg) ++from;
-    if (glob[g] == ']') // if the group contains a ] it must come first
-      ++g;
-    while (g < glob.length() && glob[g] != ']')
-      ++g;
-    if (g >= glob.length()) {
-      // glob syntax error, treat the [ as a regular [ character
-      g = from-1;
+  // all matchers in the order they were added
+  vec<rptr<Match>>                       matchers_;
+  vec<bool>                              negate_;
+  size_t                                 positive_ = 0;
+
+  std::unordered_set<string>             reject_;
+  std::unordered_map<string, uint64_t>   accept_;
+  vec<Pattern>                           patterns_;
+  LiteralSet                             prefilter_;
+  // patterns without a literal need to be tried on every value
+  uint64_t                               unfiltered_ = 0;
+
+  bool Add(rptr<Match> matcher, bool neg) {
+    bool pattern = !matcher->Text();
+    if ( (!neg && positive_ == kMax) ||
+         (pattern && patterns_.size() == kMax) )
+    {
       return false;
     }
-    to = g-1;
+    matchers_.emplace_back(matcher);
+    negate_.push_back(neg);
+    uint64_t bit = neg ? 0 : (uint64_t(1) << positive_++);
+
+    if (!pattern) {
+      if (neg)
+        reject_.insert(*matcher->Text());
+      else
+        accept_[*matcher->Text()] |= bit;
+      return true;
+    }
+
+    uint64_t index = uint64_t(1) << patterns_.size();
+    patterns_.push_back({matcher, neg, bit});
+    string literal(matcher->Literal());
+    if (literal.empty())
+      unfiltered_ |= index;
+    else
+      prefilter_.Add(literal, index);
     return true;
-  };
+  }
 
-  auto matches_group = [&](const char c) -> bool {
-    for (size_t f = from; f != to+1; ++f) {
-      if (f > from && f != to && glob[f] == '-') {
-        ++f;
-        if (c >= glob[f-1] && c <= glob[f])
-          return !neg;
-      }
-      if (c == glob[f]) {
-        return !neg;
-      }
+  bool Merge(MatcherGroup &other) {
+    if (positive_ + other.positive_ > kMax ||
+        patterns_.size() + other.patterns_.size() > kMax)
+    {
+      return false;
     }
-    return neg;
-  };
+    for (size_t i = 0; i != other.matchers_.size(); ++i)
+      Add(other.matchers_[i], other.negate_[i]);
+    return true;
+  }
 
-  if (g >= glob.length()) // nothing else to match
-    return s >= str.length(); // true if there are no contents to match either
-  if (s >= str.length()) {
-    if (glob[g] == '*')
-      return match_glob(glob, g+1, str, s+1);
-    return false;
+  uint64_t AllPositive() const {
+    return positive_ == kMax ? ~uint64_t(0)
+                             : (uint64_t(1) << positive_) - 1;
   }
-  switch (glob[g]) {
-    default:
-      if (glob[g] != str[s])
-        return false;
-      return match_glob(glob, g+1, str, s+1);
-    case '?':
-      return match_glob(glob, g+1, str, s+1);
-    case '[':
-      if (!parse_group()) {
-        if (str[s] != '[')
-          return false;
-        return match_glob(glob, g+1, str, s+1);
+
+  unsigned int Cost() const {
+    unsigned int cost = (reject_.empty() && accept_.empty()) ? 0 : 1;
+    for (auto &p : patterns_)
+      cost += p.matcher_->Cost();
+    return cost;
+  }
+
+  string Describe(const char *field) const {
+    string desc;
+    for (size_t i = 0; i != matchers_.size(); ++i) {
+      if (i)
+        desc.append(" & ");
+      if (negate_[i])
+        desc.append(1, '!');
+      desc.append(field);
+      desc.append(matchers_[i]->Describe());
+    }
+    return desc;
+  }
+};
+
+// Feed the values of a field one by one until the outcome is known.
+class MatchState {
+ public:
+  const MatcherGroup &group_;
+  const uint64_t      all_;
+  uint64_t            hit_      = 0;
+  bool                rejected_ = false;
+  bool                exact_    = true;
+
+  MatchState(const MatcherGroup &group)
+  : group_(group), all_(group.AllPositive()) {}
+
+  // Decide the exact matchers of a contains filter through the db's file
+  // index, returns true if the filelist does not need to be looked at.
+  bool Owned(const DB &db, const Package &pkg) {
+    size_t exact = group_.reject_.size() + group_.accept_.size();
+    // an index lookup costs about as much as hashing a few dozen paths
+    if (!exact || pkg.filelist_.size() < exact * 32)
+      return false;
+    exact_ = false;
+    for (auto &path : group_.reject_) {
+      if (db.Owns(&pkg, path)) {
+        rejected_ = true;
+        return true;
       }
-      if (!matches_group(str[s]))
-        return false;
-      return match_glob(glob, g+1, str, s+1);
+    }
+    for (auto &entry : group_.accept_) {
+      if (db.Owns(&pkg, entry.first))
+        hit_ |= entry.second;
+    }
+    return group_.patterns_.empty();
+  }
 
-    case '*':
-    {
-      bool wasgroup = false;
-      while (g < glob.length() && (glob[g] == '*' || glob[g] == '?')) ++g;
-      if (g >= glob.length()) // ended with a set of * and ?, so we match
+  // returns true once the result is decided
+  bool operator()(const string &value) {
+    // exact matchers may have been decided by Owned() already
+    if (exact_) {
+      if (!group_.reject_.empty() && group_.reject_.count(value)) {
+        rejected_ = true;
         return true;
-      if (glob[g] == '[')
-        wasgroup = parse_group();
-      while (s < str.length()) {
-        if ( (wasgroup && matches_group(str[s])) ||
-             (!wasgroup && str[s] == glob[g]) )
-        {
-          // next character matches here, fork off:
-          if (match_glob(glob, g+1, str, s+1))
-            return true;
+      }
+      if (!group_.accept_.empty()) {
+        auto fnd = group_.accept_.find(value);
+        if (fnd != group_.accept_.end())
+          hit_ |= fnd->second;
+      }
+    }
+
+    auto &patterns = group_.patterns_;
+    if (!patterns.empty()) {
+      uint64_t candidates = group_.unfiltered_;
+      if (!group_.prefilter_.Empty())
+        candidates |= group_.prefilter_.Scan(value);
+      for (size_t i = 0; candidates; ++i, candidates >>= 1) {
+        const auto &p = patterns[i];
+        if (!(candidates & 1) || (hit_ & p.bit_) || !(*p.matcher_)(value))
+          continue;
+        if (p.negate_) {
+          rejected_ = true;
+          return true;
         }
-        ++s; // otherwise gobble it up into the *
+        hit_ |= p.bit_;
       }
-      return false;
     }
+    // with negated matchers left every value has to be seen
+    return hit_ == all_ && group_.positive_ == group_.matchers_.size();
+  }
+
+  bool Result() const {
+    return !rejected_ && hit_ == all_;
   }
+};
+
+enum class ObjField : int {
+  Name, Path, Depends, RPath, RunPath, Interp
+};
+
+enum class PkgField : int {
+  Name, Group, Depends, OptDepends, MakeDepends, CheckDepends, AllDepends,
+  Provides, Conflicts, Replaces, Contains,
+  LibDepends, LibRPath, LibRunPath, LibInterp
+};
+
+// Call fn on each value of a field until it returns true.
+template<typename F>
+static bool obj_values(ObjField field, const Elf &elf, F &fn) {
+  switch (field) {
+    case ObjField::Name:
+      return fn(elf.basename_);
+    case ObjField::Path: {
+      string p(elf.dirname_); p.append(1, '/'); p.append(elf.basename_);
+      return fn(p);
+    }
+    case ObjField::Depends:
+      for (auto &i : elf.needed_)
+        if (fn(i))
+          return true;
+      return false;
+    case ObjField::RPath:
+      return elf.rpath_set_ && fn(elf.rpath_);
+    case ObjField::RunPath:
+      return elf.runpath_set_ && fn(elf.runpath_);
+    case ObjField::Interp:
+      return elf.interpreter_set_ && fn(elf.interpreter_);
+  }
+  return false;
 }
 
-uniq<PackageFilter> PackageFilter::name(rptr<Match> matcher, bool neg) {
-  return mk_unique<PkgFilt>(neg, [matcher](const Package &pkg) {
-    return (*matcher)(pkg.name_);
-  });
+template<typename F>
+static bool dep_values(const DependList &list, F &fn) {
+  for (auto &i : list)
+    if (fn(std::get<0>(i)))
+      return true;
+  return false;
 }
 
-template<typename CONT>
-static uniq<PackageFilter>
-make_pkgfilter(rptr<Match> matcher, bool neg, CONT (Package::*member)) {
-  return mk_unique<PkgFilt>(neg, [matcher,member](const Package &pkg) {
-    for (auto &i : pkg.*member) {
-      if ((*matcher)(i))
-        return true;
-    }
-    return false;
-  });
+template<typename F>
+static bool lib_values(ObjField field, const Package &pkg, F &fn) {
+  for (auto &e : pkg.objects_)
+    if (obj_values(field, *e, fn))
+      return true;
+  return false;
 }
 
-template<typename CONT>
-static uniq<PackageFilter>
-make_pkgdepfilter(rptr<Match> matcher, bool neg, CONT (Package::*member)) {
-  return mk_unique<PkgFilt>(neg, [matcher,member](const Package &pkg) {
-    for (auto &i : pkg.*member) {
-      if ((*matcher)(std::get<0>(i)))
-        return true;
-    }
-    return false;
-  });
+template<typename F>
+static bool pkg_values(PkgField field, const Package &pkg, F &fn) {
+  switch (field) {
+    case PkgField::Name:         return fn(pkg.name_);
+    case PkgField::Depends:      return dep_values(pkg.depends_, fn);
+    case PkgField::OptDepends:   return dep_values(pkg.optdepends_, fn);
+    case PkgField::MakeDepends:  return dep_values(pkg.makedepends_, fn);
+    case PkgField::CheckDepends: return dep_values(pkg.checkdepends_, fn);
+    case PkgField::Provides:     return dep_values(pkg.provides_, fn);
+    case PkgField::Conflicts:    return dep_values(pkg.conflicts_, fn);
+    case PkgField::Replaces:     return dep_values(pkg.replaces_, fn);
+    case PkgField::AllDepends:
+      return dep_values(pkg.depends_, fn)      ||
+             dep_values(pkg.makedepends_, fn)  ||
+             dep_values(pkg.checkdepends_, fn) ||
+             dep_values(pkg.optdepends_, fn);
+    case PkgField::Group:
+      for (auto &i : pkg.groups_)
+        if (fn(i))
+          return true;
+      return false;
+    case PkgField::Contains:
+      for (auto &i : pkg.filelist_)
+        if (fn(i))
+          return true;
+      return false;
+    case PkgField::LibDepends: return lib_values(ObjField::Depends, pkg, fn);
+    case PkgField::LibRPath:   return lib_values(ObjField::RPath, pkg, fn);
+    case PkgField::LibRunPath: return lib_values(ObjField::RunPath, pkg, fn);
+    case PkgField::LibInterp:  return lib_values(ObjField::Interp, pkg, fn);
+  }
+  return false;
 }
-#define MAKE_PKGFILTER(NAME,VAR)                         \
-uniq<PackageFilter>                                      \
-PackageFilter::NAME(rptr<Match> matcher, bool neg) {     \
-  return make_pkgfilter(matcher, neg, &Package::VAR##_); \
+
+// Rough per-entry cost of walking a field's values.
+static unsigned int field_cost(PkgField field) {
+  switch (field) {
+    case PkgField::Name:         return 1;
+    case PkgField::Group:        return 2;
+    case PkgField::Provides:     return 2;
+    case PkgField::Conflicts:    return 2;
+    case PkgField::Replaces:     return 2;
+    case PkgField::Depends:      return 4;
+    case PkgField::OptDepends:   return 4;
+    case PkgField::MakeDepends:  return 4;
+    case PkgField::CheckDepends: return 4;
+    case PkgField::AllDepends:   return 12;
+    case PkgField::LibRPath:     return 4;
+    case PkgField::LibRunPath:   return 4;
+    case PkgField::LibInterp:    return 4;
+    case PkgField::LibDepends:   return 16;
+    case PkgField::Contains:     return 64;
+  }
+  return 1;
 }
-#define MAKE_PKGDEPFILTER(NAME,VAR)                         \
-uniq<PackageFilter>                                         \
-PackageFilter::NAME(rptr<Match> matcher, bool neg) {        \
-  return make_pkgdepfilter(matcher, neg, &Package::VAR##_); \
+
+static unsigned int field_cost(ObjField field) {
+  switch (field) {
+    case ObjField::Name:    return 1;
+    case ObjField::RPath:   return 1;
+    case ObjField::RunPath: return 1;
+    case ObjField::Interp:  return 1;
+    case ObjField::Path:    return 2;
+    case ObjField::Depends: return 4;
+  }
+  return 1;
 }
 
-#define MAKE_PKGDEPFILTER1(NAME) MAKE_PKGDEPFILTER(NAME,NAME)
+static const char* field_name(PkgField field) {
+  switch (field) {
+    case PkgField::Name:         return "name";
+    case PkgField::Group:        return "group";
+    case PkgField::Depends:      return "depends";
+    case PkgField::OptDepends:   return "optdepends";
+    case PkgField::MakeDepends:  return "makedepends";
+    case PkgField::CheckDepends: return "checkdepends";
+    case PkgField::AllDepends:   return "alldepends";
+    case PkgField::Provides:     return "provides";
+    case PkgField::Conflicts:    return "conflicts";
+    case PkgField::Replaces:     return "replaces";
+    case PkgField::Contains:     return "contains";
+    case PkgField::LibDepends:   return "pkglibdepends";
+    case PkgField::LibRPath:     return "pkglibrpath";
+    case PkgField::LibRunPath:   return "pkglibrunpath";
+    case PkgField::LibInterp:    return "pkglibinterp";
+  }
+  return "?";
+}
 
-MAKE_PKGFILTER(group,groups)
-MAKE_PKGDEPFILTER1(depends)
-MAKE_PKGDEPFILTER1(optdepends)
-MAKE_PKGDEPFILTER1(makedepends)
-MAKE_PKGDEPFILTER1(checkdepends)
-MAKE_PKGDEPFILTER1(provides)
-MAKE_PKGDEPFILTER1(conflicts)
-MAKE_PKGDEPFILTER1(replaces)
-MAKE_PKGFILTER(contains,filelist)
+static const char* field_name(ObjField field) {
+  switch (field) {
+    case ObjField::Name:    return "libname";
+    case ObjField::Path:    return "libpath";
+    case ObjField::Depends: return "libdepends";
+    case ObjField::RPath:   return "librpath";
+    case ObjField::RunPath: return "librunpath";
+    case ObjField::Interp:  return "libinterp";
+  }
+  return "?";
+}
 
-#undef MAKE_PKGFILTER
+// package filter on a field
+class PkgFieldFilter : public PackageFilter {
+ public:
+  PkgField     field_;
+  MatcherGroup group_;
 
-uniq<PackageFilter>
-PackageFilter::alldepends(rptr<Match> matcher, bool neg) {
-  return mk_unique<PkgFilt>(neg, [matcher](const Package &pkg) {
-    for (auto &i : pkg.depends_)
-      if ((*matcher)(std::get<0>(i)))
-        return true;
-    for (auto &i : pkg.makedepends_)
-      if ((*matcher)(std::get<0>(i)))
-        return true;
-    for (auto &i : pkg.checkdepends_)
-      if ((*matcher)(std::get<0>(i)))
-        return true;
-    for (auto &i : pkg.optdepends_)
-      if ((*matcher)(std::get<0>(i)))
-        return true;
+  PkgFieldFilter(PkgField field, rptr<Match> matcher, bool neg)
+  : PackageFilter(false), field_(field)
+  {
+    group_.Add(matcher, neg);
+  }
+
+  bool visible(const DB &db, const Package &pkg) const override {
+    MatchState state(group_);
+    if (field_ == PkgField::Contains && state.Owned(db, pkg))
+      return state.Result();
+    pkg_values(field_, pkg, state);
+    return state.Result();
+  }
+
+  int Field() const override {
+    return int(field_);
+  }
+
+  bool Merge(PackageFilter &other) override {
+    if (other.Field() != Field())
+      return false;
+    return group_.Merge(static_cast<PkgFieldFilter&>(other).group_);
+  }
+
+  unsigned int Cost() const override {
+    return field_cost(field_) * group_.Cost();
+  }
+
+  string Describe() const override {
+    return group_.Describe(field_name(field_));
+  }
+};
+
+class BrokenFilter : public PackageFilter {
+ public:
+  BrokenFilter(bool neg) : PackageFilter(neg) {}
+
+  bool visible(const DB &db, const Package &pkg) const override {
+    return db.IsBroken(&pkg);
+  }
+
+  unsigned int Cost() const override {
+    return 32;
+  }
+
+  string Describe() const override {
+    return negate_ ? "!broken" : "broken";
+  }
+};
+
+// object filter on a field
+class ObjFieldFilter : public ObjectFilter {
+ public:
+  ObjField     field_;
+  MatcherGroup group_;
+
+  ObjFieldFilter(ObjField field, rptr<Match> matcher, bool neg)
+  : ObjectFilter(false), field_(field)
+  {
+    group_.Add(matcher, neg);
+  }
+
+  bool visible(const Elf &elf) const override {
+    MatchState state(group_);
+    obj_values(field_, elf, state);
+    return state.Result();
+  }
+
+  int Field() const override {
+    return int(field_);
+  }
+
+  bool Merge(ObjectFilter &other) override {
+    if (other.Field() != Field())
+      return false;
+    return group_.Merge(static_cast<ObjFieldFilter&>(other).group_);
+  }
+
+  unsigned int Cost() const override {
+    return field_cost(field_) * group_.Cost();
+  }
+
+  string Describe() const override {
+    return group_.Describe(field_name(field_));
+  }
+};
+
+// string filter, there is only one field
+class StrMatchFilter : public StringFilter {
+ public:
+  MatcherGroup group_;
+
+  StrMatchFilter(rptr<Match> matcher, bool neg)
+  : StringFilter(false)
+  {
+    group_.Add(matcher, neg);
+  }
+
+  bool visible(const string &str) const override {
+    MatchState state(group_);
+    state(str);
+    return state.Result();
+  }
+
+  int Field() const override {
+    return 0;
+  }
+
+  bool Merge(StringFilter &other) override {
+    if (other.Field() != Field())
+      return false;
+    return group_.Merge(static_cast<StrMatchFilter&>(other).group_);
+  }
+
+  unsigned int Cost() const override {
+    return group_.Cost();
+  }
+
+  string Describe() const override {
+    return group_.Describe("file");
+  }
+};
+
+// Utility functions:
+
+// Parses the [...] group starting at glob[g]. On success g points to the
+// closing bracket and [from,to] are the group's contents.
+static bool parse_group(const string &glob, size_t &g,
+                        size_t &from, size_t &to, bool &neg)
+{
+  from = ++g;
+  neg = (g < glob.length() && glob[g] == '^');
+  if (neg) ++from;
+  if (glob[g] == ']') // if the group contains a ] it must come first
+    ++g;
+  while (g < glob.length() && glob[g] != ']')
+    ++g;
+  if (g >= glob.length()) {
+    // glob syntax error, treat the [ as a regular [ character
+    g = from-1;
     return false;
-  });
+  }
+  to = g-1;
+  return true;
 }
 
-static
-uniq<PackageFilter>
-PkgLibFilter(uniq<ObjectFilter> depfilter, bool neg) {
-  if (!depfilter)
-    return nullptr;
-  rptr<ObjectFilter> libfilter(depfilter.release());
-  if (!libfilter)
-    return nullptr;
-  return mk_unique<PkgFilt>(neg, [libfilter](const Package &pkg) {
-    for (auto &e : pkg.objects_)
-      if (libfilter->visible(*e))
-        return true;
-    return false;
-  });
+static bool matches_group(const string &glob, size_t from, size_t to,
+                          bool neg, const char c)
+{
+  for (size_t f = from; f != to+1; ++f) {
+    if (f > from && f != to && glob[f] == '-') {
+      ++f;
+      if (c >= glob[f-1] && c <= glob[f])
+        return !neg;
+    }
+    if (c == glob[f]) {
+      return !neg;
+    }
+  }
+  return neg;
 }
 
-#define MAKE_PKGLIBFILTER(NAME)                                 \
-uniq<PackageFilter>                                             \
-PackageFilter::pkglib##NAME(rptr<Match> matcher, bool neg) {    \
-  return PkgLibFilter(ObjectFilter::NAME(matcher, false), neg); \
+void GlobMatch::Compile() {
+  const string &glob = glob_;
+  size_t g = 0;
+  bool after_star = false;
+  while (g < glob.length()) {
+    switch (glob[g]) {
+      default:
+        tokens_.push_back({Tok::Char, glob[g], 0});
+        ++g;
+        break;
+      case '?':
+        tokens_.push_back({Tok::Any, 0, 0});
+        ++g;
+        break;
+      case '[':
+      {
+        size_t from, to;
+        bool neg;
+        if (!parse_group(glob, g, from, to, neg)) {
+          // right after a star the character before the group's contents
+          // is matched literally, which is the ^ of a negated group
+          tokens_.push_back({Tok::Char, after_star ? glob[g] : '[', 0});
+          g = from;
+          break;
+        }
+        std::bitset<256> bits;
+        for (unsigned int c = 0; c != 256; ++c)
+          bits[c] = matches_group(glob, from, to, neg, char(c));
+        tokens_.push_back({Tok::Group, 0, uint32_t(groups_.size())});
+        groups_.emplace_back(bits);
+        ++g;
+        break;
+      }
+      case '*':
+      {
+        // a sequence of * and ? acts as a single *, unless it ends the
+        // glob, then any ? requires at least one more character
+        bool any = false;
+        while (g < glob.length() && (glob[g] == '*' || glob[g] == '?'))
+          any = (glob[g++] == '?') || any;
+        if (g >= glob.length() && any)
+          tokens_.push_back({Tok::Any, 0, 0});
+        tokens_.push_back({Tok::Star, 0, 0});
+        after_star = true;
+        continue;
+      }
+    }
+    after_star = false;
+  }
 }
 
-MAKE_PKGLIBFILTER(depends)
-MAKE_PKGLIBFILTER(rpath)
-MAKE_PKGLIBFILTER(runpath)
-MAKE_PKGLIBFILTER(interp)
+inline bool GlobMatch::Accepts(const Token &tok, char c) const {
+  switch (tok.type_) {
+    case Tok::Char:  return c == tok.char_;
+    case Tok::Any:   return true;
+    case Tok::Group: return groups_[tok.group_][(unsigned char)c];
+    case Tok::Star:  break;
+  }
+  return false;
+}
 
-#undef MAKE_PKGLIBFILTER
+// the longest run of plain characters
+string GlobMatch::Literal() const {
+  string best, run;
+  for (auto &tok : tokens_) {
+    if (tok.type_ == Tok::Char) {
+      run.append(1, tok.char_);
+      continue;
+    }
+    if (run.length() > best.length())
+      best.swap(run);
+    run.clear();
+  }
+  if (run.length() > best.length())
+    best.swap(run);
+  return best;
+}
 
-uniq<PackageFilter> PackageFilter::broken(bool neg) {
-  return mk_unique<PkgFilt>(neg, [](const DB &db, const Package &pkg) {
-    return db.IsBroken(&pkg);
-  });
+// first position starting at s where a character token can match
+inline size_t GlobMatch::Skip(const Token &tok, const char *str,
+                              size_t s, size_t len) const
+{
+  if (s >= len)
+    return len;
+  if (tok.type_ == Tok::Char) {
+    auto at = (const char*)::memchr(str+s, tok.char_, len-s);
+    return at ? size_t(at-str) : len;
+  }
+  while (s != len && !Accepts(tok, str[s]))
+    ++s;
+  return s;
 }
 
-// general purpose object filter
-uniq<ObjectFilter> ObjectFilter::name(rptr<Match> matcher, bool neg) {
-  return mk_unique<ObjFilt>(neg, [matcher](const Elf &elf) {
-    return (*matcher)(elf.basename_);
-  });
+#define MAKE_PKGFILTER(NAME,FIELD)                                  \
+uniq<PackageFilter>                                                 \
+PackageFilter::NAME(rptr<Match> matcher, bool neg) {                \
+  return mk_unique<PkgFieldFilter>(PkgField::FIELD, matcher, neg);  \
 }
 
-uniq<ObjectFilter> ObjectFilter::path(rptr<Match> matcher, bool neg) {
-  return mk_unique<ObjFilt>(neg, [matcher](const Elf &elf) {
-    string p(elf.dirname_); p.append(1, '/'); p.append(elf.basename_);
-    return (*matcher)(p);
-  });
+MAKE_PKGFILTER(name,          Name)
+MAKE_PKGFILTER(group,         Group)
+MAKE_PKGFILTER(depends,       Depends)
+MAKE_PKGFILTER(optdepends,    OptDepends)
+MAKE_PKGFILTER(makedepends,   MakeDepends)
+MAKE_PKGFILTER(checkdepends,  CheckDepends)
+MAKE_PKGFILTER(alldepends,    AllDepends)
+MAKE_PKGFILTER(provides,      Provides)
+MAKE_PKGFILTER(conflicts,     Conflicts)
+MAKE_PKGFILTER(replaces,      Replaces)
+MAKE_PKGFILTER(contains,      Contains)
+MAKE_PKGFILTER(pkglibdepends, LibDepends)
+MAKE_PKGFILTER(pkglibrpath,   LibRPath)
+MAKE_PKGFILTER(pkglibrunpath, LibRunPath)
+MAKE_PKGFILTER(pkglibinterp,  LibInterp)
+
+#undef MAKE_PKGFILTER
+
+uniq<PackageFilter> PackageFilter::broken(bool neg) {
+  return mk_unique<BrokenFilter>(neg);
 }
 
-uniq<ObjectFilter> ObjectFilter::depends(rptr<Match> matcher, bool neg) {
-  return mk_unique<ObjFilt>(neg, [matcher](const Elf &elf) {
-    for (auto &i : elf.needed_)
-      if ((*matcher)(i))
-        return true;
-    return false;
-  });
+#define MAKE_OBJFILTER(NAME,FIELD)                                  \
+uniq<ObjectFilter>                                                  \
+ObjectFilter::NAME(rptr<Match> matcher, bool neg) {                 \
+  return mk_unique<ObjFieldFilter>(ObjField::FIELD, matcher, neg);  \
 }
 
-uniq<ObjectFilter> ObjectFilter::rpath(rptr<Match> matcher, bool neg) {
-  return mk_unique<ObjFilt>(neg, [matcher](const Elf &elf) {
-    return elf.rpath_set_ && (*matcher)(elf.rpath_);
-  });
+MAKE_OBJFILTER(name,    Name)
+MAKE_OBJFILTER(path,    Path)
+MAKE_OBJFILTER(depends, Depends)
+MAKE_OBJFILTER(rpath,   RPath)
+MAKE_OBJFILTER(runpath, RunPath)
+MAKE_OBJFILTER(interp,  Interp)
+
+#undef MAKE_OBJFILTER
+
+uniq<StringFilter> StringFilter::filter(rptr<Match> matcher, bool neg) {
+  return mk_unique<StrMatchFilter>(matcher, neg);
 }
 
-uniq<ObjectFilter> ObjectFilter::runpath(rptr<Match> matcher, bool neg) {
-  return mk_unique<ObjFilt>(neg, [matcher](const Elf &elf) {
-    return elf.runpath_set_ && (*matcher)(elf.runpath_);
-  });
+template<typename List>
+static void compile(List &list) {
+  List plan;
+  for (auto &filter : list) {
+    bool merged = false;
+    if (filter->Field() >= 0) {
+      for (auto &p : plan) {
+        if ( (merged = p->Merge(*filter)) )
+          break;
+      }
+    }
+    if (!merged)
+      plan.emplace_back(move(filter));
+  }
+  std::stable_sort(plan.begin(), plan.end(),
+    [](const typename List::value_type &a,
+       const typename List::value_type &b)
+    {
+      return a->Cost() < b->Cost();
+    });
+  list = move(plan);
 }
 
-uniq<ObjectFilter> ObjectFilter::interp(rptr<Match> matcher, bool neg) {
-  return mk_unique<ObjFilt>(neg, [matcher](const Elf &elf) {
-    return elf.interpreter_set_ && (*matcher)(elf.interpreter_);
-  });
+void Compile(FilterList &list) {
+  compile(list);
 }
 
-// string filter
-uniq<StringFilter> StringFilter::filter(rptr<Match> matcher, bool neg) {
-  return mk_unique<StrFilt>(neg, [matcher](const string &str) {
-    return (*matcher)(str);
-  });
+void Compile(ObjFilterList &list) {
+  compile(list);
+}
+
+void Compile(StrFilterList &list) {
+  compile(list);
 }
 
 bool ExactMatch::operator()(const string &other) const {
@@ -414,11 +1143,88 @@ bool ExactMatch::operator()(const string &other) const {
 }
 
 bool GlobMatch::operator()(const string &other) const {
-  return match_glob(glob_, 0, other, 0);
+  const char  *str   = other.c_str();
+  const size_t len   = other.length();
+  const size_t count = tokens_.size();
+  size_t t = 0, s = 0;
+  // where to resume when the tokens after the last star fail to match
+  size_t star_t = count, star_s = 0;
+  for (;;) {
+    if (t != count) {
+      const Token &tok = tokens_[t];
+      if (tok.type_ == Tok::Star) {
+        if (++t == count) // a trailing star matches the rest
+          return true;
+        star_t = t;
+        star_s = s = Skip(tokens_[t], str, s, len);
+        if (s == len)
+          return false;
+        continue;
+      }
+      if (s != len && Accepts(tok, str[s])) {
+        ++t;
+        ++s;
+        continue;
+      }
+    }
+    else if (s == len)
+      return true;
+    if (star_t == count)
+      return false;
+    // let the star swallow everything up to the next possible match
+    star_s = Skip(tokens_[star_t], str, star_s+1, len);
+    if (star_s == len)
+      return false;
+    t = star_t;
+    s = star_s;
+  }
 }
 
 #ifdef PKGDEPDB_ENABLE_REGEX
+string RegexMatch::Literal() const {
+  // the literal prefilter of a MatcherGroup is case sensitive
+  if (icase_)
+    return string();
+  string lit(literal_);
+  if (prefix_.length() > lit.length()) lit = prefix_;
+  if (suffix_.length() > lit.length()) lit = suffix_;
+  return lit;
+}
+
+bool RegexMatch::Prefilter(const string &other) const {
+  const size_t len = other.length();
+  if (prefix_.length() > len || suffix_.length() > len)
+    return false;
+  const char *str = other.c_str();
+  if (!icase_) {
+    if (!prefix_.empty() && memcmp(str, prefix_.c_str(), prefix_.length()))
+      return false;
+    if (!suffix_.empty() &&
+        memcmp(str + len - suffix_.length(), suffix_.c_str(),
+               suffix_.length()))
+    {
+      return false;
+    }
+    return literal_.empty() ||
+           ::memmem(str, len, literal_.c_str(), literal_.length());
+  }
+  if (!prefix_.empty() &&
+      ::strncasecmp(str, prefix_.c_str(), prefix_.length()))
+  {
+    return false;
+  }
+  if (!suffix_.empty() &&
+      ::strncasecmp(str + len - suffix_.length(), suffix_.c_str(),
+                    suffix_.length()))
+  {
+    return false;
+  }
+  return literal_.empty() || ::strcasestr(str, literal_.c_str());
+}
+
 bool RegexMatch::operator()(const string &other) const {
+  if (!Prefilter(other))
+    return false;
   regmatch_t rm;
   return 0 == regexec(&regex_, other.c_str(), 0, &rm, 0);
 }
@@ -430,13 +1236,13 @@ bool RegexMatch::operator()(const string &other) const {
 
 #ifdef TEST
 #include <iostream>
-using filter::match_glob;
+using namespace pkgdepdb;
 int main() {
   string text("This is a stupid text.");
   int r=0;
 
   auto tryglob = [&](const char *c, bool expect) {
-    if (match_glob(c, 0, text, 0) != expect) {
+    if ((*filter::Match::CreateGlob(c))(text) != expect) {
       std::cout << "FAIL: " << c << ": "
                 << (expect ? "TRUE" : "FALSE") << " expected." << std::endl;
       r=1;
@@ -479,6 +1285,13 @@ int main() {
   text = "Fa[bc]dbar";
   tryglob("Fa[[]bc*", true);
   tryglob("Fa[[]bc[]]db*", true);
+  tryglob("Fa[bc*", true);
+  tryglob("*a[bc]db*", false);
+  text = "xay";
+  tryglob("*?a*", true);
+  tryglob("xay*?", false);
+  tryglob("x*?y", true);
+  tryglob("*a*a*a*a*a*a*b", false);
   return r;
 }
 #endif
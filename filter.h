@@ -11,6 +11,14 @@ class Match {
   Match();
   virtual ~Match();
   virtual bool operator()(const string&) const = 0;
+  // estimated cost of a single test, used to order filters
+  virtual unsigned int Cost() const = 0;
+  // the pattern in filter syntax: =text, :glob or /regex/
+  virtual string Describe() const = 0;
+  // the text an exact matcher compares with, nullptr for patterns
+  virtual const string* Text() const;
+  // a substring of every matching string, empty if there is none
+  virtual string Literal() const;
 
   static rptr<Match> CreateExact(string &&text);
   static rptr<Match> CreateGlob (string &&text);
@@ -37,6 +45,12 @@ class PackageFilter {
     return visible(db, pkg) != negate_;
   }
 
+  // Filters on the same field can be merged, see Compile().
+  virtual int          Field() const;
+  virtual bool         Merge(PackageFilter &other);
+  virtual unsigned int Cost() const;
+  virtual string       Describe() const;
+
   static uniq<PackageFilter> name         (rptr<Match>, bool neg);
   static uniq<PackageFilter> group        (rptr<Match>, bool neg);
   static uniq<PackageFilter> depends      (rptr<Match>, bool neg);
@@ -76,6 +90,11 @@ class ObjectFilter {
     return visible(db, elf) != negate_;
   }
 
+  virtual int          Field() const;
+  virtual bool         Merge(ObjectFilter &other);
+  virtual unsigned int Cost() const;
+  virtual string       Describe() const;
+
   static uniq<ObjectFilter> name   (rptr<Match>, bool neg);
   static uniq<ObjectFilter> path   (rptr<Match>, bool neg);
   static uniq<ObjectFilter> depends(rptr<Match>, bool neg);
@@ -100,9 +119,21 @@ class StringFilter {
     return visible(str) != negate_;
   }
 
+  virtual int          Field() const;
+  virtual bool         Merge(StringFilter &other);
+  virtual unsigned int Cost() const;
+  virtual string       Describe() const;
+
   static uniq<StringFilter> filter(rptr<Match>, bool neg);
 };
 
+// Turn a filter list into an evaluation plan: filters on the same field
+// are merged so the field's values are only walked once, and the result
+// is ordered by estimated cost so cheap filters reject entries first.
+void Compile(FilterList&);
+void Compile(ObjFilterList&);
+void Compile(StrFilterList&);
+
 } // ::pkgdepdb::filter
 
 } // ::pkgdepdb
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
 #include <getopt.h>
 #include <ctype.h>
 #include <limits.h>
@@ -13,15 +14,21 @@
 #include "package.h"
 #include "db.h"
 #include "filter.h"
+#include "serve.h"
+#include "stats.h"
 
 using namespace pkgdepdb;
 
 static const char *arg0 = 0;
+// --trace: where to write the trace when done
+static string trace_file;
 
 static struct option long_opts[] = {
   { "help",    no_argument,       0, 'h' },
   { "version", no_argument,       0, -'v' },
   { "quiet",   no_argument,       0, 'q' },
+  { "stats",   no_argument,       0, -1024-'s' },
+  { "trace",   required_argument, 0, -1024-'t' },
   { "db",      required_argument, 0, 'd' },
   { "install", no_argument,       0, 'i' },
   { "dry",     no_argument,       0, -'d' },
@@ -58,14 +65,23 @@ static struct option long_opts[] = {
   { "depends",    required_argument, 0, -1024-'D' },
 
   { "filter",     required_argument, 0, 'f' },
+  { "explain-filters", no_argument,  0, -1024-'X' },
 
   { "files",      optional_argument, 0, -1024-'f' },
   { "no-files",   no_argument,       0, -1025-'f' },
   { "ls",         no_argument,       0, -1026-'f' },
+  { "owns",       required_argument, 0, -1028-'f' },
+  { "impact",     no_argument,       0, -1024-'M' },
+  { "preview",    no_argument,       0, -1024-'V' },
+  { "mem-stats",  no_argument,       0, -1024-'m' },
   { "rm-files",   no_argument,       0, -1027-'f' },
 
   { "touch",      no_argument,       0, -1024-'T' },
 
+  { "serve",      required_argument, 0, -1024-'S' },
+  { "connect",    required_argument, 0, -1024-'C' },
+  { "batch",      required_argument, 0, -1024-'B' },
+
   { 0, 0, 0, 0 }
 };
 
@@ -79,6 +95,8 @@ static void help [[noreturn]] (int x) {
     "  --version          show version info\n"
     "  -v, --verbose      print more information\n"
     "  -q, --quiet        suppress progress messages\n"
+    "  --stats            print timings and counters to stderr when done\n"
+    "  --trace=FILE       write a Chrome trace of the run to FILE\n"
     "  --depends=<YES|NO> enable or disable package dependencies\n"
     "  --files=<YES|NO>   whether to store all non-object files of packages\n"
     "  -J, --json=PART    activate json mode for parts of the program\n"
@@ -100,11 +118,15 @@ static void help [[noreturn]] (int x) {
     "  -i, --install      install packages to a dependency db\n"
     "  -r, --remove       remove packages from the database\n"
     "  --dry              do not commit the changes to the db\n"
+    "  --preview          with -i: show the objects installing the packages\n"
+    "                     would break or fix instead of installing them\n"
     "  --fixpaths         fix up path entries as older versions didn't\n"
     "                     handle ../ in paths (includes --relink)\n"
     "  -R, --rule=CMD     modify rules\n"
     "  --wipe             remove all packages, keep rules/settings\n"
     "  --touch            write out the db even without modifications\n"
+    "  --batch=FILE       run the command lines in FILE (- for stdin) on\n"
+    "                     the db, storing it once at the end\n"
     );
   fprintf(out,
     "db query options:\n"
@@ -116,7 +138,18 @@ static void help [[noreturn]] (int x) {
     "  -n, --rename=NAME  rename the database\n"
     "  --integrity        perform a dependency integrity check\n"
     "  -f, --filter=FILT  filter the queried packages\n"
+    "  --explain-filters  show the order in which filters are evaluated\n"
     "  --ls               list all package files\n"
+    "  --owns=PATH        show the packages containing a file\n"
+    "  --impact           show what breaks when removing the packages or\n"
+    "                     objects (by path) given as parameters\n"
+    "  --mem-stats        show the memory held by the db by category\n"
+    );
+  fprintf(out,
+    "server options:\n"
+    "  --serve=SOCKET     keep the db loaded and answer requests on SOCKET\n"
+    "  --connect=SOCKET   send the remaining options to a server\n"
+    "                     (has to be the first option)\n"
     );
   fprintf(out,
     "db query filters:\n"
@@ -125,7 +158,7 @@ static void help [[noreturn]] (int x) {
     "                     have been applied\n"
     );
   fprintf(out,
-    "db library path options: (run --relink after these changes)\n"
+    "db library path options: (affected objects are relinked)\n"
     "  --ld-prepend=DIR   add or move a directory to the\n"
     "                     top of the trusted library path\n"
     "  --ld-append=DIR    add or move a directory to the\n"
@@ -195,19 +228,87 @@ class ArgArg {
   }
 };
 
-static bool parse_rule(DB *db, const string& rule);
+static bool parse_rule(DB *db, const string& rule, bool *changed);
+static void explain_filters(const FilterList&,
+                            const ObjFilterList&,
+                            const StrFilterList&);
 static bool parse_filter(const string &filter,
                          FilterList&,
                          ObjFilterList&,
                          StrFilterList&);
 
+// A database loaded once for multiple command lines: the requests of
+// --serve or the commands of a --batch.
+struct Session {
+  DB     *db_;
+  string  dbfile_;
+  bool    batch_;
+  // batch only: to be stored at the end
+  bool    modified_ = false;
+  // batch only: relink everything before the next query or the end
+  bool    relink_   = false;
+
+  Session(DB *db, const string& dbfile, bool batch)
+  : db_(db), dbfile_(dbfile), batch_(batch)
+  {}
+};
+
+static int run(int argc, char **argv, Config&, Session *session);
+static int run_batch(const string &file, Config&, Session &batch);
+
 int main(int argc, char **argv) {
   arg0 = argv[0];
 
   if (argc < 2)
     help(1);
 
+  // a client only passes its arguments on, the server parses them
+  if (strncmp(argv[1], "--connect", 9) == 0) {
+    int skip;
+    string socket;
+    if (argv[1][9] == '=') {
+      skip = 1;
+      socket = argv[1] + 10;
+    } else if (argv[1][9] == 0 && argc > 2) {
+      skip = 2;
+      socket = argv[2];
+    } else
+      help(1);
+    argv[skip] = argv[0];
+    return serve::Connect(socket, argc-skip, argv+skip);
+  }
+
+  Config config;
+  config.log_level_ = LogLevel::Message;
+
+  if (!config.ReadConfig())
+    return 1;
+
+  int ret = run(argc, argv, config, nullptr);
+  if (config.stats_)
+    stats::Print(config, stderr);
+  if (config.trace_ && !stats::WriteTrace(config, trace_file))
+    ret = 1;
+  return ret;
+}
+
+static void reset_getopt() {
+#if defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__) || \
+    defined(__DragonFly__) || defined(__APPLE__)
+  optreset = 1;
+  optind = 1;
+#else
+  optind = 0;
+#endif
+}
+
+// Run the command line against the database it selects, or against the
+// session's already loaded one.
+static int run(int argc, char **argv, Config &config, Session *session)
+{
   string dbfile,
+         serve_socket,
+         batch_file,
          newname;
   bool   do_install    = false;
   bool   do_delete     = false;
@@ -215,6 +316,7 @@ int main(int argc, char **argv) {
   bool   do_wipefiles  = false;
   bool   has_db        = false;
   bool   modified      = false;
+  bool   failed        = false;
   bool   show_info     = false;
   bool   show_list     = false;
   bool   show_missing  = false;
@@ -228,6 +330,11 @@ int main(int argc, char **argv) {
   bool   filter_broken = false;
   bool   filter_nempty = false;
   bool   do_integrity  = false;
+  bool   do_explain    = false;
+  bool   show_impact   = false;
+  bool   show_preview  = false;
+  bool   show_memory   = false;
+  StringList owned_paths;
 
   bool   oldmode       = true;
 
@@ -243,11 +350,8 @@ int main(int argc, char **argv) {
   ObjFilterList obj_filters;
   StrFilterList str_filters;
 
-  Config config;
-  config.log_level_ = LogLevel::Message;
-
-  if (!config.ReadConfig())
-    return 1;
+  if (session)
+    reset_getopt();
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wunreachable-code"
   for (;;) {
@@ -266,7 +370,24 @@ int main(int argc, char **argv) {
       case 'q':
         config.quiet_ = true;
         break;
+      case -1024-'s':
+        config.stats_ = true;
+        break;
+      case -1024-'t':
+        // the server would write the file with its own privileges
+        if (session && !session->batch_) {
+          fprintf(stderr, "--trace cannot be used with --connect\n");
+          return 1;
+        }
+        config.trace_ = true;
+        trace_file = optarg;
+        break;
       case 'd':
+        if (session) {
+          fprintf(stderr, "--db cannot be used with --connect or "
+                          "in a --batch\n");
+          return 1;
+        }
         oldmode = false;
         has_db = true;
         dbfile = optarg;
@@ -278,7 +399,15 @@ int main(int argc, char **argv) {
         newname = optarg;
         break;
 
-      case -'d': dryrun = true; break;
+      case -'d':
+        // the commands share one database, --dry has to cover all of them
+        if (session && session->batch_) {
+          fprintf(stderr, "--dry cannot be used in a --batch, pass it along "
+                          "with --batch instead\n");
+          return 1;
+        }
+        dryrun = true;
+        break;
 
       case 'v': ++config.verbosity_; break;
 
@@ -300,6 +429,32 @@ int main(int argc, char **argv) {
       case -'G': oldmode = false; do_integrity = true; break;
 
       case -1024-'T': oldmode = false; modified = true; break;
+      case -1024-'X': oldmode = false; do_explain = true; break;
+      case -1024-'M': oldmode = false; show_impact = true; break;
+      case -1024-'V': oldmode = false; show_preview = true; break;
+      case -1024-'m': oldmode = false; show_memory  = true; break;
+
+      case -1024-'S':
+        if (session) {
+          fprintf(stderr, "--serve cannot be used with --connect or "
+                          "in a --batch\n");
+          return 1;
+        }
+        oldmode = false;
+        serve_socket = optarg;
+        break;
+      case -1024-'B':
+        if (session) {
+          fprintf(stderr, "--batch cannot be used with --connect or "
+                          "in a --batch\n");
+          return 1;
+        }
+        oldmode = false;
+        batch_file = optarg;
+        break;
+      case -1024-'C':
+        fprintf(stderr, "--connect has to be the first option\n");
+        return 1;
 
       case -1024-'D':
         config.package_depends_ = Config::str2bool(optarg);
@@ -322,6 +477,10 @@ int main(int argc, char **argv) {
         oldmode = false;
         do_wipefiles = true;
         break;
+      case -1028-'f':
+        oldmode = false;
+        owned_paths.emplace_back(optarg);
+        break;
 
       case  'R': rulemod    = optarg; break;
       case -'A': ld_append  = optarg; break;
@@ -381,6 +540,12 @@ int main(int argc, char **argv) {
   if (config.quiet_)
     config.log_level_ = LogLevel::Print;
 
+  filter::Compile(pkg_filters);
+  filter::Compile(obj_filters);
+  filter::Compile(str_filters);
+  if (do_explain)
+    explain_filters(pkg_filters, obj_filters, str_filters);
+
   if (do_fixpaths)
     do_relink = true;
 
@@ -394,11 +559,57 @@ int main(int argc, char **argv) {
     help(1);
   }
 
+  if (show_impact && (do_install || do_delete)) {
+    fprintf(stderr, "--impact cannot be combined with --install/--remove\n");
+    help(1);
+  }
+
+  if (show_impact && optind >= argc) {
+    fprintf(stderr, "--impact requires a list of package names or "
+                    "object paths\n");
+    help(1);
+  }
+
+  if (show_preview && !do_install) {
+    fprintf(stderr, "--preview requires --install\n");
+    help(1);
+  }
+
   if (do_install && optind >= argc) {
     fprintf(stderr, "--install requires a list of package archive files\n");
     help(1);
   }
 
+  bool writes = !dryrun &&
+    (modified || do_rename || rulemod || ld_append || ld_prepend ||
+     ld_delete || !ld_insert.empty() || ld_clear || do_wipe ||
+     do_relink || (do_install && !show_preview) || do_delete ||
+     do_wipefiles);
+
+  bool queries = show_info || show_packages || show_list || show_missing ||
+                 show_found || show_filelist || !owned_paths.empty() ||
+                 show_impact || show_preview || do_integrity ||
+                 show_memory;
+
+  if ((serve_socket.length() || batch_file.length()) &&
+      (writes || queries || optind < argc))
+  {
+    fprintf(stderr, "--serve and --batch cannot be combined with other "
+                    "actions\n");
+    help(1);
+  }
+  if (serve_socket.length() && batch_file.length()) {
+    fprintf(stderr, "--serve and --batch are mutually exclusive\n");
+    help(1);
+  }
+
+  if (session) {
+    serve::Started(writes);
+    oldmode = false;
+    has_db  = true;
+    dbfile  = session->dbfile_;
+  }
+
   vec<Package*> packages;
 
   if (oldmode) {
@@ -425,6 +636,12 @@ int main(int argc, char **argv) {
     return 0;
   }
 
+  StringList impact_names;
+  if (show_impact) {
+    while (optind < argc)
+      impact_names.emplace_back(argv[optind++]);
+  }
+
   if (!do_delete && optind < argc) {
     if (do_install)
       config.Log(Message, "loading packages...\n");
@@ -433,8 +650,10 @@ int main(int argc, char **argv) {
       if (do_install)
         config.Log(Print, "  %s\n", argv[optind]);
       Package *package = Package::Open(argv[optind], config);
-      if (!package)
+      if (!package) {
         config.Log(Error, "error reading package %s\n", argv[optind]);
+        failed = true;
+      }
       else {
         if (do_install)
           packages.push_back(package);
@@ -450,22 +669,70 @@ int main(int argc, char **argv) {
       config.Log(Message, "packages loaded...\n");
   }
 
-  uniq<DB> db(new DB(config));
-  if (has_db) {
+  // a batch must not go on with a part of the packages
+  if (failed && session && session->batch_) {
+    for (auto pkg : packages)
+      delete pkg;
+    return 1;
+  }
+
+  uniq<DB> owned;
+  DB *db = session ? session->db_ : nullptr;
+  if (!db) {
+    owned.reset(new DB(config));
+    db = owned.get();
     if (!db->Load(dbfile)) {
       config.Log(Error, "failed to read database\n");
       return 1;
     }
   }
 
+  if (serve_socket.length()) {
+    // requests run in the clients' working directories
+    if (dbfile[0] != '/') {
+      char cwd[PATH_MAX];
+      if (!getcwd(cwd, sizeof(cwd))) {
+        config.Log(Error, "failed to get the working directory\n");
+        return 1;
+      }
+      dbfile = string(cwd) + "/" + dbfile;
+    }
+    return serve::Serve(serve_socket, dbfile, owned, config,
+      [&config,&dbfile](int argc, char **argv, DB *db) {
+        Session request(db, dbfile, false);
+        // report only the request's own work
+        stats::Reset(config);
+        int ret = run(argc, argv, config, &request);
+        if (config.stats_)
+          stats::Print(config, stderr);
+        if (config.trace_ && !stats::WriteTrace(config, trace_file))
+          ret = 1;
+        return ret;
+      });
+  }
+
+  if (batch_file.length()) {
+    Session batch(db, dbfile, true);
+    if (int ret = run_batch(batch_file, config, batch))
+      return ret;
+    modified  = batch.modified_;
+    do_relink = batch.relink_;
+  }
+
   if (do_rename) {
     modified = true;
     db->name_ = newname;
   }
 
   if (rulemod) {
-    for (auto &rule : rulemod.arg_)
-      modified = parse_rule(db.get(), rule) || modified;
+    for (auto &rule : rulemod.arg_) {
+      bool changed = false;
+      if (!parse_rule(db, rule, &changed))
+        failed = true;
+      modified = changed || modified;
+    }
+    if (failed && session && session->batch_)
+      return 1;
   }
 
   if (ld_append) {
@@ -496,35 +763,49 @@ int main(int argc, char **argv) {
     db->FixPaths();
   }
 
-  if (do_install && packages.size()) {
+  if (do_install && !show_preview && packages.size()) {
     config.Log(Message, "installing packages\n");
     for (auto pkg : packages) {
       modified = true;
       if (!db->InstallPackage(move(pkg))) {
         printf("failed to commit package %s to database\n",
                pkg->name_.c_str());
+        failed = true;
         break;
       }
     }
+    if (failed && session && session->batch_)
+      return 1;
   }
 
   if (do_delete) {
+    StringList names;
     while (optind < argc) {
       config.Log(Message, "uninstalling: %s\n", argv[optind]);
-      modified = true;
-      if (!db->DeletePackage(argv[optind])) {
-        config.Log(Error, "error uninstalling package: %s\n", argv[optind]);
-        return 1;
-      }
+      names.emplace_back(argv[optind]);
       ++optind;
     }
+    if (!names.empty()) {
+      modified = true;
+      db->DeletePackages(names);
+    }
   }
 
-  if (do_relink) {
+  // a batch relinks only once, before it is needed
+  if (do_relink && session && session->batch_) {
+    modified = true;
+    session->relink_ = true;
+  }
+  else if (do_relink) {
     modified = true;
     config.Log(Message, "relinking everything\n");
     db->RelinkAll();
   }
+  if (queries && session && session->relink_) {
+    config.Log(Message, "relinking everything\n");
+    db->RelinkAll();
+    session->relink_ = false;
+  }
 
   if (do_wipefiles)
     modified = db->WipeFilelists();
@@ -547,12 +828,40 @@ int main(int argc, char **argv) {
   if (show_filelist)
     db->ShowFilelist(pkg_filters, str_filters);
 
-  if (do_integrity)
-    db->CheckIntegrity(pkg_filters, obj_filters);
+  if (!owned_paths.empty())
+    db->ShowOwners(owned_paths, pkg_filters);
+
+  if (show_impact)
+    db->ShowImpact(impact_names);
+
+  if (show_preview) {
+    db->ShowPreview(vec<const Package*>(packages.begin(), packages.end()));
+    for (auto pkg : packages)
+      delete pkg;
+  }
+
+  // The check results are cached in the database. Storing them must not
+  // make a query fail on a read-only database, and a --serve request only
+  // updates them when it holds the database for writing anyway.
+  if (do_integrity) {
+    bool update_cache = !dryrun &&
+                        (!session || session->batch_ || writes) &&
+                        access(dbfile.c_str(), W_OK) == 0;
+    if (db->CheckIntegrity(pkg_filters, obj_filters, update_cache))
+      modified = true;
+  }
+
+  if (show_memory)
+    db->ShowMemory();
+
+  if (session && session->batch_) {
+    session->modified_ = session->modified_ || (modified && !dryrun);
+    return 0;
+  }
 
   if (!dryrun && modified && has_db) {
     if (config.json_ & JSONBits::DB)
-      db_store_json(db.get(), dbfile);
+      db_store_json(db, dbfile);
     else if (!db->Store(dbfile))
       config.Log(Error, "failed to write to the database\n");
   }
@@ -560,10 +869,105 @@ int main(int argc, char **argv) {
   return 0;
 }
 
+// the settings a command line can change, reset for every batch command
+static void copy_settings(Config &to, const Config &from) {
+  to.verbosity_        = from.verbosity_;
+  to.quiet_            = from.quiet_;
+  to.package_depends_  = from.package_depends_;
+  to.package_filelist_ = from.package_filelist_;
+  to.package_info_     = from.package_info_;
+  to.json_             = from.json_;
+  to.max_jobs_         = from.max_jobs_;
+  to.log_level_        = from.log_level_;
+}
+
+// split a batch line into words like a shell would, without expansions:
+// quotes group words, a backslash escapes the next character outside of
+// single quotes and # starts a comment
+static bool split_command(const char *line, StringList &words) {
+  string word;
+  bool   in_word = false;
+  for (const char *at = line; *at; ++at) {
+    char c = *at;
+    if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+      if (in_word)
+        words.emplace_back(move(word));
+      word.clear();
+      in_word = false;
+      continue;
+    }
+    if (c == '#' && !in_word)
+      break;
+    in_word = true;
+    if (c == '\\') {
+      if (at[1])
+        word.push_back(*++at);
+    }
+    else if (c == '\'' || c == '"') {
+      const char quote = c;
+      for (++at; *at != quote; ++at) {
+        if (!*at)
+          return false;
+        if (quote == '"' && *at == '\\' && at[1])
+          ++at;
+        word.push_back(*at);
+      }
+    }
+    else
+      word.push_back(c);
+  }
+  if (in_word)
+    words.emplace_back(move(word));
+  return true;
+}
+
+static int run_batch(const string &file, Config &config, Session &batch) {
+  FILE *in = file == "-" ? stdin : fopen(file.c_str(), "r");
+  if (!in) {
+    config.Log(Error, "failed to open %s\n", file.c_str());
+    return 1;
+  }
+
+  Config settings;
+  copy_settings(settings, config);
+
+  int           ret    = 0;
+  char         *line   = nullptr;
+  size_t        cap    = 0;
+  unsigned long lineno = 0;
+  while (getline(&line, &cap, in) != -1) {
+    ++lineno;
+    StringList words;
+    words.emplace_back(arg0);
+    if (!split_command(line, words)) {
+      config.Log(Error, "%s:%lu: unterminated quote\n", file.c_str(), lineno);
+      ret = 1;
+      break;
+    }
+    if (words.size() == 1)
+      continue;
+    vec<char*> argv;
+    for (auto &w : words)
+      argv.push_back(&w[0]);
+    argv.push_back(nullptr);
+    ret = run(int(words.size()), argv.data(), config, &batch);
+    copy_settings(config, settings);
+    if (ret) {
+      config.Log(Error, "%s:%lu: command failed\n", file.c_str(), lineno);
+      break;
+    }
+  }
+  free(line);
+  if (in != stdin)
+    fclose(in);
+  return ret;
+}
+
 static bool try_rule(const string                 &rule,
                      const string                 &what,
                      const char                   *usage,
                      bool                         *ret,
+                     bool                         *bad,
                      function<bool(const string&)> fn)
 {
   if (rule.compare(0, what.length(), what) == 0) {
@@ -571,6 +975,7 @@ static bool try_rule(const string                 &rule,
       fprintf(stderr, "malformed rule: `%s`\n", rule.c_str());
       fprintf(stderr, "format: %s%s\n", what.c_str(), usage);
       *ret = false;
+      *bad = true;
       return true;
     }
     *ret = fn(rule.substr(what.length()));
@@ -579,47 +984,49 @@ static bool try_rule(const string                 &rule,
   return false;
 }
 
-static bool parse_rule(DB *db, const string& rule) {
+// returns false if the rule is malformed, *changed tells whether it
+// modified the database
+static bool parse_rule(DB *db, const string& rule, bool *changed) {
   bool ret = false;
+  bool bad = false;
 
-  if (try_rule(rule, "ignore:", "FILENAME", &ret,
+  if (try_rule(rule, "ignore:", "FILENAME", &ret, &bad,
     [db](const string &cmd) {
       return db->IgnoreFile_Add(cmd);
     })
-    || try_rule(rule, "strict:", "BOOL", &ret,
+    || try_rule(rule, "strict:", "BOOL", &ret, &bad,
     [db](const string &cmd) {
-      bool old = db->strict_linking_;
-      db->strict_linking_ = Config::str2bool(cmd);
-      return old == db->strict_linking_;
+      return db->SetStrictLinking(Config::str2bool(cmd));
     })
-    || try_rule(rule, "unignore:", "FILENAME", &ret,
+    || try_rule(rule, "unignore:", "FILENAME", &ret, &bad,
     [db](const string &cmd) {
       return db->IgnoreFile_Delete(cmd);
     })
-    || try_rule(rule, "unignore-id:", "ID", &ret,
+    || try_rule(rule, "unignore-id:", "ID", &ret, &bad,
     [db](const string &cmd) {
       return db->IgnoreFile_Delete(strtoul(cmd.c_str(), nullptr, 0));
     })
-    || try_rule(rule, "assume-found:", "LIBNAME", &ret,
+    || try_rule(rule, "assume-found:", "LIBNAME", &ret, &bad,
     [db](const string &cmd) {
       return db->AssumeFound_Add(cmd);
     })
-    || try_rule(rule, "unassume-found:", "LIBNAME", &ret,
+    || try_rule(rule, "unassume-found:", "LIBNAME", &ret, &bad,
     [db](const string &cmd) {
       return db->AssumeFound_Delete(cmd);
     })
-    || try_rule(rule, "unassume-found:", "ID", &ret,
+    || try_rule(rule, "unassume-found:", "ID", &ret, &bad,
     [db](const string &cmd) {
       return db->AssumeFound_Delete(strtoul(cmd.c_str(), nullptr, 0));
     })
-    || try_rule(rule, "pkg-ld-clear:", "PKG", &ret,
+    || try_rule(rule, "pkg-ld-clear:", "PKG", &ret, &bad,
     [db,&rule](const string &cmd) {
       return db->PKG_LD_Clear(cmd);
     })
-    || try_rule(rule, "pkg-ld-append:", "PKG:PATH", &ret,
-    [db,&rule](const string &cmd) {
+    || try_rule(rule, "pkg-ld-append:", "PKG:PATH", &ret, &bad,
+    [db,&rule,&bad](const string &cmd) {
       size_t s = cmd.find_first_of(':');
       if (s == string::npos) {
+        bad = true;
         fprintf(stderr, "malformed rule: `%s`\n", rule.c_str());
         fprintf(stderr, "format: pkg-ld-append:PKG:PATH\n");
         return false;
@@ -628,18 +1035,19 @@ static bool parse_rule(DB *db, const string& rule) {
       StringList &lst(db->package_library_path_[pkg]);
       return db->PKG_LD_Insert(pkg, cmd.substr(s+1), lst.size());
     })
-    || try_rule(rule, "pkg-ld-prepend:", "PKG:PATH", &ret,
-    [db,&rule](const string &cmd) {
+    || try_rule(rule, "pkg-ld-prepend:", "PKG:PATH", &ret, &bad,
+    [db,&rule,&bad](const string &cmd) {
       size_t s = cmd.find_first_of(':');
       if (s == string::npos) {
+        bad = true;
         fprintf(stderr, "malformed rule: `%s`\n", rule.c_str());
         fprintf(stderr, "format: pkg-ld-prepend:PKG:PATH\n");
         return false;
       }
       return db->PKG_LD_Insert(cmd.substr(0, s), cmd.substr(s+1), 0);
     })
-    || try_rule(rule, "pkg-ld-insert:", "PKG:ID:PATH", &ret,
-    [db,&rule](const string &cmd) {
+    || try_rule(rule, "pkg-ld-insert:", "PKG:ID:PATH", &ret, &bad,
+    [db,&rule,&bad](const string &cmd) {
       size_t s1, s2 = 0;
       s1 = cmd.find_first_of(':');
       if (s1 != string::npos)
@@ -647,6 +1055,7 @@ static bool parse_rule(DB *db, const string& rule) {
       if (s1 == string::npos ||
           s2 == string::npos)
       {
+        bad = true;
         fprintf(stderr, "malformed rule: `%s`\n", rule.c_str());
         fprintf(stderr, "format: pkg-ld-insert:PKG:ID:PATH\n");
         return false;
@@ -656,20 +1065,22 @@ static bool parse_rule(DB *db, const string& rule) {
                                strtoul(cmd.substr(s1, s2-s1).c_str(),
                                        nullptr, 0));
     })
-    || try_rule(rule, "pkg-ld-delete:", "PKG:PATH", &ret,
-    [db,&rule](const string &cmd) {
+    || try_rule(rule, "pkg-ld-delete:", "PKG:PATH", &ret, &bad,
+    [db,&rule,&bad](const string &cmd) {
       size_t s = cmd.find_first_of(':');
       if (s == string::npos) {
+        bad = true;
         fprintf(stderr, "malformed rule: `%s`\n", rule.c_str());
         fprintf(stderr, "format: pkg-ld-delete:PKG:PATH\n");
         return false;
       }
       return db->PKG_LD_Delete(cmd.substr(0, s), cmd.substr(s+1));
     })
-    || try_rule(rule, "pkg-ld-delete-id:", "PKG:ID", &ret,
-    [db,&rule](const string &cmd) {
+    || try_rule(rule, "pkg-ld-delete-id:", "PKG:ID", &ret, &bad,
+    [db,&rule,&bad](const string &cmd) {
       size_t s = cmd.find_first_of(':');
       if (s == string::npos) {
+        bad = true;
         fprintf(stderr, "malformed rule: `%s`\n", rule.c_str());
         fprintf(stderr, "format: pkg-ld-delete-id:PKG:ID\n");
         return false;
@@ -677,25 +1088,50 @@ static bool parse_rule(DB *db, const string& rule) {
       return db->PKG_LD_Delete(cmd.substr(0, s),
                                strtoul(cmd.substr(s+1).c_str(), nullptr, 0));
     })
-    || try_rule(rule, "base-add:", "PKG", &ret,
+    || try_rule(rule, "base-add:", "PKG", &ret, &bad,
     [db,&rule](const string &cmd) {
       return db->BasePackages_Add(cmd);
     })
-    || try_rule(rule, "base-remove:", "PKG", &ret,
+    || try_rule(rule, "base-remove:", "PKG", &ret, &bad,
     [db,&rule](const string &cmd) {
       return db->BasePackages_Delete(cmd);
     })
-    || try_rule(rule, "base-remove-id:", "ID", &ret,
+    || try_rule(rule, "base-remove-id:", "ID", &ret, &bad,
     [db,&rule](const string &cmd) {
       return db->BasePackages_Delete(strtoul(cmd.c_str(), nullptr, 0));
     })
   ) {
-    return ret;
+    *changed = ret;
+    return !bad;
   }
   fprintf(stderr, "no such rule command: `%s'\n", rule.c_str());
   return false;
 }
 
+template<typename List>
+static void explain_filterlist(const char *what, const List &list) {
+  if (list.empty())
+    return;
+  printf("%s filters:\n", what);
+  size_t n = 0;
+  for (auto &f : list)
+    printf("  %lu. [cost %u] %s\n", (unsigned long)++n, f->Cost(),
+           f->Describe().c_str());
+}
+
+static void explain_filters(const FilterList    &pkg_filters,
+                            const ObjFilterList &obj_filters,
+                            const StrFilterList &str_filters)
+{
+  if (pkg_filters.empty() && obj_filters.empty() && str_filters.empty()) {
+    printf("no filters\n");
+    return;
+  }
+  explain_filterlist("package", pkg_filters);
+  explain_filterlist("object",  obj_filters);
+  explain_filterlist("file",    str_filters);
+}
+
 static bool parse_filter(const string  &filter,
                          FilterList    &pkg_filters,
                          ObjFilterList &obj_filters,
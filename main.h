@@ -24,6 +24,8 @@ using Depend     = tuple<string,string>;
 using DependList = vec<Depend>;
 
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
 
 #include <set>
 using StringSet  = std::set<string>;
@@ -31,10 +33,17 @@ using StringSet  = std::set<string>;
 #include <functional>
 using std::function;
 
+#include <atomic>
+#include <chrono>
+
 #include "util.h"
 
 #include "config.h"
 
+#ifdef PKGDEPDB_ENABLE_THREADS
+#  include <mutex>
+#endif
+
 namespace pkgdepdb {
 
 typedef unsigned int uint;
@@ -71,6 +80,10 @@ using FilterList    = vec<uniq<filter::PackageFilter>>;
 using ObjFilterList = vec<uniq<filter::ObjectFilter>>;
 using StrFilterList = vec<uniq<filter::StringFilter>>;
 
+namespace stats {
+struct Totals;
+} // ::pkgdepdb::stats
+
 namespace JSONBits {
   // NOTE: Keep in sync with pkgdepdb.h's PKGDEPDB_JSON_BITS
   static const unsigned int
@@ -93,6 +106,12 @@ struct Config {
   uint   json_             = 0;
   uint   max_jobs_         = 0;
   uint   log_level_        = LogLevel::Message;
+  // collect the timings and counters of stats.h
+  bool   stats_            = false;
+  // record the spans of stats.h for a trace
+  bool   trace_            = false;
+
+  uniq<stats::Totals> stats_totals_;
 
   Config();
   Config(Config&&) = delete;
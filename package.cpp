@@ -6,9 +6,12 @@
 #include "main.h"
 #include "elf.h"
 #include "package.h"
+#include "stats.h"
 
 namespace pkgdepdb {
 
+unsigned long Package::renames_ = 0;
+
 static bool care_about(struct archive_entry *entry, mode_t mode) {
 #if 0
   if (AE_IFLNK == (mode & AE_IFLNK)) {
@@ -66,6 +69,7 @@ static bool read_info(Package *pkg, struct archive *tar, const size_t size,
     optconfig.Log(Error, "failed to read .PKGINFO");
     return false;
   }
+  stats::Count(optconfig, stats::BytesRead, size);
 
   string str(&data[0], data.size());
 
@@ -291,6 +295,7 @@ static bool read_object(Package         *pkg,
     optconfig.Log(Error, "file was short: %s\n", filename.c_str());
     return false;
   }
+  stats::Count(optconfig, stats::BytesRead, size);
 
   bool err = false;
   rptr<Elf> object(Elf::Open(&data[0], data.size(), &err, filename.c_str(),
@@ -446,6 +451,8 @@ void Package::Guess(const string& path) {
 }
 
 Package* Package::Open(const string& path, const Config& optconfig) {
+  stats::Timer timer(optconfig, stats::Open);
+  stats::Span  span (optconfig, "open", path);
   uniq<Package> package(new Package);
 
   struct archive *tar = archive_read_new();
@@ -30,10 +30,16 @@ struct Package {
                           info_; // generic info - everything not caught above
 
 // non-serialized {
+  // number of objects missing a library, maintained by the DB the
+  // package is installed into
+  size_t                  broken_objects_ = 0;
   // used only while loading an archive
   struct {
     std::map<string, string> symlinks;
   } load_;
+  // counts the renames of named packages so a DB can tell when its
+  // package index went stale
+  static unsigned long renames_;
 // }
 
   static Package* Open(const string& path, const Config&);
@@ -143,6 +143,13 @@ unsigned int     pkgdepdb_cfg_log_level    (pkgdepdb_cfg*);
 /** set the current log level. \sa PKGDEPDB_CFG_LOG_LEVEL  */
 void             pkgdepdb_cfg_set_log_level(pkgdepdb_cfg*, unsigned int);
 
+/** Check whether timings and counters are being collected.
+ * \sa pkgdepdb_db_stats()
+ */
+pkgdepdb_bool    pkgdepdb_cfg_stats    (pkgdepdb_cfg*);
+/** Enable or disable collecting timings and counters. */
+void             pkgdepdb_cfg_set_stats(pkgdepdb_cfg*, pkgdepdb_bool);
+
 /* json - this part of the interface should not usually be required... */
 /** used only by the commandline tool */
 #define PKGDEPDB_JSONBITS_QUERY (1<<0)
@@ -168,6 +175,21 @@ void             pkgdepdb_cfg_set_json(pkgdepdb_cfg*, unsigned int);
 pkgdepdb_db  *pkgdepdb_db_new   (pkgdepdb_cfg *cfg);
 /** Delete a database instance. */
 void          pkgdepdb_db_delete(pkgdepdb_db*);
+/**
+ * Create a copy-on-write snapshot of a database, which shares the packages
+ * and objects with it until installing or deleting packages or relinking
+ * in the snapshot modifies them. Use it to try out changes without copying
+ * the whole database. Several snapshots of the same database can be used
+ * in parallel from different threads.
+ * \param db the base database, which must not be modified or deleted while
+ *           the snapshot exists.
+ * \returns a new database instance to be deleted with pkgdepdb_db_delete().
+ *          Packages and objects taken from it may be shared with the base
+ *          and must not be modified, only packages installed into the
+ *          snapshot can be removed from it with pkgdepdb_db_package_remove_p()
+ *          or pkgdepdb_db_package_remove_i().
+ */
+pkgdepdb_db  *pkgdepdb_db_snapshot(pkgdepdb_db *db);
 /** Read a database from disk.
  * \param db the database instance.
  * \param filename path to the database file to read.
@@ -186,6 +208,73 @@ pkgdepdb_bool pkgdepdb_db_store (pkgdepdb_db *db, const char *filename);
  */
 unsigned int  pkgdepdb_db_loaded_version(pkgdepdb_db*);
 
+/** The timed phases, indexes into pkgdepdb_stats' phase arrays. */
+enum PKGDEPDB_STATS_PHASE {
+  PKGDEPDB_STATS_OPEN,      /**< reading package archives */
+  PKGDEPDB_STATS_INSTALL,   /**< installing packages into a database */
+  PKGDEPDB_STATS_RELINK,    /**< relinking all objects */
+  PKGDEPDB_STATS_INTEGRITY, /**< the integrity check */
+  PKGDEPDB_STATS_LOAD,      /**< reading a database file */
+  PKGDEPDB_STATS_STORE,     /**< writing a database file */
+  PKGDEPDB_STATS_PHASES
+};
+
+/** Timings and counters, see pkgdepdb_db_stats(). */
+typedef struct pkgdepdb_stats {
+  unsigned long long phase_ns   [PKGDEPDB_STATS_PHASES];
+  unsigned long long phase_calls[PKGDEPDB_STATS_PHASES];
+  unsigned long long objects_linked;
+  unsigned long long lookups;       /**< libraries searched for */
+  unsigned long long cache_hits;    /**< lookups answered by the cache */
+  unsigned long long candidates;    /**< objects compared while searching */
+  unsigned long long elf_finds;     /**< search path checks */
+  unsigned long long bytes_read;
+  unsigned long long bytes_written;
+  unsigned long long peak_rss;      /**< peak process memory in kilobytes */
+} pkgdepdb_stats;
+
+/** Retrieve the timings and counters collected while the database's
+ * configuration had pkgdepdb_cfg_stats() enabled. They are kept by the
+ * configuration, so they include the work of all databases sharing it.
+ * \param db the database instance.
+ * \param out the structure to fill.
+ */
+void          pkgdepdb_db_stats      (pkgdepdb_db *db, pkgdepdb_stats *out);
+/** Reset the counters retrieved by pkgdepdb_db_stats() to zero. */
+void          pkgdepdb_db_stats_reset(pkgdepdb_db*);
+
+/** The categories of pkgdepdb_memory's arrays. */
+enum PKGDEPDB_MEMORY_CATEGORY {
+  PKGDEPDB_MEMORY_PACKAGES,  /**< package records, names and object lists */
+  PKGDEPDB_MEMORY_DEPENDS,   /**< dependency and provides lists */
+  PKGDEPDB_MEMORY_GROUPS,
+  PKGDEPDB_MEMORY_FILELISTS,
+  PKGDEPDB_MEMORY_INFO,      /**< the remaining PKGINFO entries */
+  PKGDEPDB_MEMORY_OBJECTS,   /**< object records, paths and needed lists */
+  PKGDEPDB_MEMORY_LINKS,     /**< the found libraries of objects */
+  PKGDEPDB_MEMORY_MISSING,   /**< the missing libraries of objects */
+  PKGDEPDB_MEMORY_RULES,     /**< library paths and rules */
+  PKGDEPDB_MEMORY_INTEGRITY, /**< the integrity check cache */
+  PKGDEPDB_MEMORY_TABLES,    /**< the package and object lists */
+  PKGDEPDB_MEMORY_INDEXES,   /**< the lookup caches and indexes */
+  PKGDEPDB_MEMORY_CATEGORIES
+};
+
+/** Heap memory held by a database, see pkgdepdb_db_memory(). */
+typedef struct pkgdepdb_memory {
+  unsigned long long bytes      [PKGDEPDB_MEMORY_CATEGORIES];
+  unsigned long long allocations[PKGDEPDB_MEMORY_CATEGORIES];
+  unsigned long long peak_rss;  /**< peak process memory in kilobytes */
+} pkgdepdb_memory;
+
+/** Add up the heap memory held by a database by category. The node sizes
+ * of containers are estimates. A snapshot includes what it shares with the
+ * database it was taken of.
+ * \param db the database instance.
+ * \param out the structure to fill.
+ */
+void          pkgdepdb_db_memory(pkgdepdb_db *db, pkgdepdb_memory *out);
+
 /** Return whether database queries should assume strict link mode.
  * \sa pkgdepdb_set_strict_linking().
  */
@@ -288,6 +377,13 @@ pkgdepdb_bool pkgdepdb_db_package_delete_p(pkgdepdb_db*, pkgdepdb_pkg*);
 /** Delete and destroy an installed package by name. All remaining references
  * to the package are invalidated. */
 pkgdepdb_bool pkgdepdb_db_package_delete_s(pkgdepdb_db*, const char*);
+/** Delete and destroy multiple installed packages by name. Links are only
+ * repaired once for all of them, which is a lot faster than deleting them
+ * one by one. All remaining references to the packages are invalidated.
+ * \returns the number of packages which were deleted.
+ */
+size_t        pkgdepdb_db_package_delete_s_r(pkgdepdb_db*, size_t count,
+                                             const char **names);
 /** Delete and destroy an installed package by index. All remaining references
  * to the package are invalidated. */
 pkgdepdb_bool pkgdepdb_db_package_delete_i(pkgdepdb_db*, size_t);
@@ -302,6 +398,21 @@ pkgdepdb_bool pkgdepdb_db_package_remove_p(pkgdepdb_db*, pkgdepdb_pkg*);
  */
 pkgdepdb_bool pkgdepdb_db_package_remove_i(pkgdepdb_db*, size_t);
 
+/** Find the installed packages whose file list contains a file.
+ * The lookup uses an index which is built on first use and dropped when
+ * packages are installed or deleted. It remembers files by their position
+ * in a package's file list, so after changing the file list of an already
+ * installed package, files added or moved by the change may be missed
+ * until the next installation or deletion rebuilds the index.
+ * \param db the database instance.
+ * \param path the file, with or without a leading slash.
+ * \param out the output array that will be filled.
+ * \param count the size of the output array, may be 0.
+ * \returns the number of owning packages, which may exceed count.
+ */
+size_t        pkgdepdb_db_package_owners  (pkgdepdb_db *db, const char *path,
+                                           pkgdepdb_pkg **out, size_t count);
+
 /** Check whether an installed package has to be considered broken in the
  * database.
  * Currently this means that the package contains an ELF file which fails to
@@ -310,6 +421,16 @@ pkgdepdb_bool pkgdepdb_db_package_remove_i(pkgdepdb_db*, size_t);
  */
 pkgdepdb_bool pkgdepdb_db_package_is_broken(pkgdepdb_db*, pkgdepdb_pkg*);
 
+/** Retrieve all broken packages of the database at once, in the order of
+ * the installed packages. See pkgdepdb_db_package_is_broken().
+ * \param db the database instance.
+ * \param out an array to store up to count package pointers in.
+ * \param count the number of elements that fit into the output array.
+ * \returns the number of broken packages, which may exceed count.
+ */
+size_t        pkgdepdb_db_package_broken  (pkgdepdb_db *db, pkgdepdb_pkg **out,
+                                           size_t count);
+
 /** Retrieve the number of ELF files contained within all the packages
  * installed into the database. These have no particular order. */
 size_t pkgdepdb_db_object_count(pkgdepdb_db*);
@@ -396,12 +517,52 @@ pkgdepdb_bool pkgdepdb_db_assume_found_del_i   (pkgdepdb_db*, size_t);
 /** List of libraries assumed to exist: \sa pkgdepdb_db_library_path_del_r().*/
 size_t        pkgdepdb_db_assume_found_del_r   (pkgdepdb_db*, size_t, size_t);
 
+/** Retrieve the number of extra library paths of a package.
+ * The paths are kept by package name, so they may be set before the
+ * package is installed.
+ */
+size_t        pkgdepdb_db_package_library_path_count (pkgdepdb_db*,
+                                                      const char *pkg);
+/** A package's library paths: \sa pkgdepdb_db_library_path_get(). */
+size_t        pkgdepdb_db_package_library_path_get   (pkgdepdb_db*,
+                                                      const char *pkg,
+                                                      const char **out,
+                                                      size_t offset,
+                                                      size_t count);
+/** Insert a path into a package's library paths at a specified position,
+ * or move it there if it is already listed.
+ */
+pkgdepdb_bool pkgdepdb_db_package_library_path_insert(pkgdepdb_db*,
+                                                      const char *pkg,
+                                                      size_t index,
+                                                      const char *path);
+/** Delete a path from a package's library paths. */
+pkgdepdb_bool pkgdepdb_db_package_library_path_del_s (pkgdepdb_db*,
+                                                      const char *pkg,
+                                                      const char *path);
+/** Delete a package library path entry by index. */
+pkgdepdb_bool pkgdepdb_db_package_library_path_del_i (pkgdepdb_db*,
+                                                      const char *pkg,
+                                                      size_t index);
+/** Delete all library paths of a package. */
+pkgdepdb_bool pkgdepdb_db_package_library_path_clear (pkgdepdb_db*,
+                                                      const char *pkg);
+
 /**
- * Relink all objects contained in the database. Do this whenever you change
- * database rules such as the global library path.
+ * Relink all objects contained in the database.
+ * Changes to database rules such as the global library path only mark the
+ * affected objects, which get relinked by pkgdepdb_db_relink_dirty(), so
+ * this is rarely necessary.
  * This operation can use threading if the configuration enables it.
  */
 void          pkgdepdb_db_relink_all    (pkgdepdb_db*);
+/**
+ * Relink the objects affected by rule changes since the last relink.
+ * This happens automatically when storing the database or checking whether
+ * a package or object is broken.
+ * \returns true if any objects had to be relinked.
+ */
+pkgdepdb_bool pkgdepdb_db_relink_dirty  (pkgdepdb_db*);
 void          pkgdepdb_db_fix_paths     (pkgdepdb_db*);
 /** Convenience function to delete all packages from the database while keeping
  * all the rules. */
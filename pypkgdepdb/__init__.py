@@ -27,6 +27,28 @@ class JSON(object):
     Query = 1
     DB    = 2
 
+class Phase(object):
+    Open      = 0
+    Install   = 1
+    Relink    = 2
+    Integrity = 3
+    Load      = 4
+    Store     = 5
+
+class MemoryCategory(object):
+    Packages  = 0
+    Depends   = 1
+    Groups    = 2
+    Filelists = 3
+    Info      = 4
+    Objects   = 5
+    Links     = 6
+    Missing   = 7
+    Rules     = 8
+    Integrity = 9
+    Tables    = 10
+    Indexes   = 11
+
 class ELF(object):
     CLASSNONE = 0
     CLASS32   = 1
@@ -96,6 +118,7 @@ class Config(object):
     json      = IntProperty(lib.cfg_json,      lib.cfg_set_json)
 
     quiet              = BoolProperty(lib.cfg_quiet, lib.cfg_set_quiet)
+    stats              = BoolProperty(lib.cfg_stats, lib.cfg_set_stats)
     package_depends    = BoolProperty(lib.cfg_package_depends,
                                       lib.cfg_set_package_depends)
     package_file_lists = BoolProperty(lib.cfg_package_file_lists,
@@ -133,7 +156,7 @@ class DB(object):
 
         def get_named(self, name):
             ptr = lib.db_package_find(self.owner._ptr, cstr(name))
-            if ptr is None:
+            if not ptr:
                 raise KeyError('no such package: %s' % (name))
             return Package(ptr,True)
 
@@ -208,8 +231,13 @@ class DB(object):
         def __contains__(self, value):
             return value in self.get()
 
-    def __init__(self, cfg):
-        self._ptr = lib.db_new(cfg._ptr)
+    def __init__(self, cfg, base=None):
+        # a snapshot keeps its base alive
+        self._base = base
+        if base is None:
+            self._ptr = lib.db_new(cfg._ptr)
+        else:
+            self._ptr = lib.db_snapshot(base._ptr)
         if self._ptr is None:
             raise PKGDepDBException('failed to create database instance')
         self._library_path = StringListAccess(self,
@@ -272,9 +300,54 @@ class DB(object):
         if lib.db_store(self._ptr, cstr(path)) != 1:
             raise PKGDepDBException('failed to store database to %s' % (path))
 
+    def snapshot(self):
+        return DB(None, self)
+
+    def stats(self):
+        out = functions.Stats()
+        lib.db_stats(self._ptr, ctypes.byref(out))
+        return out
+
+    def stats_reset(self):
+        lib.db_stats_reset(self._ptr)
+
+    def memory(self):
+        out = functions.Memory()
+        lib.db_memory(self._ptr, ctypes.byref(out))
+        return out
+
+    def package_library_path(self, pkg):
+        pkg = cstr(pkg)
+        count = lib.db_package_library_path_count(self._ptr, pkg)
+        out = (ctypes.c_char_p * count)()
+        got = lib.db_package_library_path_get(self._ptr, pkg, out, 0, count)
+        return [from_c_string(x) for x in out[0:got]]
+
+    def package_library_path_insert(self, pkg, index, path):
+        return lib.db_package_library_path_insert(self._ptr, cstr(pkg), index,
+                                                  cstr(path)) == 1
+
+    def package_library_path_add(self, pkg, path):
+        count = lib.db_package_library_path_count(self._ptr, cstr(pkg))
+        return self.package_library_path_insert(pkg, count, path)
+
+    def package_library_path_delete(self, pkg, what):
+        if isinstance(what, int):
+            v = lib.db_package_library_path_del_i(self._ptr, cstr(pkg), what)
+        else:
+            v = lib.db_package_library_path_del_s(self._ptr, cstr(pkg),
+                                                  cstr(what))
+        return v == 1
+
+    def package_library_path_clear(self, pkg):
+        return lib.db_package_library_path_clear(self._ptr, cstr(pkg)) == 1
+
     def relink_all(self):
         lib.db_relink_all(self._ptr)
 
+    def relink_dirty(self):
+        return bool(lib.db_relink_dirty(self._ptr))
+
     def fix_paths(self):
         lib.db_fix_paths(self._ptr)
 
@@ -310,6 +383,30 @@ class DB(object):
             pkg.linked = False
             del pkg
 
+    def delete_packages(self, names):
+        names = [cstr(n) for n in names]
+        return lib.db_package_delete_s_r(self._ptr, len(names),
+                                          (ctypes.c_char_p * len(names))(*names))
+
+    def owners(self, path):
+        path = cstr(path)
+        count = 16
+        while True:
+            out = (p_pkg * count)()
+            got = lib.db_package_owners(self._ptr, path, out, count)
+            if got <= count:
+                return [Package(x,True) for x in out[0:got]]
+            count = got
+
+    def broken_packages(self):
+        count = 16
+        while True:
+            out = (p_pkg * count)()
+            got = lib.db_package_broken(self._ptr, out, count)
+            if got <= count:
+                return [Package(x,True) for x in out[0:got]]
+            count = got
+
     def is_broken(self, what):
         if type(what) == Package:
             v = lib.db_package_is_broken(self._ptr, what._ptr)
@@ -1,5 +1,6 @@
 from .common import *
 from ctypes import c_int, c_uint, c_char_p, c_size_t, POINTER, c_void_p, c_ubyte
+from ctypes import c_ulonglong, Structure
 
 def load(rawlib, lib, funcs, allprefix):
     for fn in funcs:
@@ -15,6 +16,31 @@ p_db  = POINTER(c_void_p)
 p_pkg = POINTER(c_void_p)
 p_elf = POINTER(c_void_p)
 
+STATS_PHASES = 6
+
+class Stats(Structure):
+    _fields_ = [
+        ('phase_ns',       c_ulonglong * STATS_PHASES),
+        ('phase_calls',    c_ulonglong * STATS_PHASES),
+        ('objects_linked', c_ulonglong),
+        ('lookups',        c_ulonglong),
+        ('cache_hits',     c_ulonglong),
+        ('candidates',     c_ulonglong),
+        ('elf_finds',      c_ulonglong),
+        ('bytes_read',     c_ulonglong),
+        ('bytes_written',  c_ulonglong),
+        ('peak_rss',       c_ulonglong),
+    ]
+
+MEMORY_CATEGORIES = 12
+
+class Memory(Structure):
+    _fields_ = [
+        ('bytes',       c_ulonglong * MEMORY_CATEGORIES),
+        ('allocations', c_ulonglong * MEMORY_CATEGORIES),
+        ('peak_rss',    c_ulonglong),
+    ]
+
 pkgdepdb_functions = [
     ('init',                       None,     []),
     ('finalize',                   None,     []),
@@ -43,11 +69,17 @@ pkgdepdb_functions = [
     ('cfg_set_log_level',          None,     [p_cfg, c_uint]),
     ('cfg_json',                   c_uint,   [p_cfg]),
     ('cfg_set_json',               None,     [p_cfg, c_uint]),
+    ('cfg_stats',                  c_int,    [p_cfg]),
+    ('cfg_set_stats',              None,     [p_cfg, c_int]),
     ('db_new',                     p_db,     [p_cfg]),
     ('db_delete',                  None,     [p_db]),
+    ('db_snapshot',                p_db,     [p_db]),
     ('db_load',                    c_int,    [p_db, c_char_p]),
     ('db_store',                   c_int,    [p_db, c_char_p]),
     ('db_loaded_version',          c_uint,   [p_db]),
+    ('db_stats',                   None,     [p_db, POINTER(Stats)]),
+    ('db_stats_reset',             None,     [p_db]),
+    ('db_memory',                  None,     [p_db, POINTER(Memory)]),
     ('db_strict_linking',          c_int,    [p_db]),
     ('db_set_strict_linking',      None,     [p_db, c_int]),
     ('db_name',                    c_char_p, [p_db]),
@@ -56,6 +88,8 @@ pkgdepdb_functions = [
     ('db_library_path_get',        c_size_t, [p_db, POINTER(c_char_p), c_size_t, c_size_t]),
     ('db_library_path_contains',   c_int,    [p_db, c_char_p]),
     ('db_library_path_add',        c_int,    [p_db, c_char_p]),
+    ('db_library_path_insert',     c_int,    [p_db, c_size_t, c_char_p]),
+    ('db_library_path_insert_r',   c_size_t, [p_db, c_size_t, c_size_t, POINTER(c_char_p)]),
     ('db_library_path_del_s',      c_int,    [p_db, c_char_p]),
     ('db_library_path_del_i',      c_int,    [p_db, c_size_t]),
     ('db_library_path_del_r',      c_int,    [p_db, c_size_t, c_size_t]),
@@ -66,10 +100,13 @@ pkgdepdb_functions = [
     ('db_package_get',             c_size_t, [p_db, POINTER(p_pkg), c_size_t, c_size_t]),
     ('db_package_delete_p',        c_size_t, [p_db, p_pkg]),
     ('db_package_delete_s',        c_size_t, [p_db, c_char_p]),
+    ('db_package_delete_s_r',      c_size_t, [p_db, c_size_t, POINTER(c_char_p)]),
     ('db_package_delete_i',        c_size_t, [p_db, c_size_t]),
     ('db_package_remove_p',        c_size_t, [p_db, p_pkg]),
     ('db_package_remove_i',        c_size_t, [p_db, p_pkg]),
+    ('db_package_owners',          c_size_t, [p_db, c_char_p, POINTER(p_pkg), c_size_t]),
     ('db_package_is_broken',       c_int,    [p_db, p_pkg]),
+    ('db_package_broken',          c_size_t, [p_db, POINTER(p_pkg), c_size_t]),
     ('db_object_count',            c_size_t, [p_db]),
     ('db_object_get',              c_size_t, [p_db, POINTER(p_elf), c_size_t, c_size_t]),
     ('db_object_is_broken',        c_int,    [p_db, p_elf]),
@@ -94,7 +131,14 @@ pkgdepdb_functions = [
     ('db_assume_found_del_s',      c_int,    [p_db, c_char_p]),
     ('db_assume_found_del_i',      c_int,    [p_db, c_size_t]),
     ('db_assume_found_del_r',      c_int,    [p_db, c_size_t, c_size_t]),
+    ('db_package_library_path_count',  c_size_t, [p_db, c_char_p]),
+    ('db_package_library_path_get',    c_size_t, [p_db, c_char_p, POINTER(c_char_p), c_size_t, c_size_t]),
+    ('db_package_library_path_insert', c_int,    [p_db, c_char_p, c_size_t, c_char_p]),
+    ('db_package_library_path_del_s',  c_int,    [p_db, c_char_p, c_char_p]),
+    ('db_package_library_path_del_i',  c_int,    [p_db, c_char_p, c_size_t]),
+    ('db_package_library_path_clear',  c_int,    [p_db, c_char_p]),
     ('db_relink_all',              None,     [p_db]),
+    ('db_relink_dirty',            c_int,    [p_db]),
     ('db_fix_paths',               None,     [p_db]),
     ('db_wipe_packages',           c_int,    [p_db]),
     ('db_wipe_filelists',          c_int,    [p_db]),
@@ -0,0 +1,503 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "main.h"
+#include "elf.h"
+#include "package.h"
+#include "db.h"
+#include "serve.h"
+
+namespace pkgdepdb {
+namespace serve {
+
+// A request starts with its length as a 32 bit integer, sent together with
+// the client's stdin, stdout and stderr. The request itself is a list of
+// NUL terminated strings: the client's working directory followed by its
+// arguments. The reply is the exit status as a 32 bit integer.
+static const uint32_t kMaxRequest = 1024*1024;
+
+// a client has this long to send its request
+static const time_t kRequestTimeout = 5;
+
+// where a request tells the server whether it modifies the database
+static int started_fd = -1;
+
+// signals are handled in the main loop by writing them to a pipe
+static int signal_pipe[2] = { -1, -1 };
+
+static void on_signal(int sig) {
+  int saved = errno;
+  char c = (char)sig;
+  ssize_t r = write(signal_pipe[1], &c, 1);
+  (void)r;
+  errno = saved;
+}
+
+static bool write_all(int fd, const void *data, size_t length) {
+  const char *at = reinterpret_cast<const char*>(data);
+  while (length) {
+    ssize_t n = write(fd, at, length);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    at     += n;
+    length -= size_t(n);
+  }
+  return true;
+}
+
+static bool read_all(int fd, void *data, size_t length) {
+  char *at = reinterpret_cast<char*>(data);
+  while (length) {
+    ssize_t n = read(fd, at, length);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    at     += n;
+    length -= size_t(n);
+  }
+  return true;
+}
+
+static bool make_address(const string& path, sockaddr_un &addr) {
+  if (path.length() >= sizeof(addr.sun_path))
+    return false;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  memcpy(addr.sun_path, path.c_str(), path.length()+1);
+  return true;
+}
+
+union FDControl {
+  cmsghdr align_;
+  char    data_[CMSG_SPACE(3 * sizeof(int))];
+};
+
+static bool send_header(int fd, uint32_t length) {
+  int stdfds[3] = { 0, 1, 2 };
+  FDControl control;
+  memset(&control, 0, sizeof(control));
+
+  iovec iov;
+  iov.iov_base = &length;
+  iov.iov_len  = sizeof(length);
+
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov        = &iov;
+  msg.msg_iovlen     = 1;
+  msg.msg_control    = control.data_;
+  msg.msg_controllen = sizeof(control.data_);
+
+  cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type  = SCM_RIGHTS;
+  cmsg->cmsg_len   = CMSG_LEN(sizeof(stdfds));
+  memcpy(CMSG_DATA(cmsg), stdfds, sizeof(stdfds));
+
+  ssize_t n;
+  do {
+    n = sendmsg(fd, &msg, 0);
+  } while (n < 0 && errno == EINTR);
+  return n == sizeof(length);
+}
+
+static bool receive_request(int fd, int stdfds[3], string &request) {
+  uint32_t length = 0;
+  FDControl control;
+  memset(&control, 0, sizeof(control));
+
+  iovec iov;
+  iov.iov_base = &length;
+  iov.iov_len  = sizeof(length);
+
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov        = &iov;
+  msg.msg_iovlen     = 1;
+  msg.msg_control    = control.data_;
+  msg.msg_controllen = sizeof(control.data_);
+
+  ssize_t n;
+  do {
+    n = recvmsg(fd, &msg, 0);
+  } while (n < 0 && errno == EINTR);
+  if (n <= 0)
+    return false;
+
+  bool got_fds = false;
+  for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+       cmsg = CMSG_NXTHDR(&msg, cmsg))
+  {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+        cmsg->cmsg_len == CMSG_LEN(3 * sizeof(int)))
+    {
+      memcpy(stdfds, CMSG_DATA(cmsg), 3 * sizeof(int));
+      got_fds = true;
+    }
+  }
+  if (!got_fds)
+    return false;
+
+  if (n != sizeof(length) || length > kMaxRequest || !length) {
+    for (int i = 0; i != 3; ++i)
+      close(stdfds[i]);
+    return false;
+  }
+  request.resize(length);
+  if (!read_all(fd, &request[0], length) || request.back() != 0) {
+    for (int i = 0; i != 3; ++i)
+      close(stdfds[i]);
+    return false;
+  }
+  return true;
+}
+
+// The socket's permissions already keep other users out, where the
+// system can tell who is connecting the peer has to be the server's user
+// as well.
+static bool trusted_peer(int client) {
+#if defined(SO_PEERCRED)
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+  if (getsockopt(client, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0)
+    return false;
+  return cred.uid == geteuid();
+#elif defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__) || \
+      defined(__DragonFly__) || defined(__APPLE__)
+  uid_t uid;
+  gid_t gid;
+  if (getpeereid(client, &uid, &gid) != 0)
+    return false;
+  return uid == geteuid();
+#else
+  (void)client;
+  return true;
+#endif
+}
+
+static void reply(int client, int32_t code) {
+  write_all(client, &code, sizeof(code));
+  close(client);
+}
+
+static int32_t exit_code(int status) {
+  if (WIFEXITED(status))
+    return WEXITSTATUS(status);
+  if (WIFSIGNALED(status))
+    return 128 + WTERMSIG(status);
+  return 1;
+}
+
+// reply to the clients of finished readers
+static void reap(std::map<pid_t, int> &running, bool wait_all) {
+  while (!running.empty()) {
+    int status;
+    pid_t pid = waitpid(-1, &status, wait_all ? 0 : WNOHANG);
+    if (pid < 0 && errno == EINTR)
+      continue;
+    if (pid <= 0)
+      break;
+    auto it = running.find(pid);
+    if (it == running.end())
+      continue;
+    reply(it->second, exit_code(status));
+    running.erase(it);
+  }
+}
+
+void Started(bool writes) {
+  if (started_fd < 0)
+    return;
+  char state = writes ? 'w' : 'r';
+  write_all(started_fd, &state, 1);
+  close(started_fd);
+  started_fd = -1;
+}
+
+// build the lazily created indices once instead of in every request
+static void prepare(DB *db) {
+  db->file_index_.Build(db->packages_);
+  db->reverse_index_.Build(db->packages_, db->objects_);
+}
+
+// the forked child running a single request
+static void run_request [[noreturn]] (const std::map<pid_t, int> &running,
+                                      int                         listener,
+                                      int                         client,
+                                      int                         stdfds[3],
+                                      int                         started,
+                                      string                     &request,
+                                      DB                         *db,
+                                      function<request_func_t>   &func)
+{
+  close(listener);
+  close(client);
+  close(signal_pipe[0]);
+  close(signal_pipe[1]);
+  for (auto &r : running)
+    close(r.second);
+  signal(SIGINT,  SIG_DFL);
+  signal(SIGTERM, SIG_DFL);
+  signal(SIGCHLD, SIG_DFL);
+  signal(SIGPIPE, SIG_DFL);
+
+  for (int i = 0; i != 3; ++i) {
+    if (stdfds[i] != i) {
+      dup2(stdfds[i], i);
+      close(stdfds[i]);
+    }
+  }
+  started_fd = started;
+
+  // the working directory followed by argv
+  vec<char*> argv;
+  for (size_t at = 0; at != request.length();
+       at = request.find('\0', at) + 1)
+  {
+    argv.push_back(&request[at]);
+  }
+  if (argv.size() < 2) {
+    fprintf(stderr, "malformed request\n");
+    exit(1);
+  }
+  if (chdir(argv[0]) != 0) {
+    fprintf(stderr, "failed to change into %s: %s\n",
+            argv[0], strerror(errno));
+    exit(1);
+  }
+  argv.push_back(nullptr);
+  exit(func(int(argv.size()-2), argv.data()+1, db));
+}
+
+int Serve(const string&            path,
+          const string&            dbfile,
+          uniq<DB>&                db,
+          const Config&            config,
+          function<request_func_t> func)
+{
+  sockaddr_un addr;
+  if (!make_address(path, addr)) {
+    config.Log(Error, "socket path too long: %s\n", path.c_str());
+    return 1;
+  }
+
+  // replace a socket left behind by a previous server
+  struct stat st;
+  if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+    unlink(path.c_str());
+
+  // requests run with the server's privileges, so only its user may
+  // connect; the socket is created without access for anyone else rather
+  // than changed after the fact
+  mode_t mask = umask(0077);
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  bool bound = listener >= 0 &&
+    bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0;
+  umask(mask);
+  if (!bound || listen(listener, SOMAXCONN) != 0) {
+    config.Log(Error, "failed to listen on %s: %s\n",
+               path.c_str(), strerror(errno));
+    if (listener >= 0)
+      close(listener);
+    return 1;
+  }
+
+  if (pipe(signal_pipe) != 0) {
+    config.Log(Error, "failed to create a pipe: %s\n", strerror(errno));
+    close(listener);
+    unlink(path.c_str());
+    return 1;
+  }
+  fcntl(signal_pipe[0], F_SETFL, O_NONBLOCK);
+  fcntl(signal_pipe[1], F_SETFL, O_NONBLOCK);
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_signal;
+  sa.sa_flags   = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGINT,  &sa, nullptr);
+  sigaction(SIGTERM, &sa, nullptr);
+  sigaction(SIGCHLD, &sa, nullptr);
+  signal(SIGPIPE, SIG_IGN);
+
+  prepare(db.get());
+
+  config.Log(Message, "serving %s on %s\n", dbfile.c_str(), path.c_str());
+
+  // running readers and their clients
+  std::map<pid_t, int> running;
+  bool done = false;
+  while (!done) {
+    pollfd fds[2];
+    fds[0].fd     = listener;
+    fds[0].events = POLLIN;
+    fds[1].fd     = signal_pipe[0];
+    fds[1].events = POLLIN;
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      config.Log(Error, "poll failed: %s\n", strerror(errno));
+      break;
+    }
+
+    if (fds[1].revents & POLLIN) {
+      char sigs[64];
+      ssize_t n;
+      while ((n = read(signal_pipe[0], sigs, sizeof(sigs))) > 0) {
+        for (ssize_t i = 0; i != n; ++i) {
+          if (sigs[i] == SIGINT || sigs[i] == SIGTERM)
+            done = true;
+        }
+      }
+      reap(running, false);
+    }
+    if (done || !(fds[0].revents & POLLIN))
+      continue;
+
+    int client = accept(listener, nullptr, nullptr);
+    if (client < 0)
+      continue;
+    if (!trusted_peer(client)) {
+      config.Log(Warn, "dropping a request from another user\n");
+      close(client);
+      continue;
+    }
+    timeval timeout;
+    timeout.tv_sec  = kRequestTimeout;
+    timeout.tv_usec = 0;
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    int stdfds[3];
+    string request;
+    if (!receive_request(client, stdfds, request)) {
+      config.Log(Warn, "dropping a malformed request\n");
+      close(client);
+      continue;
+    }
+
+    int started[2];
+    if (pipe(started) != 0) {
+      config.Log(Error, "failed to create a pipe: %s\n", strerror(errno));
+      for (int i = 0; i != 3; ++i)
+        close(stdfds[i]);
+      reply(client, 1);
+      continue;
+    }
+
+    // don't let the child write out our pending output again
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid == 0)
+      run_request(running, listener, client, stdfds, started[1], request,
+                  db.get(), func);
+
+    for (int i = 0; i != 3; ++i)
+      close(stdfds[i]);
+    close(started[1]);
+    if (pid < 0) {
+      config.Log(Error, "fork failed: %s\n", strerror(errno));
+      close(started[0]);
+      reply(client, 1);
+      continue;
+    }
+
+    // without an answer the request ended before touching the database
+    char state = 'r';
+    read_all(started[0], &state, 1);
+    close(started[0]);
+    if (state != 'w') {
+      running[pid] = client;
+      continue;
+    }
+
+    // writers run one at a time with no new readers starting meanwhile
+    int status;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+      ;
+    reply(client, exit_code(status));
+
+    uniq<DB> fresh(new DB(config));
+    if (!fresh->Load(dbfile)) {
+      config.Log(Error, "failed to reload the database, "
+                        "keeping the previous state\n");
+      continue;
+    }
+    db = move(fresh);
+    prepare(db.get());
+  }
+
+  close(listener);
+  unlink(path.c_str());
+  reap(running, true);
+  close(signal_pipe[0]);
+  close(signal_pipe[1]);
+  return 0;
+}
+
+int Connect(const string& path, int argc, char **argv) {
+  sockaddr_un addr;
+  if (!make_address(path, addr)) {
+    fprintf(stderr, "socket path too long: %s\n", path.c_str());
+    return 1;
+  }
+
+  char cwd[PATH_MAX];
+  if (!getcwd(cwd, sizeof(cwd))) {
+    fprintf(stderr, "failed to get the working directory: %s\n",
+            strerror(errno));
+    return 1;
+  }
+  string request(cwd, strlen(cwd)+1);
+  for (int i = 0; i != argc; ++i)
+    request.append(argv[i], strlen(argv[i])+1);
+  if (request.length() > kMaxRequest) {
+    fprintf(stderr, "too many arguments for a request\n");
+    return 1;
+  }
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 ||
+      connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0)
+  {
+    fprintf(stderr, "failed to connect to %s: %s\n",
+            path.c_str(), strerror(errno));
+    if (fd >= 0)
+      close(fd);
+    return 1;
+  }
+
+  // a server dropping the request closes the connection early
+  signal(SIGPIPE, SIG_IGN);
+  int32_t status = 1;
+  if (!send_header(fd, uint32_t(request.length())) ||
+      !write_all(fd, request.data(), request.length()))
+  {
+    fprintf(stderr, "failed to send the request: %s\n", strerror(errno));
+  }
+  else if (!read_all(fd, &status, sizeof(status))) {
+    fprintf(stderr, "lost the connection to the server\n");
+    status = 1;
+  }
+  close(fd);
+  return status;
+}
+
+} // ::pkgdepdb::serve
+} // ::pkgdepdb
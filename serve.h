@@ -0,0 +1,33 @@
+#ifndef PKGDEPDB_SERVE_H__
+#define PKGDEPDB_SERVE_H__
+
+namespace pkgdepdb {
+namespace serve {
+
+  // Runs one request's command line against the served database, returns
+  // the exit status for the client.
+  using request_func_t = int(int argc, char **argv, DB *db);
+
+  // Keep the database loaded and answer requests arriving on the unix
+  // socket at Path. Every request runs in a forked child which writes to
+  // the client's own stdout and stderr, so readers run concurrently on a
+  // shared copy of the database. A request which modifies the database
+  // blocks the server until it is done, after which the database is
+  // reloaded from DBFile. Returns when receiving SIGINT or SIGTERM.
+  int Serve(const string&            Path,
+            const string&            DBFile,
+            uniq<DB>&                DB,
+            const Config&            Config,
+            function<request_func_t> Request);
+
+  // Pass the arguments to a server and return the request's exit status.
+  int Connect(const string& Path, int argc, char **argv);
+
+  // To be called by a request once its options are parsed, tells the
+  // server whether it has to wait for the request to finish.
+  void Started(bool writes);
+
+} // ::pkgdepdb::serve
+} // ::pkgdepdb
+
+#endif
@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <iterator>
+
+#include "main.h"
+#include "writer.h"
+#include "stats.h"
+
+namespace pkgdepdb {
+namespace stats {
+
+thread_local uint64_t local[CounterCount];
+
+// spans of the current thread not yet moved to the totals
+static thread_local vec<Event> local_events;
+// moved to the totals once this many spans are buffered
+static const size_t kEventFlush = 4096;
+
+static std::atomic<uint32_t> next_thread_id(1);
+static thread_local uint32_t thread_id = 0;
+
+static const char *phase_names[PhaseCount] = {
+  "open", "install", "relink", "integrity", "load", "store"
+};
+
+Totals::Totals()
+: epoch_(std::chrono::steady_clock::now())
+{
+  for (auto &v : phase_ns_)    v = 0;
+  for (auto &v : phase_calls_) v = 0;
+  for (auto &v : counters_)    v = 0;
+}
+
+static void FlushEvents(Totals &totals) {
+#ifdef PKGDEPDB_ENABLE_THREADS
+  std::lock_guard<std::mutex> lock(totals.events_mutex_);
+#endif
+  totals.events_.insert(totals.events_.end(),
+                        std::make_move_iterator(local_events.begin()),
+                        std::make_move_iterator(local_events.end()));
+  local_events.clear();
+}
+
+void Flush(const Config& config) {
+  for (size_t i = 0; i != CounterCount; ++i) {
+    if (local[i]) {
+      config.stats_totals_->counters_[i] += local[i];
+      local[i] = 0;
+    }
+  }
+  if (!local_events.empty())
+    FlushEvents(*config.stats_totals_);
+}
+
+void Reset(const Config& config) {
+  for (auto &v : local)
+    v = 0;
+  local_events.clear();
+  Totals &totals(*config.stats_totals_);
+  for (auto &v : totals.phase_ns_)    v = 0;
+  for (auto &v : totals.phase_calls_) v = 0;
+  for (auto &v : totals.counters_)    v = 0;
+#ifdef PKGDEPDB_ENABLE_THREADS
+  std::lock_guard<std::mutex> lock(totals.events_mutex_);
+#endif
+  totals.events_.clear();
+  totals.epoch_ = std::chrono::steady_clock::now();
+}
+
+void Get(const Config& config, Values& out) {
+  Flush(config);
+  const Totals &totals(*config.stats_totals_);
+  for (size_t i = 0; i != PhaseCount; ++i) {
+    out.phase_ns_[i]    = totals.phase_ns_[i];
+    out.phase_calls_[i] = totals.phase_calls_[i];
+  }
+  for (size_t i = 0; i != CounterCount; ++i)
+    out.counters_[i] = totals.counters_[i];
+  out.peak_rss_ = PeakRSS();
+}
+
+uint64_t PeakRSS() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+#if defined(__APPLE__)
+  // reported in bytes there
+  return (uint64_t)usage.ru_maxrss / 1024;
+#else
+  return (uint64_t)usage.ru_maxrss;
+#endif
+}
+
+void Print(const Config& config, FILE *out) {
+  Values v;
+  Get(config, v);
+
+  auto count = [&v](Counter c) {
+    return (unsigned long long)v.counters_[c];
+  };
+
+  bool header = false;
+  for (size_t i = 0; i != PhaseCount; ++i) {
+    if (!v.phase_calls_[i])
+      continue;
+    if (!header)
+      fprintf(out, "phase       calls       seconds\n");
+    header = true;
+    fprintf(out, "%-9s %7llu %13.6f\n", phase_names[i],
+            (unsigned long long)v.phase_calls_[i],
+            v.phase_ns_[i] / 1e9);
+  }
+  fprintf(out, "objects linked:       %llu\n", count(ObjectsLinked));
+  fprintf(out, "library lookups:      %llu\n", count(Lookups));
+  fprintf(out, "link cache hits:      %llu\n", count(CacheHits));
+  fprintf(out, "candidates compared:  %llu\n", count(Candidates));
+  fprintf(out, "search path checks:   %llu\n", count(ElfFinds));
+  fprintf(out, "bytes read:           %llu\n", count(BytesRead));
+  fprintf(out, "bytes written:        %llu\n", count(BytesWritten));
+  fprintf(out, "peak memory:          %llu kB\n",
+          (unsigned long long)v.peak_rss_);
+}
+
+// Chrome's timestamps are in microseconds
+static void put_usecs(Writer &out, uint64_t ns) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%llu.%03u",
+           (unsigned long long)(ns / 1000), (unsigned)(ns % 1000));
+  out.Put(buf);
+}
+
+bool WriteTrace(const Config& config, const string& filename) {
+  Flush(config);
+  Totals &totals(*config.stats_totals_);
+
+  FILE *file = fopen(filename.c_str(), "wb");
+  if (!file) {
+    config.Log(Error, "failed to open trace file `%s' for writing\n",
+               filename.c_str());
+    return false;
+  }
+  guard close_file([file]() { fclose(file); });
+  Writer out(file);
+
+  auto pid = (unsigned long)getpid();
+  out.Put("{\"traceEvents\":[");
+  bool first = true;
+  auto begin = [&]() {
+    out.Put(first ? "\n" : ",\n");
+    first = false;
+  };
+
+  vec<uint32_t> threads;
+  for (auto &ev : totals.events_) {
+    begin();
+    out.Put("{\"name\":").JSONQuote(ev.name_)
+       .Put(",\"cat\":\"").Put(ev.cat_)
+       .Put("\",\"ph\":\"X\",\"ts\":");
+    put_usecs(out, ev.start_);
+    out.Put(",\"dur\":");
+    put_usecs(out, ev.duration_);
+    out.Put(",\"pid\":").Unsigned(pid)
+       .Put(",\"tid\":").Unsigned(ev.thread_)
+       .Put('}');
+    threads.push_back(ev.thread_);
+  }
+
+  // name the threads, the one writing the trace is the main thread
+  std::sort(threads.begin(), threads.end());
+  threads.erase(std::unique(threads.begin(), threads.end()), threads.end());
+  for (uint32_t id : threads) {
+    begin();
+    out.Put("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":")
+       .Unsigned(pid)
+       .Put(",\"tid\":").Unsigned(id)
+       .Put(",\"args\":{\"name\":\"")
+       .Put(id == thread_id ? "main" : "worker")
+       .Put("\"}}");
+  }
+  out.Put("\n],\"displayTimeUnit\":\"ms\"}\n");
+
+  if (!out.Flush()) {
+    config.Log(Error, "failed writing to trace file `%s'\n",
+               filename.c_str());
+    return false;
+  }
+  return true;
+}
+
+void Span::Begin(const string& name) {
+  if (running_)
+    End();
+  name_    = name;
+  start_   = std::chrono::steady_clock::now();
+  running_ = true;
+}
+
+void Span::End() {
+  using std::chrono::duration_cast;
+  using std::chrono::nanoseconds;
+
+  auto end = std::chrono::steady_clock::now();
+  auto &totals = *config_->stats_totals_;
+  if (!thread_id)
+    thread_id = next_thread_id++;
+  // spans started before a Reset() are clipped to the new epoch
+  auto start = std::max(start_, totals.epoch_);
+  end = std::max(end, start);
+  local_events.push_back(Event {
+    cat_,
+    move(name_),
+    uint64_t(duration_cast<nanoseconds>(start - totals.epoch_).count()),
+    uint64_t(duration_cast<nanoseconds>(end - start).count()),
+    thread_id
+  });
+  running_ = false;
+  if (local_events.size() >= kEventFlush)
+    FlushEvents(totals);
+}
+
+void Timer::Stop() {
+  auto took = std::chrono::steady_clock::now() - start_;
+  auto &totals = *config_->stats_totals_;
+  totals.phase_ns_[phase_] +=
+    std::chrono::duration_cast<std::chrono::nanoseconds>(took).count();
+  ++totals.phase_calls_[phase_];
+  Flush(*config_);
+}
+
+} // ::pkgdepdb::stats
+} // ::pkgdepdb
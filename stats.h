@@ -0,0 +1,147 @@
+#ifndef PKGDEPDB_STATS_H__
+#define PKGDEPDB_STATS_H__
+
+namespace pkgdepdb {
+namespace stats {
+
+  // NOTE: Keep in sync with pkgdepdb.h's pkgdepdb_stats
+  enum Phase {
+    Open, Install, Relink, Integrity, Load, Store,
+    PhaseCount
+  };
+
+  enum Counter {
+    ObjectsLinked,
+    Lookups,       // libraries searched for, cached or not
+    CacheHits,     // lookups answered by the link cache
+    Candidates,    // objects compared in FindFor
+    ElfFinds,      // search path checks
+    BytesRead,
+    BytesWritten,
+    CounterCount
+  };
+
+  // The counts of the current thread. They are only touched while the
+  // Config has stats_ enabled and are folded into its totals by Flush(),
+  // which threads started by thread::work do when they are done.
+  extern thread_local uint64_t local[CounterCount];
+
+  // A span of a trace, times are in nanoseconds since the trace started.
+  struct Event {
+    const char *cat_;
+    string      name_;
+    uint64_t    start_;
+    uint64_t    duration_;
+    uint32_t    thread_;
+  };
+
+  struct Totals {
+    std::atomic<uint64_t> phase_ns_   [PhaseCount];
+    std::atomic<uint64_t> phase_calls_[PhaseCount];
+    std::atomic<uint64_t> counters_   [CounterCount];
+
+    // Spans recorded while the Config has trace_ enabled. Every thread
+    // collects its spans in a buffer of its own which is only moved here
+    // when it fills up and by Flush().
+    std::chrono::steady_clock::time_point epoch_;
+    vec<Event>                            events_;
+#ifdef PKGDEPDB_ENABLE_THREADS
+    std::mutex                            events_mutex_;
+#endif
+
+    Totals();
+  };
+
+  // A copy of the totals as returned by Get().
+  struct Values {
+    uint64_t phase_ns_   [PhaseCount]   = {};
+    uint64_t phase_calls_[PhaseCount]   = {};
+    uint64_t counters_   [CounterCount] = {};
+    // in kilobytes, of the whole process
+    uint64_t peak_rss_                  = 0;
+  };
+
+  inline void Count(const Config& config, Counter what, uint64_t n = 1) {
+    if (config.stats_)
+      local[what] += n;
+  }
+
+  void Flush(const Config&);
+  // Drops the totals and the calling thread's counts and spans.
+  void Reset(const Config&);
+  // Flushes the calling thread's counts before copying the totals.
+  void Get  (const Config&, Values&);
+  void Print(const Config&, FILE*);
+  // The peak resident set size of the process in kilobytes.
+  uint64_t PeakRSS();
+  // Write the recorded spans in the Chrome trace event format, which
+  // chrome://tracing and Perfetto can open.
+  bool WriteTrace(const Config&, const string& filename);
+
+  // Times the scope it lives in, then flushes the thread's counts.
+  class Timer {
+   public:
+    Timer(const Config& config, Phase phase)
+    : config_(config.stats_ ? &config : nullptr), phase_(phase)
+    {
+      if (config_)
+        start_ = std::chrono::steady_clock::now();
+    }
+
+    ~Timer() {
+      if (config_)
+        Stop();
+    }
+
+   private:
+    void Stop();
+
+    const Config                          *config_;
+    Phase                                  phase_;
+    std::chrono::steady_clock::time_point  start_;
+  };
+
+  // A named span of a trace in the category Cat, which has to be a string
+  // literal. Start() ends the running span, so one Span can time each
+  // item of a loop in turn.
+  class Span {
+   public:
+    Span(const Config& config, const char *cat)
+    : config_(config.trace_ ? &config : nullptr), cat_(cat)
+    {}
+
+    Span(const Config& config, const char *cat, const string& name)
+    : Span(config, cat)
+    {
+      Start(name);
+    }
+
+    ~Span() {
+      Stop();
+    }
+
+    void Start(const string& name) {
+      if (config_)
+        Begin(name);
+    }
+
+    void Stop() {
+      if (config_ && running_)
+        End();
+    }
+
+   private:
+    void Begin(const string& name);
+    void End();
+
+    const Config                          *config_;
+    const char                            *cat_;
+    bool                                   running_ = false;
+    string                                 name_;
+    std::chrono::steady_clock::time_point  start_;
+  };
+
+} // ::pkgdepdb::stats
+} // ::pkgdepdb
+
+#endif
@@ -19,6 +19,7 @@ START_TEST (test_ca_config)
   pkgdepdb_cfg_set_max_jobs          (cfg, 4);
   pkgdepdb_cfg_set_log_level         (cfg, PKGDEPDB_CFG_LOG_LEVEL_PRINT);
   pkgdepdb_cfg_set_json              (cfg, PKGDEPDB_JSONBITS_QUERY);
+  pkgdepdb_cfg_set_stats             (cfg, 1);
   ck_assert_str_eq(pkgdepdb_cfg_database(cfg),           "test.db.gz");
   ck_assert_int_eq(pkgdepdb_cfg_verbosity(cfg),          3);
   ck_assert_int_eq(pkgdepdb_cfg_quiet(cfg),              1);
@@ -28,6 +29,7 @@ START_TEST (test_ca_config)
   ck_assert_int_eq(pkgdepdb_cfg_max_jobs(cfg),           4);
   ck_assert_int_eq(pkgdepdb_cfg_log_level(cfg), PKGDEPDB_CFG_LOG_LEVEL_PRINT);
   ck_assert_int_eq(pkgdepdb_cfg_json(cfg),      PKGDEPDB_JSONBITS_QUERY);
+  ck_assert_int_eq(pkgdepdb_cfg_stats(cfg),              1);
 
   pkgdepdb_cfg_set_database          (cfg, "other.db.gz");
   pkgdepdb_cfg_set_verbosity         (cfg, 0);
@@ -38,6 +40,7 @@ START_TEST (test_ca_config)
   pkgdepdb_cfg_set_max_jobs          (cfg, 1);
   pkgdepdb_cfg_set_log_level         (cfg, PKGDEPDB_CFG_LOG_LEVEL_DEBUG);
   pkgdepdb_cfg_set_json              (cfg, PKGDEPDB_JSONBITS_DB);
+  pkgdepdb_cfg_set_stats             (cfg, 0);
   ck_assert_str_eq(pkgdepdb_cfg_database(cfg),           "other.db.gz");
   ck_assert_int_eq(pkgdepdb_cfg_verbosity(cfg),          0);
   ck_assert_int_eq(pkgdepdb_cfg_quiet(cfg),              0);
@@ -48,6 +51,7 @@ START_TEST (test_ca_config)
   ck_assert_int_eq(pkgdepdb_cfg_log_level(cfg), PKGDEPDB_CFG_LOG_LEVEL_DEBUG);
   ck_assert_int_eq(pkgdepdb_cfg_json(cfg),
                    PKGDEPDB_JSONBITS_DB);
+  ck_assert_int_eq(pkgdepdb_cfg_stats(cfg),              0);
 
   pkgdepdb_cfg_delete(cfg);
 }
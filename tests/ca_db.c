@@ -165,15 +165,49 @@ START_TEST (test_ca_db)
   ck_assert_str_eq(paths[1], "A");
   ck_assert_str_eq(paths[2], "X");
 
+  ck_assert_int_eq(pkgdepdb_db_package_library_path_count(db, "libfoo"), 0);
+  ck_assert_int_eq(
+    pkgdepdb_db_package_library_path_insert(db, "libfoo", 0, "/opt/a"), 1);
+  ck_assert_int_eq(
+    pkgdepdb_db_package_library_path_insert(db, "libfoo", 0, "/opt/b"), 1);
+  ck_assert_int_eq(
+    pkgdepdb_db_package_library_path_insert(db, "libfoo", 0, "/opt/b"), 0);
+  ck_assert_int_eq(
+    pkgdepdb_db_package_library_path_get(db, "libfoo", paths, 0, 8), 2);
+  ck_assert_str_eq(paths[0], "/opt/b");
+  ck_assert_str_eq(paths[1], "/opt/a");
+  ck_assert_int_eq(
+    pkgdepdb_db_package_library_path_del_s(db, "libfoo", "/opt/a"), 1);
+  ck_assert_int_eq(pkgdepdb_db_package_library_path_del_i(db, "libfoo", 1), 0);
+  ck_assert_int_eq(pkgdepdb_db_package_library_path_clear(db, "libfoo"), 1);
+  ck_assert_int_eq(pkgdepdb_db_package_library_path_count(db, "libfoo"), 0);
+
   pkgdepdb_pkg *libfoopkg = pkg_libfoo();
   ck_assert_int_eq(pkgdepdb_db_package_install(db, libfoopkg), 1);
   ck_assert_int_eq(pkgdepdb_db_package_count(db), 1);
   ck_assert_int_eq(pkgdepdb_db_package_is_broken(db, libfoopkg), 1);
+  pkgdepdb_pkg *broken[2] = { NULL, NULL };
+  ck_assert_int_eq(pkgdepdb_db_package_broken(db, broken, 2), 1);
+  ck_assert(broken[0] == libfoopkg);
 
   pkgdepdb_pkg *libbarpkg = pkg_libbar();
   ck_assert_int_eq(pkgdepdb_db_package_install(db, libbarpkg), 1);
   ck_assert_int_eq(pkgdepdb_db_package_count(db), 2);
   ck_assert_int_eq(pkgdepdb_db_package_is_broken(db, libfoopkg), 0);
+  ck_assert_int_eq(pkgdepdb_db_package_broken(db, broken, 2), 0);
+
+  pkgdepdb_db *snap = pkgdepdb_db_snapshot(db);
+  ck_assert(snap);
+  ck_assert_int_eq(pkgdepdb_db_package_count(snap), 2);
+  ck_assert_int_eq(pkgdepdb_db_package_remove_p(snap, libbarpkg), 0);
+  ck_assert_int_eq(pkgdepdb_db_package_delete_s(snap, "libbar"), 1);
+  ck_assert_int_eq(pkgdepdb_db_package_count(snap), 1);
+  ck_assert_int_eq(pkgdepdb_db_package_broken(snap, broken, 2), 1);
+  ck_assert_str_eq(pkgdepdb_pkg_name(broken[0]), "libfoo");
+  ck_assert_int_eq(pkgdepdb_db_package_count(db), 2);
+  ck_assert_int_eq(pkgdepdb_db_package_is_broken(db, libfoopkg), 0);
+  ck_assert_int_eq(pkgdepdb_db_package_broken(db, broken, 2), 0);
+  pkgdepdb_db_delete(snap);
 
   pkgdepdb_db_delete(db);
   pkgdepdb_cfg_delete(cfg);
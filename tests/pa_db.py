@@ -106,6 +106,139 @@ class TestConfig(unittest.TestCase):
         pkg.elfs.append(self.elf_libbar2())
         return pkg
 
+    def link_state(self, db):
+        state = {}
+        for elf in db.elfs:
+            state[elf.dirname + '/' + elf.basename] = (
+                sorted(f.dirname + '/' + f.basename for f in elf.found),
+                sorted(elf.missing))
+        return state
+
+    def assertLinkedLikeFresh(self, db):
+        db.store('pa_db_relink.db.gz')
+        fresh = pypkgdepdb.DB(self.cfg)
+        fresh.read('pa_db_relink.db.gz')
+        os.unlink('pa_db_relink.db.gz')
+        fresh.relink_all()
+        self.assertEqual(self.link_state(db), self.link_state(fresh))
+        self.assertEqual([p.name for p in db.broken_packages()],
+                         [p.name for p in fresh.broken_packages()])
+
+    def libpath_db(self, library_path=['/opt/lib'],
+                   prog_osabi=pypkgdepdb.ELF.OSABI_FREEBSD):
+        db = pypkgdepdb.DB(self.cfg)
+        db.library_path = library_path
+        x = self.MakePkg('x', '1-1', 'x')
+        x.elfs.append(self.MakeElf('/opt/lib', 'libx.so'))
+        y = self.MakePkg('y', '1-1', 'y')
+        y.elfs.append(self.MakeElf('/srv/lib', 'liby.so'))
+        c = self.MakePkg('c', '1-1', 'c')
+        prog = self.MakeElf('/usr/bin', 'prog', eosabi=prog_osabi)
+        prog.needed = ['libx.so', 'liby.so']
+        c.elfs.append(prog)
+        for pkg in [x, y, c]:
+            db.install(pkg)
+        db.relink_all()
+        return db
+
+    def test_dblibpath_relink(self):
+        paths = (ctypes.c_char_p * 1)(pypkgdepdb.cstr('/srv/lib'))
+        def setter(db):
+            db.library_path = ['/srv/lib']
+        def del_s(db):
+            del db.library_path['/opt/lib']
+        def del_i(db):
+            del db.library_path[0]
+        def set_i(db):
+            db.library_path[0] = '/srv/lib'
+        def add(db):
+            db.library_path.append('/srv/lib')
+        def insert(db):
+            pypkgdepdb.lib.db_library_path_insert(db._ptr, 0,
+                                                  pypkgdepdb.cstr('/srv/lib'))
+        def insert_r(db):
+            pypkgdepdb.lib.db_library_path_insert_r(db._ptr, 0, 1, paths)
+        def del_r(db):
+            pypkgdepdb.lib.db_library_path_del_r(db._ptr, 0, 1)
+        for change in [setter, del_s, del_i, set_i, add, insert, insert_r,
+                       del_r]:
+            db = self.libpath_db()
+            self.assertEqual(db.broken_packages()[0].name, 'c')
+            change(db)
+            db.relink_dirty()
+            self.assertLinkedLikeFresh(db)
+            db.relink_all()
+            self.assertLinkedLikeFresh(db)
+
+    def assertDirtyRelinkLikeFresh(self, cases):
+        # each case: fixture arguments, whether 'c' is broken before and
+        # after, and the rule change to apply in between
+        for args, before, after, change in cases:
+            db = self.libpath_db(**args)
+            self.assertEqual(db.is_broken(db.packages['c']), before)
+            change(db)
+            db.relink_dirty()
+            self.assertEqual(db.is_broken(db.packages['c']), after)
+            self.assertLinkedLikeFresh(db)
+
+    def test_dbrules_relink(self):
+        both   = { 'library_path': ['/opt/lib', '/srv/lib'] }
+        strict = { 'library_path': ['/opt/lib', '/srv/lib'],
+                   'prog_osabi': pypkgdepdb.ELF.OSABI_NONE }
+        def ld_del(db):
+            del db.library_path['/srv/lib']
+        def ld_add(db):
+            db.library_path.append('/srv/lib')
+        def pkg_ld_add(db):
+            db.package_library_path_add('c', '/srv/lib')
+        def pkg_ld_other(db):
+            db.package_library_path_add('x', '/srv/lib')
+        def pkg_ld_del_s(db):
+            db.package_library_path_add('c', '/srv/lib')
+            db.relink_dirty()
+            db.package_library_path_delete('c', '/srv/lib')
+        def pkg_ld_del_i(db):
+            db.package_library_path_add('c', '/srv/lib')
+            db.relink_dirty()
+            db.package_library_path_delete('c', 0)
+        def pkg_ld_clear(db):
+            db.package_library_path_add('c', '/srv/lib')
+            db.relink_dirty()
+            db.package_library_path_clear('c')
+        def strict_on(db):
+            db.strict_linking = True
+        def strict_off(db):
+            db.strict_linking = True
+            db.relink_dirty()
+            db.strict_linking = False
+        def assume_add(db):
+            db.assume_found.append('liby.so')
+        def assume_del(db):
+            db.assume_found.append('liby.so')
+            db.relink_dirty()
+            del db.assume_found['liby.so']
+        def ignore_add(db):
+            db.ignored_files.append('/usr/bin/prog')
+        def ignore_del(db):
+            db.ignored_files.append('/usr/bin/prog')
+            db.relink_dirty()
+            del db.ignored_files['/usr/bin/prog']
+        self.assertDirtyRelinkLikeFresh([
+            (both,   False, True,  ld_del),
+            ({},     True,  False, ld_add),
+            ({},     True,  False, pkg_ld_add),
+            ({},     True,  True,  pkg_ld_other),
+            ({},     True,  True,  pkg_ld_del_s),
+            ({},     True,  True,  pkg_ld_del_i),
+            ({},     True,  True,  pkg_ld_clear),
+            (strict, False, True,  strict_on),
+            (strict, False, False, strict_off),
+            ({},     True,  False, assume_add),
+            ({},     True,  True,  assume_del),
+            ({},     True,  False, ignore_add),
+            ({},     True,  True,  ignore_del),
+        ])
+
     def test_dbpkgs(self):
         db = pypkgdepdb.DB(self.cfg)
         db.name = 'A Database'
@@ -123,19 +256,177 @@ class TestConfig(unittest.TestCase):
         db.install(libfoo)
         self.assertEqual(len(db.packages), 1)
         self.assertTrue(db.is_broken(libfoo))
+        self.assertEqual([p.name for p in db.broken_packages()], ['libfoo'])
 
         libbar = self.pkg_libbar()
         db.install(libbar)
         self.assertEqual(len(db.packages), 2)
         self.assertFalse(db.is_broken(libfoo))
+        self.assertEqual(db.broken_packages(), [])
+
+        self.assertEqual([p.name for p in db.owners('/usr/lib/libbar1.so')],
+                         ['libbar'])
+        self.assertEqual([p.name for p in db.owners('usr/lib/libfoo.so.1')],
+                         ['libfoo'])
+        self.assertEqual(db.owners('/usr/lib/libnope.so'), [])
 
         db.store('pa_db_test.db.gz')
         ck = pypkgdepdb.DB(self.cfg)
         ck.read('pa_db_test.db.gz')
         self.assertEqual(len(db.packages), len(ck.packages))
+        self.assertEqual(ck.broken_packages(), [])
+        del ck
+
+        os.unlink('pa_db_test.db.gz')
+
+        db.delete_package('libbar')
+        self.assertEqual([p.name for p in db.broken_packages()], ['libfoo'])
+
+    def test_dbowners_filelist_change(self):
+        db = pypkgdepdb.DB(self.cfg)
+        pkg = self.MakePkg('a', '1-1', 'a')
+        pkg.filelist = ['usr/bin/a', 'usr/share/a']
+        db.install(pkg)
+        pkg = db.packages['a']
+        # the first lookup scans, the second one builds the index
+        self.assertEqual([p.name for p in db.owners('usr/share/a')], ['a'])
+        self.assertEqual([p.name for p in db.owners('usr/share/a')], ['a'])
+        # grow the list enough to move it, then drop the indexed entries
+        pkg.filelist.extend(['usr/share/a%d' % i for i in range(256)])
+        del pkg.filelist['usr/bin/a']
+        del pkg.filelist['usr/share/a']
+        self.assertEqual(db.owners('usr/share/a'), [])
+        self.assertEqual(db.owners('usr/bin/a'), [])
+
+    def test_dbdelete_order(self):
+        db = pypkgdepdb.DB(self.cfg)
+        names = ['a', 'b', 'c', 'd', 'e', 'f']
+        for name in names:
+            db.install(self.MakePkg(name, '1-1', name))
+        db.delete_package('b')
+        self.assertEqual([p.name for p in db.packages],
+                         ['a', 'c', 'd', 'e', 'f'])
+        self.assertEqual(db.delete_packages(['a', 'e', 'x', 'a']), 2)
+        self.assertEqual([p.name for p in db.packages], ['c', 'd', 'f'])
+        for name in ['c', 'd', 'f']:
+            self.assertEqual(db.packages[name].name, name)
+        db.install(self.MakePkg('a', '1-1', 'a'))
+        self.assertEqual([p.name for p in db.packages], ['c', 'd', 'f', 'a'])
+        db.install(self.MakePkg('d', '1-2', 'd'))
+        self.assertEqual([p.name for p in db.packages], ['c', 'd', 'f', 'a'])
+        self.assertEqual(db.packages['d'].version, '1-2')
+
+        # enough single removals to have the index rebuilt
+        names = ['p%03d' % i for i in range(300)]
+        for name in names:
+            db.install(self.MakePkg(name, '1-1', name))
+        for name in names[::2]:
+            db.delete_package(name)
+            with self.assertRaises(KeyError):
+                db.packages[name]
+        kept = ['c', 'd', 'f', 'a'] + names[1::2]
+        self.assertEqual([p.name for p in db.packages], kept)
+        for name in kept:
+            self.assertEqual(db.packages[name].name, name)
+
+    def test_dbpackage_rename(self):
+        db = pypkgdepdb.DB(self.cfg)
+        for name in ['a', 'b', 'c']:
+            db.install(self.MakePkg(name, '1-1', name))
+        db.packages['b'].name = 'x'
+        with self.assertRaises(KeyError):
+            db.packages['b']
+        self.assertEqual(db.packages['x'].description, 'b')
+        db.install(self.MakePkg('x', '1-2', 'x'))
+        self.assertEqual([p.name for p in db.packages], ['a', 'x', 'c'])
+        self.assertEqual(db.packages['x'].version, '1-2')
+        db.delete_package('x')
+        self.assertEqual([p.name for p in db.packages], ['a', 'c'])
+
+    def test_dbsnapshot(self):
+        db = pypkgdepdb.DB(self.cfg)
+        db.library_path = ['/lib', '/usr/lib']
+        db.install(self.pkg_libfoo())
+        db.install(self.pkg_libbar())
+        self.assertEqual(db.broken_packages(), [])
+
+        snap = db.snapshot()
+        self.assertEqual(len(snap.packages), 2)
+        with self.assertRaises(pypkgdepdb.PKGDepDBException):
+            snap.uninstall_package(snap.packages['libbar'])
+        snap.delete_package('libbar')
+        self.assertEqual(len(snap.packages), 1)
+        self.assertEqual([p.name for p in snap.broken_packages()],
+                         ['libfoo'])
+        self.assertEqual(len(db.packages), 2)
+        self.assertEqual(db.broken_packages(), [])
+
+        libbar = self.pkg_libbar()
+        snap.install(libbar)
+        self.assertEqual(snap.broken_packages(), [])
+        snap.uninstall_package(libbar)
+        self.assertEqual([p.name for p in snap.broken_packages()],
+                         ['libfoo'])
+        del libbar
+
+        snap.store('pa_db_test.db.gz')
+        ck = pypkgdepdb.DB(self.cfg)
+        ck.read('pa_db_test.db.gz')
+        self.assertEqual([p.name for p in ck.packages], ['libfoo'])
+        self.assertEqual([p.name for p in ck.broken_packages()], ['libfoo'])
         del ck
+        os.unlink('pa_db_test.db.gz')
+        del snap
+
+        self.assertEqual(len(db.packages), 2)
+        self.assertEqual(len(db.elfs), 3)
+        self.assertEqual(db.broken_packages(), [])
 
+    def test_dbstats(self):
+        db = pypkgdepdb.DB(self.cfg)
+        db.library_path = ['/lib', '/usr/lib']
+        db.install(self.pkg_libfoo())
+        self.assertEqual(db.stats().objects_linked, 0)
+
+        self.cfg.stats = True
+        self.assertEqual(self.cfg.stats, True)
+        db.install(self.pkg_libbar())
+        db.relink_all()
+        stats = db.stats()
+        self.assertEqual(stats.phase_calls[pypkgdepdb.Phase.Install], 1)
+        self.assertEqual(stats.phase_calls[pypkgdepdb.Phase.Relink], 1)
+        self.assertEqual(stats.phase_calls[pypkgdepdb.Phase.Load], 0)
+        self.assertGreater(stats.objects_linked, 0)
+        self.assertGreater(stats.lookups, 0)
+        self.assertGreater(stats.peak_rss, 0)
+
+        db.store('pa_db_test.db.gz')
+        self.assertGreater(db.stats().bytes_written, 0)
         os.unlink('pa_db_test.db.gz')
 
+        db.stats_reset()
+        stats = db.stats()
+        self.assertEqual(stats.objects_linked, 0)
+        self.assertEqual(stats.phase_calls[pypkgdepdb.Phase.Install], 0)
+
+    def test_dbmemory(self):
+        db = pypkgdepdb.DB(self.cfg)
+        empty = db.memory()
+        self.assertEqual(empty.bytes[pypkgdepdb.MemoryCategory.Packages], 0)
+        self.assertEqual(empty.bytes[pypkgdepdb.MemoryCategory.Objects], 0)
+
+        db.library_path = ['/lib', '/usr/lib']
+        db.install(self.pkg_libfoo())
+        db.install(self.pkg_libbar())
+        mem = db.memory()
+        for what in [pypkgdepdb.MemoryCategory.Packages,
+                     pypkgdepdb.MemoryCategory.Objects,
+                     pypkgdepdb.MemoryCategory.Links,
+                     pypkgdepdb.MemoryCategory.Rules,
+                     pypkgdepdb.MemoryCategory.Tables]:
+            self.assertGreater(mem.bytes[what], 0)
+            self.assertGreater(mem.allocations[what], 0)
+        self.assertGreater(mem.peak_rss, 0)
+
 if __name__ == '__main__':
     unittest.main()
@@ -0,0 +1,67 @@
+#include <algorithm>
+
+#include <stdio.h>
+
+#include "main.h"
+#include "writer.h"
+
+#ifdef PKGDEPDB_ENABLE_THREADS
+#  include <atomic>
+#  include <thread>
+#  include <unistd.h>
+#endif
+
+#include "stats.h"
+#include "thread.h"
+
+namespace pkgdepdb {
+namespace thread {
+
+#ifdef PKGDEPDB_ENABLE_THREADS
+  static unsigned int ncpus_init() {
+    long v = sysconf(_SC_NPROCESSORS_CONF);
+    return (v <= 0 ? 1 : (unsigned int)v);
+  }
+
+  unsigned int ncpus = ncpus_init();
+
+  // below this many items formatting is cheaper than starting threads
+  static const unsigned long kOrderedOutputMin = 1024;
+#endif
+
+  void ordered_output(Writer                   &Out,
+                      unsigned long             Count,
+                      size_t                    Skip,
+                      function<format_func_t>   Format,
+                      const Config&             Config)
+  {
+#ifdef PKGDEPDB_ENABLE_THREADS
+    if (Count < kOrderedOutputMin || Config.max_jobs_ == 1 || ncpus < 2)
+#endif
+    {
+      (void)Skip;
+      (void)Config;
+      return Format(Out, 0, Count, true);
+    }
+#ifdef PKGDEPDB_ENABLE_THREADS
+    auto worker = [&Format]
+    (std::atomic_ulong*, size_t from, size_t to, Writer &chunk) {
+      Format(chunk, from, to, false);
+    };
+    auto merger = [&Out,Skip](vec<Writer> &&chunks) {
+      bool written = false;
+      for (auto &chunk : chunks) {
+        auto &data = chunk.Data();
+        if (data.empty())
+          continue;
+        size_t skip = written ? 0 : std::min(Skip, data.size());
+        Out.Put(data.data() + skip, data.size() - skip);
+        written = true;
+      }
+    };
+    work<Writer>(Count, nullptr, worker, merger, Config);
+#endif
+  }
+
+} // ::pkgdepdb::thread
+} // ::pkgdepdb
@@ -0,0 +1,117 @@
+#ifndef PKGDEPDB_THREAD_H__
+#define PKGDEPDB_THREAD_H__
+
+namespace pkgdepdb {
+namespace thread {
+
+  // Format(out, from, to, first) writes the items [from, to) to out, first
+  // tells whether they start the output.
+  using format_func_t = void(Writer &out, size_t from, size_t to, bool first);
+
+  // Write Count formatted items to Out. Large outputs are formatted in
+  // parallel, one contiguous range per thread into a memory buffer, and the
+  // buffers are written in order so the output matches the serial one. As
+  // every range is then formatted with first=false, Skip bytes are dropped
+  // from the beginning of the output to remove the first item's separator.
+  void ordered_output(Writer                   &Out,
+                      unsigned long             Count,
+                      size_t                    Skip,
+                      function<format_func_t>   Format,
+                      const Config&             Config);
+
+#ifdef PKGDEPDB_ENABLE_THREADS
+
+  extern unsigned int ncpus;
+
+  using status_printer_func_t =
+    void (unsigned long at, unsigned long count, unsigned long threads);
+
+  template<typename PerThread>
+  using worker_func_t =
+    void(std::atomic_ulong*, size_t from, size_t to, PerThread&);
+
+  template<typename PerThread>
+  using merger_func_t = void(vec<PerThread>&&);
+
+  template<typename PerThread>
+  void work(unsigned long                      Count,
+            function<status_printer_func_t>    StatusPrinter,
+            function<worker_func_t<PerThread>> Worker,
+            function<merger_func_t<PerThread>> Merger,
+            const Config&                      Config)
+  {
+    unsigned long threadcount = thread::ncpus;
+    if (Config.max_jobs_ >= 1 && Config.max_jobs_ < threadcount)
+      threadcount = Config.max_jobs_;
+
+    // the status printer is optional
+    bool status = StatusPrinter && !Config.quiet_;
+
+    unsigned long  obj_per_thread = Count / threadcount;
+    if (status)
+      StatusPrinter(0, Count, threadcount);
+
+    // data created by threads, to be merged in the merger
+    vec<PerThread> Data;
+
+    if (threadcount == 1) {
+      Data.resize(1);
+      for (unsigned long i = 0; i != Count; ++i) {
+        Worker(nullptr, i, i+1, Data[0]);
+        if (status)
+          StatusPrinter(i, Count, 1);
+      }
+      Merger(move(Data));
+      return;
+    }
+
+    Data.resize(threadcount);
+
+    std::atomic_ulong         counter(0);
+    vec<std::thread*> threads;
+
+    // hand the thread's stats counts over before it ends
+    auto run = [&Worker,&Config]
+    (std::atomic_ulong *at, size_t from, size_t to, PerThread &data) {
+      Worker(at, from, to, data);
+      stats::Flush(Config);
+    };
+
+    unsigned long i;
+    for (i = 0; i != threadcount-1; ++i) {
+      threads.emplace_back(
+        new std::thread(run,
+                        &counter,
+                        i*obj_per_thread,
+                        i*obj_per_thread + obj_per_thread,
+                        std::ref(Data[i])));
+    }
+    threads.emplace_back(
+      new std::thread(run,
+                      &counter,
+                      i*obj_per_thread, Count,
+                      std::ref(Data[i])));
+    if (status) {
+      unsigned long c = 0;
+      while (c != Count) {
+        c = counter.load();
+        StatusPrinter(c, Count, threadcount);
+        usleep(100000);
+      }
+    }
+
+    for (i = 0; i != threadcount; ++i) {
+      threads[i]->join();
+      delete threads[i];
+    }
+    Merger(move(Data));
+    if (status)
+      StatusPrinter(Count, Count, threadcount);
+  }
+
+#endif
+
+} // ::pkgdepdb::thread
+} // ::pkgdepdb
+
+#endif
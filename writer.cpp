@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "main.h"
+#include "writer.h"
+
+namespace pkgdepdb {
+
+Writer::Writer(FILE *file)
+: file_(file)
+{
+  if (file_)
+    buffer_.reserve(kFlush + 1024);
+}
+
+Writer::~Writer() {
+  Flush();
+}
+
+bool Writer::Flush() {
+  if (file_ && !buffer_.empty()) {
+    if (fwrite(buffer_.data(), 1, buffer_.size(), file_) != buffer_.size())
+      failed_ = true;
+    buffer_.clear();
+  }
+  return !failed_;
+}
+
+void Writer::PutDirect(const char *str, size_t length) {
+  Flush();
+  if (fwrite(str, 1, length, file_) != length)
+    failed_ = true;
+}
+
+Writer& Writer::Unsigned(unsigned long value) {
+  char digits[3*sizeof(value)];
+  char *at = digits + sizeof(digits);
+  do {
+    *--at = char('0' + value % 10);
+    value /= 10;
+  } while (value);
+  return Put(at, size_t(digits + sizeof(digits) - at));
+}
+
+// Whether any of the 8 bytes in the word is a quote, a backslash or a
+// control character, which are the bytes JSONEscape has to look at.
+static inline bool json_special(uint64_t word) {
+  const uint64_t ones = 0x0101010101010101ull;
+  const uint64_t high = 0x8080808080808080ull;
+  uint64_t quote  = word ^ (ones * '"');
+  uint64_t bslash = word ^ (ones * '\\');
+  return (((quote  - ones) & ~quote)  |
+          ((bslash - ones) & ~bslash) |
+          ((word - ones * 0x20) & ~word)) & high;
+}
+
+Writer& Writer::JSONEscape(const string& str) {
+  const char *at  = str.data();
+  const char *end = at + str.length();
+  const char *run = at;
+  while (at != end) {
+    // skip over words which need no escaping
+    while (end - at >= 8) {
+      uint64_t word;
+      memcpy(&word, at, sizeof(word));
+      if (json_special(word))
+        break;
+      at += 8;
+    }
+    if (at == end)
+      break;
+    const char *esc;
+    switch (*at) {
+      case '"':  esc = "\\\""; break;
+      case '\\': esc = "\\\\"; break;
+      case '\b': esc = "\\b"; break;
+      case '\f': esc = "\\f"; break;
+      case '\n': esc = "\\n"; break;
+      case '\r': esc = "\\r"; break;
+      case '\t': esc = "\\t"; break;
+      default:   esc = nullptr; break;
+    }
+    if (esc) {
+      buffer_.append(run, size_t(at - run));
+      buffer_.append(esc, 2);
+      run = at + 1;
+    }
+    ++at;
+  }
+  return Put(run, size_t(end - run));
+}
+
+} // ::pkgdepdb
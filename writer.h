@@ -0,0 +1,76 @@
+#ifndef PKGDEPDB_WRITER_H__
+#define PKGDEPDB_WRITER_H__
+
+namespace pkgdepdb {
+
+// Buffered output for the listings and the JSON export. Text is collected
+// in a buffer which is written to the file whenever it grows past kFlush
+// bytes and when the writer is destroyed. Without a file everything stays
+// in memory, which is used to format output on multiple threads.
+class Writer {
+ public:
+  static const size_t kFlush = 64*1024;
+
+  Writer(FILE *file = nullptr);
+  Writer(Writer&&) = default;
+  ~Writer();
+
+  Writer& Put(char c);
+  Writer& Put(const char *str);
+  Writer& Put(const char *str, size_t length);
+  Writer& Put(const string& str);
+  Writer& Unsigned(unsigned long value);
+  // the string with JSON's escape sequences applied, without quotes
+  Writer& JSONEscape(const string& str);
+  Writer& JSONQuote (const string& str);
+
+  // returns false if writing to the file failed at any point
+  bool          Flush();
+  const string& Data() const { return buffer_; }
+
+ private:
+  void FlushFull() {
+    if (file_ && buffer_.size() >= kFlush)
+      Flush();
+  }
+  // write a block too large for the buffer directly
+  void PutDirect(const char *str, size_t length);
+
+  FILE   *file_;
+  string  buffer_;
+  bool    failed_ = false;
+};
+
+inline Writer& Writer::Put(char c) {
+  buffer_.push_back(c);
+  FlushFull();
+  return *this;
+}
+
+inline Writer& Writer::Put(const char *str, size_t length) {
+  if (file_ && length >= kFlush) {
+    PutDirect(str, length);
+    return *this;
+  }
+  buffer_.append(str, length);
+  FlushFull();
+  return *this;
+}
+
+inline Writer& Writer::Put(const char *str) {
+  return Put(str, std::char_traits<char>::length(str));
+}
+
+inline Writer& Writer::Put(const string& str) {
+  return Put(str.data(), str.length());
+}
+
+inline Writer& Writer::JSONQuote(const string& str) {
+  buffer_.push_back('"');
+  JSONEscape(str);
+  return Put('"');
+}
+
+} // ::pkgdepdb
+
+#endif